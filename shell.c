@@ -6,27 +6,56 @@
  *
  * An implementation of a simple UNIX shell.  This program supports:
  *
- *     - Running processes
- *     - Redirecting standard output (>)
- *     - Redirecting standard input (<)
- *     - Appending standard output to a file (>>)
- *     - Redirecting both standard output and standard input (&>)
+ *     - Running processes, found on $PATH when named without a slash, with
+ *       missing commands remembered ('command -v' to probe for one)
+ *     - Redirecting any file descriptor to or from a file ([n]>, [n]>>, [n]<,
+ *       [n]<>), including standard output and standard error together (&>,
+ *       &>>)
+ *     - Duplicating and closing file descriptors ([n]>&m, [n]<&m, [n]>&-)
+ *     - Replacing the shell with a program, or keeping descriptors open for
+ *       the commands that follow ('exec', 'exec 3>>log')
  *     - Creating process pipelines (p1 | p2 | ...)
  *     - Interrupting a running process (i.e., Ctrl-C)
- *     - A built-in version of the 'ls' command
- *     - A built-in version of the 'rm' command
+ *     - A built-in version of the 'ls' command (with -l, -a, -R, -S and -t)
+ *     - Built-in versions of the 'rm' and 'echo' commands
+ *     - Shell variables (name=value, $name, ${name}, $?, $$), with names the
+ *       shell has not set taken from the environment
+ *     - The ${...} string operators: ${#name}, ${name#pat}, ${name%pat},
+ *       ${name/pat/rep}, ${name:off:len} and ${name^}/${name,} case conversion
+ *     - Built-in 'read' and 'mapfile' commands that read ahead rather than a
+ *       byte at a time
+ *     - Indexed and associative arrays (name=(a b c), name[key]=value,
+ *       'declare -A', ${name[key]}, ${name[@]}, ${#name[@]}, ${!name[@]})
+ *     - Built-in '[[' (==, != and =~) and 'case' commands that test words
+ *       against patterns compiled once and cached ('matchcache on|off')
+ *     - An fd leak audit ('fdaudit on', or SHELL_FD_AUDIT in the environment)
+ *     - Launching often-used programs from cached descriptors ('execcache on',
+ *       or SHELL_EXEC_CACHE in the environment)
+ *     - Keeping files appended to open between commands ('appendcache'), and
+ *       combining consecutive 'echo' appends into one write ('appendcache
+ *       combine', or SHELL_APPEND_COMBINE in the environment)
+ *     - Restricting how redirection targets are resolved ('redirpolicy')
+ *     - Built-in 'cd', 'pushd', 'popd' and 'dirs' commands
+ *     - A built-in 'hashsum' command (SHA-256, CRC32C or XXH64 over many files)
+ *     - Built-in 'cut', 'uniq' and 'tr' commands
+ *     - A built-in 'xargs' command that packs arguments up to ARG_MAX
+ *     - Built-in 'seq' and 'yes' generators
+ *     - Running a command line on many agents at once ('fanout'), where an
+ *       agent is a shell started with --serve (over TCP only with a shared
+ *       secret in SHELL_AGENT_SECRET)
+ *     - Sharing tasks out among local and remote agents ('parallel')
+ *     - Running a command in namespaces of its own ('sandbox'), taken from a
+ *       pool made ahead of time
+ *     - Running a command line in the background (p1 &) and listing the jobs
+ *       ('jobs')
+ *     - Piping/IO redirection for built-in commands (all but the short ones,
+ *       and any in a pipeline, run in a child)
  *
  * Among the many things it does _NOT_ support are:
  *
- *     - PATH searching -- you must supply the absolute path to all programs
- *       (e.g., /bin/ls instead of just ls)
- *     - Environment variables
- *     - Appending standard error to a file (2>>)
- *     - Appending both standard output and standard input (2&>)
- *     - Backgrounding processes (p1&)
+ *     - Exporting variables to the environment
  *     - Unconditionally chaining processes (p1;p2)
  *     - Conditionally chaining processes (p1 && p2 or p1 || p2)
- *     - Piping/IO redirection for built-in commands
  *
  * Keep in mind that this program was written to be easily understood/modified
  * for educational purposes.  The author makes no claim that this is the
@@ -36,39 +65,115 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <dirent.h>
+#include <errno.h>
 #include "shellParser.h"
+#include "shellRedirect.h"
+#include "shellFd.h"
+#include "shellDirs.h"
+#include "shellLs.h"
+#include "shellHash.h"
+#include "shellText.h"
+#include "shellXargs.h"
+#include "shellGen.h"
+#include "shellAgent.h"
+#include "shellFanout.h"
+#include "shellParallel.h"
+#include "shellSandbox.h"
+#include "shellJobs.h"
+#include "shellSpawn.h"
+#include "shellExec.h"
+#include "shellPath.h"
+#include "shellAppend.h"
+#include "shellVars.h"
+#include "shellExpand.h"
+#include "shellRead.h"
+#include "shellMatch.h"
 
 /* Macros to test whether a process ID is a parent's or a child's. */
 #define PARENT_PID(pid) ((pid) > 0)
 #define CHILD_PID(pid)  ((pid) == 0)
 
+/* A command the shell implements itself */
+typedef struct {
+    const char* name;
+    int       (*function)(char** args);  /* Returns the exit status */
+    bool        runsInShell;             /* Short: runs in the shell when it is on its own */
+} Builtin;
 
 /* Function prototypes */
 static char** promptAndRead(void);
-static pid_t  forkWrapper(void);
-static void   pipeWrapper(int fds[]);
 static int    dupWrapper(int fd);
 static bool   isSpecial(char* token);
 static void   signalHandler();
 
 static void   parseArgs(char** args, char** line, int* lineIndex);
-static void   continueProcessingLine(char** line, int* lineIndex, char** args);
-static void   doAppendRedirection(char* filename);
-static void   doStdoutRedirection(char* filename);
-static void   doStderrRedirection(char* filename);
-static void   doStdoutStderrRedirection(char* filename);
-static void   doStdinRedirection(char* filename);
-static void   doPipe(char** p1Args, char** line, int* lineIndex);
-static void   doLs(char** args);
-static void   doRm(char** args);
-static void   run(char** args);
+static bool   buildPlan(char** line, SpawnPlan* plan);
+static void   noteRedirections(char** line, int lineIndex);
+static bool   onlyAppends(char** line, int lineIndex);
+static int    doRm(char** args);
+static int    doEcho(char** args);
+static int    doFdAudit(char** args);
+static int    doCommand(char** args);
+static int    doExec(char** args);
+static int    runExec(char** line, SpawnPlan* plan);
+static bool   isPipeline(char** line);
+static const Builtin* findBuiltin(const char* name);
+static int    runCommandLine(char** line);
+static int    runExpandedLine(char** line);
+static int    assignLine(char** line);
+static int    runAgentLine(char** line);
+static char*  readScript(const char* path);
+static int    runScript(char* text);
+static bool   isBlankLine(const char* text);
+
+/*
+ * The built-in commands.  The short ones, which never work through a
+ * stream of input or output or a tree of files, run in the shell itself
+ * when they are on their own, with any redirections set up over the
+ * shell's descriptors and undone afterwards.  The others (the filters,
+ * generators, ls, rm, xargs and the like) always run in a child, as any
+ * builtin does in a pipeline or in the background, so that Ctrl-C can
+ * stop them.
+ */
+static const Builtin builtins[] = {
+    { "ls",          doLs,          false },
+    { "rm",          doRm,          false },
+    { "echo",        doEcho,        true  },
+    { "read",        doRead,        true  },
+    { "mapfile",     doMapfile,     true  },
+    { "declare",     doDeclare,     true  },
+    { "[[",          doTest,        true  },
+    { "case",        doCase,        true  },
+    { "matchcache",  doMatchCache,  true  },
+    { "fdaudit",     doFdAudit,     true  },
+    { "execcache",   doExecCache,   true  },
+    { "appendcache", doAppendCache, true  },
+    { "command",     doCommand,     true  },
+    { "exec",        doExec,        true  },
+    { "redirpolicy", doRedirPolicy, true  },
+    { "cd",          doCd,          true  },
+    { "pushd",       doPushd,       true  },
+    { "popd",        doPopd,        true  },
+    { "dirs",        doDirs,        true  },
+    { "hashsum",     doHashsum,     false },
+    { "cut",         doCut,         false },
+    { "uniq",        doUniq,        false },
+    { "tr",          doTr,          false },
+    { "xargs",       doXargs,       false },
+    { "seq",         doSeq,         false },
+    { "yes",         doYes,         false },
+    { "fanout",      doFanout,      false },
+    { "parallel",    doParallel,    false },
+    { "sandbox",     doSandbox,     false },
+    { "jobs",        doJobs,        true  },
+};
 
 /*
  * A global variable representing the process ID of this shell's child.  When the value of this
@@ -76,57 +181,71 @@ static void   run(char** args);
  */
 static pid_t childPid = 0;
 
+/* Whether to print each child's exit status (not when serving as an agent or running a script) */
+static bool reportChildren = true;
+
+/* The line being run is the last of a script, so its command may replace the shell */
+static bool lastLine = false;
+
 /*
- * Entry point of the application
+ * Entry point of the application.  "shell --serve endpoint" runs the shell
+ * as an agent for 'fanout' instead of reading commands from the keyboard;
+ * "shell -c 'command line'" and "shell script" run the given lines and exit
+ * with the status of the last.
  */
-int main(void) {
+int main(int argc, char** argv) {
     char** line;
 
     /*registerring a custom signal handler function to handle ctrl+shift+c */
-    signal(SIGINT, signalHandler);
-
+    setShellSignal(SIGINT, signalHandler);
 
-    /* Read a line of input from the keyboard */
-    line = promptAndRead();
-
-    /* While the line was blank or the user didn't type exit */
-    while (line[0] == NULL || (strcmp(line[0], "exit") != 0)) {
-        int lineIndex = 0; /* An index into the line array */
-
-        /* Ignore blank lines */
-        if (line[lineIndex] != NULL) {
-            int   status;
-            char* args[MAX_ARGS]; /* A processes arguments */
+    if (getenv("SHELL_FD_AUDIT") != NULL) {
+        setFdAudit(true);
+    }
+    if (getenv("SHELL_EXEC_CACHE") != NULL) {
+        setExecCache(true);
+    }
+    if (getenv("SHELL_APPEND_COMBINE") != NULL) {
+        setAppendCache(true, true);
+    }
 
-            /* Dig out the arguments for a single process */
-            parseArgs(args, line, &lineIndex);
+    /* Cache a descriptor for the current directory; redirections open relative to it */
+    initDirs();
 
-            if (strcmp(args[0], "ls") == 0) {
-                doLs(args);
-            } else if (strcmp(args[0], "rm") == 0) {
-                doRm(args);
-            } else {
-                /* Fork off a child process */
-                childPid = forkWrapper();
+    /* Zygotes for 'sandbox' start on first use, or now if $SHELL_SANDBOX_POOL is set */
+    if (getenv("SHELL_SANDBOX_POOL") != NULL) {
+        initSandboxPool(atoi(getenv("SHELL_SANDBOX_POOL")), true);
+    } else {
+        initSandboxPool(SANDBOX_POOL_DEFAULT, false);
+    }
 
-                if (CHILD_PID(childPid)) {
-                    /* The child shell continues to process the command line */
-                    continueProcessingLine(line, &lineIndex, args);
-                } else {
-                    long wait = 0;
-                    do{
-                     wait =( long)waitpid(childPid, &status, WUNTRACED);
-                    }while(!WIFEXITED(status) && !WIFSIGNALED(status));
+    /* Agents (remote, or local ones started by 'parallel') run lines like we do */
+    setLineRunner(runAgentLine);
 
-                    printf("Child %ld exited with status %d \n", wait, status);
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+        return serveAgent(argv[2]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "-c") == 0) {
+        return runScript(strdup(argv[2]));
+    }
+    if (argc >= 2 && argv[1][0] != '-') {
+        char* text = readScript(argv[1]);
 
+        return text != NULL ? runScript(text) : 127;
+    }
 
+    /* Read a line of input from the keyboard */
+    line = promptAndRead();
 
-                }
-            }
+    /* While the line was blank or the user didn't type exit */
+    while (line[0] == NULL || (strcmp(line[0], "exit") != 0)) {
+        /* Ignore blank lines */
+        if (line[0] != NULL) {
+            runCommandLine(line);
         }
 
-        /* Read the next line of input from the keyboard */
+        /* Say which background jobs have finished, then read the next line */
+        reportJobs();
         line = promptAndRead();
     }
 
@@ -134,223 +253,407 @@ int main(void) {
     return 0;
 }
 
-
 /*
- * continueProcessingLine
- *
- * This function continues to process a line read in from the user.  This processing can include
- * append redirection, stderr redirection, etc.  Note that this function operates recursively; it
- * breaks off a piece associated with a process until it gets to something "special", decides what
- * to do with that "special" thing, and then calls itself to handle the rest.  The base case of
- * the recursion is when the end of the 'line' array is reached (i.e., when line[*lineIndex] ==
- * NULL).
- *
- * line      - An array of pointers to string corresponding to ALL of the tokens entered on the
- * command line.
- * lineIndex - A pointer to the index of the next token to be processed
- * args      - A NULL terminated array of string corresponding to the arguments for a process
- * (i.e., stuff that was already parsed off of line).
+ * runCommandLine
+ *
+ * Runs the (non-blank) command line 'line', just scanned: sets the variables if it is only
+ * assignments, otherwise expands its words and runs it (see runExpandedLine()).  The status is
+ * kept for $?.
+ *
+ * Returns the exit status of the command line.
  */
-static void continueProcessingLine(char** line, int* lineIndex, char** args) {
-    if (line[*lineIndex] == NULL) { /* Base case -- nothing left in line */
-        run(args);
-
-    } else if (strcmp(line[*lineIndex], ">>") == 0) {
-        (*lineIndex)++;
-        doAppendRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], "2>") == 0) {
-        (*lineIndex)++;
-        doStderrRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], "&>") == 0) {
-        (*lineIndex)++;
-        doStdoutStderrRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], ">") == 0) {
-        (*lineIndex)++;
-        doStdoutRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], "<") == 0) {
-        (*lineIndex)++;
-        doStdinRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], "|") == 0) {
-        (*lineIndex)++;
-        doPipe(args, line, lineIndex);
-        /* doPipe() calls continueProcessingLine() only in some cases */
+static int runCommandLine(char** line) {
+    char** words  = expandLine(line);
+    int    status = 1;
+
+    if (words != NULL && isAssignmentLine(line)) {
+        status = assignLine(words);
+    } else if (words != NULL) {
+        status = runExpandedLine(words);
     }
+    setLastStatus(status);
+    return status;
 }
 
 /*
- * doPipe
+ * assignLine
  *
- * Implements a pipe between two processes.
+ * Carries out the assignments (name=value, name[key]=value and name=(item ...)) that make up the
+ * expanded command line 'line'.
  *
- * p1Args    - The arguments for the left-hand-side command.
- * line      - An array of pointers to string corresponding to ALL of the
- *             tokens entered on the command line.
- * lineIndex - A pointer to the index of the next token to be processed.
- *             This index should point to one element beyond the pipe
- *             symbol.
+ * Returns 0, or 1 if one could not be made.
  */
-static void doPipe(char** p1Args, char** line, int* lineIndex) {
-    int   pipefd[2]; /* Array of integers to hold 2 file descriptors. */
-    pid_t pid;       /* PID of a child process */
-
-    pipeWrapper(pipefd);
-
-    /* Fork the current process */
-    pid = forkWrapper();
+static int assignLine(char** line) {
+    const char* quotes = getWordQuotes();
+    int         status = 0;
+    int         taken;
+    int         i;
+
+    for (i = 0; line[i] != NULL; i += taken) {
+        taken = 1;
+        if (isListAssignment(line[i])) {
+            if ((taken = assignList(line + i, quotes + i)) < 0) {
+                return 1;
+            }
+        } else if (!assignVar(line[i])) {
+            status = 1;
+        }
+    }
+    return status;
+}
 
-    if (CHILD_PID(pid)) { /* Child -- will execute left-hand-side process */
-        close(pipefd[0]);//closes child process input side of pipe
-        dup2(pipefd[1], STDOUT_FILENO);
-        run(p1Args);
+/*
+ * runExpandedLine
+ *
+ * Runs the expanded command line 'line': a builtin on its own runs in the shell itself, anything
+ * else as a pipeline of children started from a spawn plan, which the shell waits for.
+ *
+ * Returns the exit status of the command line.
+ */
+static int runExpandedLine(char** line) {
+    static SpawnPlan plan;               /* Large; the shell starts one line at a time */
+    int              lineIndex = 0;      /* An index into the line array */
+    int              status    = 0;
+    char*            args[MAX_ARGS + 1]; /* A processes arguments */
+    const Builtin*   builtin;
+    bool             background = false;
+    int              length;
+
+    /* A trailing "&" runs the line in the background */
+    for (length = 0; line[length] != NULL; ++length) {
+    }
+    if (length > 0 && strcmp(line[length - 1], "&") == 0) {
+        line[length - 1] = NULL;
+        background       = true;
+        if (line[0] == NULL) {
+            return 0;
+        }
+        if (!canAddJob()) {
+            printf("Too many background jobs\n");
+            return 1;
+        }
+    }
 
-    } else {  /* Parent will keep going */
-        char* args[MAX_ARGS];
-        close(pipefd[1]); //parent closes ouput side of pipe
+    /* Dig out the arguments for a single process */
+    parseArgs(args, line, &lineIndex);
+    builtin = args[0] != NULL ? findBuiltin(args[0]) : NULL;
 
-        printf("right before doing read in parent pipe \n");
+    /* Whatever reads next gets what read and mapfile read ahead, unless they carry on with it */
+    if (builtin == NULL || (builtin->function != doRead && builtin->function != doMapfile)
+            || background || isPipeline(line)) {
+        syncReadBuffers();
+    }
 
-        dup2(pipefd[0],STDIN_FILENO);
-        //line = read(pipefd[0], lineIndex, FILE_LENGTH); // reads in args
+    if (builtin != NULL && builtin->function == doExec && !background && !isPipeline(line)) {
+        /* Its redirections are the shell's own, or it replaces the shell */
+        flushAppends();
+        status = runExec(line, &plan);
+    } else if (builtin != NULL && builtin->runsInShell && line[lineIndex] == NULL && !background) {
+        /* A short builtin on its own runs in the shell */
+        flushAppends();
+        status = builtin->function(args);
+    } else {
+        /* Let often-used redirection directories get cached descriptors */
+        noteRedirections(line, lineIndex);
 
-        //delete this next line
-        printf("Finish parent pipe ");
+        /* A background job gets a process group of its own, out of Ctrl-C's way */
+        plan.pgid = background ? 0 : -1;
 
+        /* Held-back echo output is written before the targets are opened (and maybe truncated),
+           unless this is another echo that only appends */
+        if (builtin == NULL || builtin->function != doEcho || background || isPipeline(line)
+                || !onlyAppends(line, lineIndex)) {
+            flushAppends();
+        }
 
+        if (!buildPlan(line, &plan) || !prepareSpawnPlan(&plan)) {
+            status = 1;
+        } else if (builtin != NULL && builtin->runsInShell && !background && plan.count == 1
+                   && runSpawnBuiltin(&plan, builtin->function == doEcho, &status)) {
+            /* A short builtin with redirections runs in the shell too; only echo's output is combined */
+        } else if (lastLine && !background && plan.count == 1 && plan.stages[0].builtin == NULL
+                   && !jobsRunning()) {
+            /* Nothing follows, so rather than wait for it, become it */
+            execSpawnPlan(&plan);
+        } else {
+            pid_t pids[SPAWN_MAX_STAGES];
+            int   i;
+
+            startSpawnPlan(&plan);
+            for (i = 0; i < plan.count; ++i) {
+                pids[i] = plan.stages[i].pid;
+            }
+            childPid = pids[plan.count - 1];
 
+            if (background) {
+                /* The job is known by its last process */
+                for (i = plan.count - 1; i > 0 && pids[i] <= 0; --i) {
+                }
+                if (pids[i] > 0) {
+                    int id = addJob(pids[i], line);
 
-        /* Read the args for the next process in the pipeline */
-        parseArgs(args, line, lineIndex);
+                    if (reportChildren) {
+                        printf("[%d] %ld\n", id, (long) pids[i]);
+                    }
+                }
+                status = pids[i] > 0 ? 0 : 1;
+            } else {
+                status = waitForForeground(pids, plan.count, NULL);
 
-        /* And keep going... */
-        continueProcessingLine(line, lineIndex, args);
+                if (reportChildren && childPid > 0) {
+                    printf("Child %ld exited with status %d \n", (long) childPid, status);
+                }
+                status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            }
+            childPid = 0;
+        }
     }
+
+    fdAuditCheck(args[0]);
+    return status;
 }
 
 /*
- * doAppendRedirection
+ * runAgentLine
  *
- * Redirects the standard output of this process to append to the
- * file with the specified name.
+ * Runs a command line sent to us as an agent.  Output goes back to the client,
+ * which gets the status separately, so children's statuses aren't printed.
  *
- * filename - the name of the file to which to append our output
+ * Returns the exit status of the command line.
  */
-static void doAppendRedirection(char* filename) {
-    int file = open(filename, O_CREAT | O_APPEND | O_WRONLY, S_IRWXU);
+static int runAgentLine(char** line) {
+    int status;
+
+    reportChildren = false;
+    lastLine       = false;
+    status         = runCommandLine(line);
+    flushAppends();
+    return status;
+}
 
-    if(file < 0){
-        perror("Error Opening file for append\n");
-        _exit(1);
+/*
+ * readScript
+ *
+ * Returns the contents of the script 'path' as a string (to be freed), or NULL after printing a
+ * message.
+ */
+static char* readScript(const char* path) {
+    struct stat info;
+    char*       text;
+    size_t      length = 0;
+    int         fd     = shellOpen(path, O_RDONLY, 0);
+
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        perror(path);
+        if (fd >= 0) {
+            shellClose(fd);
+        }
+        return NULL;
     }
 
-    dup2(file,STDOUT_FILENO);
+    text = malloc((size_t) info.st_size + 1);
+    while (length < (size_t) info.st_size) {
+        ssize_t count = read(fd, text + length, (size_t) info.st_size - length);
 
-    close(file);
-    
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        length += (size_t) count;
+    }
+    text[length] = '\0';
+    shellClose(fd);
+    return text;
 }
 
 /*
- * doStdoutRedirection
+ * runScript
  *
- * Redirects the standard output of this process to overwrite the
- * file with the specified name.
+ * Runs the lines of 'text' (which this frees) one after another, as 'shell -c' and 'shell script'
+ * do.  Blank lines and lines starting with '#' are skipped; "exit [status]" stops early.  The
+ * command on the last line may replace the shell rather than run in a child (see
+ * execSpawnPlan()).
  *
- * filename - the name of the file which to overwrite
+ * Returns the exit status of the last line run.
  */
-static void doStdoutRedirection(char* filename) {
-    int file = open(filename, O_CREAT | O_TRUNC | O_WRONLY, S_IRWXU);
+static int runScript(char* text) {
+    char* last   = NULL;  /* Start of the last line with a command */
+    char* next;
+    int   status = 0;
+
+    reportChildren = false;
 
-    if(file < 0){
-        perror("Error Opening file for Stdout\n");
-        _exit(1);
+    for (next = text; next != NULL; ) {
+        char* end = strchr(next, '\n');
+
+        if (!isBlankLine(next)) {
+            last = next;
+        }
+        next = end != NULL ? end + 1 : NULL;
     }
 
-    dup2(file,STDOUT_FILENO);
+    for (next = text; next != NULL; ) {
+        char*  start = next;
+        char*  end   = strchr(next, '\n');
+        char** line;
+
+        if (end != NULL) {
+            *end = '\0';
+        }
+        next = end != NULL ? end + 1 : NULL;
+        if (isBlankLine(start)) {
+            continue;
+        }
+
+        line = getArgListFromString(start);
+        if (line[0] == NULL) {
+            continue;
+        }
+        if (strcmp(line[0], "exit") == 0) {
+            if (line[1] != NULL) {
+                status = atoi(line[1]);
+            }
+            break;
+        }
+
+        lastLine = (start == last);
+        status   = runCommandLine(line);
+    }
 
-    close(file);
+    free(text);
+    flushAppends();
+    fflush(stdout);
+    return status;
 }
 
 /*
- * doStderrRedirection
- *
- * Redirects the standard error of this process to overwrite the
- * file with the specified name.
+ * isBlankLine
  *
- * filename - the name of the file which to overwrite
+ * Returns true if the line starting at 'text' (ended by a newline or NUL) has nothing on it but
+ * blanks or a comment.
  */
-static void doStderrRedirection(char* filename){
-    int file = open(filename, O_CREAT | O_TRUNC | O_WRONLY, S_IRWXU);
-
-    if(file < 0){
-        perror("Error Opening file for Stdout\n");
-        _exit(1);
+static bool isBlankLine(const char* text) {
+    while (*text == ' ' || *text == '\t') {
+        text++;
     }
-
-    dup2(file,STDERR_FILENO);
-    close(file);
+    return *text == '\0' || *text == '\n' || *text == '#';
 }
 
+
 /*
- * doStdoutStderrRedirection
+ * buildPlan
+ *
+ * Splits the command line into the processes of a pipeline, collecting each one's arguments and
+ * redirections into a stage of 'plan'.  A builtin is looked up here, so the child that runs it
+ * need not.
  *
- * Redirects the standard output AND standard error of this process to
- * overwrite the file with the specified name.
+ * line - An array of pointers to string corresponding to ALL of the tokens entered on the
+ *        command line.
+ * plan - The plan to fill in; its process group is left alone.
  *
- * filename - the name of the file which to overwrite
+ * Returns false, after printing a message, if a redirection is malformed or the pipeline is too
+ * long.
  */
-static void doStdoutStderrRedirection(char* filename) {
+static bool buildPlan(char** line, SpawnPlan* plan) {
+    SpawnStage* stage;
+    int         lineIndex = 0;
+    int         argCount  = 0;
+    int         i;
+
+    plan->count = 0;
+    if ((stage = addSpawnStage(plan)) == NULL) {
+        return false;
+    }
 
-    int file = open(filename, O_CREAT | O_TRUNC | O_WRONLY, S_IRWXU);
+    while (line[lineIndex] != NULL) {
+        if (strcmp(line[lineIndex], "|") == 0) {
+            lineIndex++;
+            stage->argv[argCount] = NULL;
+            if ((stage = addSpawnStage(plan)) == NULL) {
+                return false;
+            }
+            argCount = 0;
+
+        } else if (isRedirection(line[lineIndex])) {
+            char* op     = line[lineIndex++];
+            char* target = NULL;
 
-    if(file < 0){
-        perror("Error Opening file for Stdout\n");
-        _exit(1);
+            if (redirectionNeedsTarget(op)
+                    && line[lineIndex] != NULL && !isSpecial(line[lineIndex])) {
+                target = line[lineIndex++];
+            }
+            if (!addRedirection(&stage->actions, op, target)) {
+                return false;
+            }
+
+        } else {
+            /* Arguments, possibly following a redirection (e.g., cmd > file arg) */
+            parseArgs(stage->argv + argCount, line, &lineIndex);
+            while (stage->argv[argCount] != NULL) {
+                argCount++;
+            }
+        }
     }
+    stage->argv[argCount] = NULL;
 
-    dup2(file,STDOUT_FILENO);
-    dup2(file,STDERR_FILENO);
+    for (i = 0; i < plan->count; ++i) {
+        const Builtin* builtin;
 
-    close(file);
+        stage = &plan->stages[i];
+        if (stage->argv[0] != NULL && (builtin = findBuiltin(stage->argv[0])) != NULL) {
+            stage->builtin = builtin->function;
+        }
+
+        /* Not found leaves it NULL; the stage is then not started */
+        if (stage->builtin == NULL && stage->argv[0] != NULL) {
+            stage->path = findCommand(stage->argv[0], stage->found, sizeof(stage->found));
+        }
+    }
+    return true;
 }
 
 /*
- * doStdinRedirection
+ * noteRedirections
  *
- * Redirects the standard input to this process from the file with the
- * specified name.
+ * Tells the directory cache about every redirection target from line[lineIndex] onward.  This
+ * is done in the shell itself, before forking, so the descriptors it caches are inherited by
+ * (and outlive) the children that do the opening.
  *
- * filename - the name of the file from which to read as standard input.
+ * line      - An array of pointers to string corresponding to ALL of the
+ *             tokens entered on the command line.
+ * lineIndex - The index of the first token to look at.
  */
-static void doStdinRedirection(char* filename) {
-    int file = open(filename, O_RDONLY, S_IRWXU);
-
-    if(file < 0){
-        perror("Error Opening file for Stdin\n");
-        _exit(1);
+static void noteRedirections(char** line, int lineIndex) {
+    for (; line[lineIndex] != NULL; ++lineIndex) {
+        if (isRedirection(line[lineIndex]) && redirectionNeedsTarget(line[lineIndex])
+                && line[lineIndex + 1] != NULL) {
+            noteRedirectDir(line[lineIndex + 1]);
+        }
     }
+}
 
-    dup2(file,STDIN_FILENO);
+/*
+ * onlyAppends
+ *
+ * Returns true if every redirection from line[lineIndex] onward that opens a file appends to
+ * it (>> or &>>).
+ *
+ * line      - An array of pointers to string corresponding to ALL of the
+ *             tokens entered on the command line.
+ * lineIndex - The index of the first token to look at.
+ */
+static bool onlyAppends(char** line, int lineIndex) {
+    for (; line[lineIndex] != NULL; ++lineIndex) {
+        size_t length = strlen(line[lineIndex]);
 
-    close(file);
+        if (isRedirection(line[lineIndex]) && redirectionNeedsTarget(line[lineIndex])
+                && (length < 2 || strcmp(line[lineIndex] + length - 2, ">>") != 0)) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /*
@@ -385,44 +688,11 @@ static void parseArgs(char** args, char** line, int* lineIndex) {
  * the array corresponds to a token from the input line.
  */
 static char** promptAndRead(void) {
+    flushAppends();
     printf("(%d) $ ", getpid());
     return getArgList();
 }
 
-/*
- * forkWrapper
- *
- * A simple wrapper around the 'fork' system call that attempts to
- * invoke fork and on failure, prints an appropriate message and
- * terminates the process.
- */
-static pid_t forkWrapper(void) {
-    pid_t pid = fork();
-
-    if (pid < 0) {
-        perror("fork");
-        _exit(2);
-    }
-
-    return pid;
-}
-
-/*
- * pipeWrapper
- *
- * A simple wrapper around the 'pipe' system call that attempts to invoke
- * pipe and on failure, prints an appropriate message and terminates the
- * process.
- */
-static void pipeWrapper(int pipefds[]) {
-    int pipeNo = -1;
-
-    if((pipeNo = pipe(pipefds)) < 0) {
-        perror("pipe");
-        _exit(4);
-    }
-}
-
 /*
  * dupWrapper
  *
@@ -433,7 +703,7 @@ static void pipeWrapper(int pipefds[]) {
 static int dupWrapper(int oldfd) {
     int newfd = -1;
 
-    if ((newfd = dup(oldfd)) < 0) {
+    if ((newfd = shellDup(oldfd)) < 0) {
         perror("dup");
         _exit(3);
     }
@@ -445,82 +715,223 @@ static int dupWrapper(int oldfd) {
  * isSpecial
  *
  * Returns true if the specified token is "special" (i.e., is an
- * operator like >, >>, |, <); false otherwise.
+ * operator like >, >>, 2>&1, |, <); false otherwise.
  */
 static bool isSpecial(char* token) {
-    return    (strlen(token) == 1 && strchr("<>|", token[0]) != NULL)
-           || (strlen(token) == 2 && strchr(">",   token[1]) != NULL);
+    return strcmp(token, "|") == 0 || isRedirection(token);
 }
 
 /**
- * doLs
+ * doRm
  *
- * Implements a built-in version of the 'ls' command.
+ * Implements a built-in version of the 'rm' command.
  *
  * args - An array of strings corresponding to the command and its arguments.
- *        If args[1] is NULL, the current directory (./) is assumed; otherwise
- *        it specifies the directory to list.
- *
- *        NOTE: currently lists all files and subdirectories along with . and ..
- *        pending fix depending on Dr. K's response
+ *        args[0] is "rm", additional arguments are in args[1] ... n.
+ *        args[x] = NULL indicates the end of the argument list.
  */
-static void doLs(char** args) {
+static int doRm(char** args) {
+    if(args[1] == NULL){
+        printf("ERROR: No File Specified \n");
+        return 1;
+    } else{
+        int i = 1;
+        while (args[i] != NULL){
+            unlink(args[i]);
+            i++;
+        }
+    }
+    return 0;
+}
 
-    DIR *directory;
-    struct dirent *file;
+/**
+ * doEcho
+ *
+ * Implements a built-in version of the 'echo' command: prints its arguments separated by spaces,
+ * and a newline unless the first argument is "-n".
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+static int doEcho(char** args) {
+    bool newline = true;
+    int  i       = 1;
 
-    if(args[1] == NULL){
-        directory = opendir("./");
-    }else{
-        directory = opendir(args[1]);
-    }
-    if(directory != NULL){
-        while((file = readdir(directory)) != NULL){
-            printf(file->d_name);
-            printf(" \n");
+    if (args[1] != NULL && strcmp(args[1], "-n") == 0) {
+        newline = false;
+        i       = 2;
+    }
+    for (; args[i] != NULL; ++i) {
+        fputs(args[i], stdout);
+        if (args[i + 1] != NULL) {
+            putchar(' ');
         }
-        closedir(directory);
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return 0;
+}
+
+/**
+ * doFdAudit
+ *
+ * Implements the built-in 'fdaudit' command, which turns the fd leak audit
+ * on or off.  While it is on, descriptors left open in the shell after a
+ * command are reported along with the code site that created them.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        args[1] is "on" or "off"; with no argument the current state is
+ *        printed.
+ */
+static int doFdAudit(char** args) {
+    if (args[1] == NULL) {
+        printf("fdaudit is %s\n", fdAuditEnabled() ? "on" : "off");
+    } else if (strcmp(args[1], "on") == 0) {
+        setFdAudit(true);
+    } else if (strcmp(args[1], "off") == 0) {
+        setFdAudit(false);
     } else {
-        perror("opendir");
+        printf("usage: fdaudit [on|off]\n");
     }
+    return 0;
 }
 
 /**
- * doRm
+ * doCommand
  *
- * Implements a built-in version of the 'rm' command.
+ * Implements the built-in 'command -v', which says what each named command would run: the name
+ * of a builtin, or the path of a program.
  *
  * args - An array of strings corresponding to the command and its arguments.
- *        args[0] is "rm", additional arguments are in args[1] ... n.
- *        args[x] = NULL indicates the end of the argument list.
+ *        args[1] is "-v" and args[2] ... n are the commands to look for.
+ *
+ * Returns 0 if every command was found, 1 otherwise.
  */
-static void doRm(char** args) {
-    if(args[1] == NULL){
-        printf("ERROR: No File Specified \n");
-    } else{
-        int i = 1;
-        while (args[i] != NULL){
-            unlink(args[i]);
-            i++;
+static int doCommand(char** args) {
+    char found[PATH_MAX];
+    int  status = 0;
+    int  i;
+
+    if (args[1] == NULL || strcmp(args[1], "-v") != 0 || args[2] == NULL) {
+        printf("usage: command -v name ...\n");
+        return 1;
+    }
+
+    for (i = 2; args[i] != NULL; ++i) {
+        const char* path;
+
+        if (findBuiltin(args[i]) != NULL) {
+            printf("%s\n", args[i]);
+        } else if ((path = findCommand(args[i], found, sizeof(found))) != NULL
+                   && access(path, X_OK) == 0) {
+            printf("%s\n", path);
+        } else {
+            status = 1;
         }
     }
+    return status;
 }
 
 /**
- * run
+ * doExec
+ *
+ * Implements the built-in 'exec' where it cannot change the shell (in a pipeline or in the
+ * background, so in a child): runs the program named by args[1] in place of the child.  See
+ * runExec() for the usual case.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        args[1] ... n are the program and its arguments.
+ *
+ * Returns the exit status of the command (only if the program cannot be run).
+ */
+static int doExec(char** args) {
+    char        found[PATH_MAX];
+    const char* path;
+
+    if (args[1] == NULL) {
+        return 0;
+    }
+    if ((path = findCommand(args[1], found, sizeof(found))) == NULL) {
+        fprintf(stderr, "%s: command not found\n", args[1]);
+        return 127;
+    }
+    fflush(stdout);
+    execv(path, args + 1);
+    perror("execv");
+    return 126;
+}
+
+/*
+ * runExec
+ *
+ * Runs the line 'line', an 'exec' on its own, in the shell: with a program it replaces the shell
+ * (its redirections applied, as for any command); with only redirections they are carried out in
+ * the shell and stay in effect for the commands that follow.  Builtins are not looked up: exec
+ * runs programs.
+ *
+ * line - An array of pointers to string corresponding to ALL of the tokens entered on the
+ *        command line.
+ * plan - A plan to build the command in.
+ *
+ * Returns the exit status of the command (only if the shell is not replaced).
+ */
+static int runExec(char** line, SpawnPlan* plan) {
+    SpawnStage* stage;
+    int         i;
+
+    if (!buildPlan(line, plan)) {
+        return 1;
+    }
+    stage = &plan->stages[0];
+
+    if (stage->argv[1] == NULL) {
+        return applyShellRedirections(&stage->actions) ? 0 : 1;
+    }
+
+    for (i = 0; stage->argv[i] != NULL; ++i) {
+        stage->argv[i] = stage->argv[i + 1];
+    }
+    stage->builtin = NULL;
+    stage->path    = findCommand(stage->argv[0], stage->found, sizeof(stage->found));
+    plan->pgid     = -1;
+
+    if (!prepareSpawnPlan(plan) || !stage->ready) {
+        return 1;
+    }
+    execSpawnPlan(plan);
+    return 1;
+}
+
+/*
+ * isPipeline
  *
- * runs the program specified by its exact filepath contained in args[0]
+ * Returns true if the command line 'line' has more than one process.
+ */
+static bool isPipeline(char** line) {
+    int i;
+
+    for (i = 0; line[i] != NULL; ++i) {
+        if (strcmp(line[i], "|") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * findBuiltin
  *
- * args - An array of strings corresponding to the command and it's arguments.
- *        args[0] is unknown, but should be a valid process
- *        args[1] - args[n] are additional arguments
- *        args[x] = NULL indicating the end of the argument list
+ * Returns the built-in command called 'name', or NULL if there is none.
  */
-static void run(char** args){
-    if(execv(args[0], args) == -1){
-            perror("execv");
-            _exit(1);
+static const Builtin* findBuiltin(const char* name) {
+    size_t i;
+
+    for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return &builtins[i];
         }
+    }
+    return NULL;
 }
 
 /**
@@ -0,0 +1,684 @@
+/*
+ * shellAgent.c
+ *
+ * The agent side of "shell --serve", and the connection and framing code
+ * its clients share (see shellAgent.h).
+ *
+ * An agent forks a handler for each connection.  The handler checks the
+ * secret of a TCP connection first, then announces it is ready, then for
+ * each command frame runs the line in a child of its own, with standard
+ * output and standard error on pipes that it forwards as frames while the
+ * command runs, and finishes with an exit frame and another ready frame.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "shellAgent.h"
+#include "shellParser.h"
+#include "shellRedirect.h"
+#include "shellDirs.h"
+#include "shellSandbox.h"
+#include "shellExec.h"
+#include "shellPath.h"
+#include "shellAppend.h"
+#include "shellRead.h"
+#include "shellFd.h"
+
+/* Runs a command line and returns its exit status (see setLineRunner()) */
+static int (*lineRunner)(char** line) = NULL;
+
+/* Function prototypes */
+static int  openEndpoint(const char* endpoint, bool listening);
+static int  openUnixEndpoint(const char* endpoint, const char* path, bool listening);
+static int  openTcpEndpoint(const char* endpoint, const char* text, bool listening);
+static bool isUnixEndpoint(const char* endpoint);
+static void serveConnection(int fd, const char* secret);
+static bool checkHello(int fd, FrameReader* reader, const char* secret);
+static bool runCommand(int fd, const char* text);
+static bool sendExit(int fd, int status, uint64_t elapsed);
+
+/*
+ * connectAgent
+ *
+ * Connects to the agent at 'endpoint', presenting the secret from
+ * $SHELL_AGENT_SECRET if it is a TCP endpoint.  Returns the (close-on-exec)
+ * socket, or -1 after printing a message.
+ */
+int connectAgent(const char* endpoint) {
+    const char* secret = getenv(AGENT_SECRET_VAR);
+    int         fd;
+
+    if (!isUnixEndpoint(endpoint) && (secret == NULL || secret[0] == '\0')) {
+        fprintf(stderr, "%s: %s must be set to connect over TCP\n", endpoint, AGENT_SECRET_VAR);
+        return -1;
+    }
+    if ((fd = openEndpoint(endpoint, false)) < 0) {
+        return -1;
+    }
+    if (!isUnixEndpoint(endpoint) && !sendFrame(fd, FRAME_HELLO, secret, strlen(secret))) {
+        perror(endpoint);
+        shellClose(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * sendFrame
+ *
+ * Sends one frame.  Returns false if the connection is gone (without
+ * raising SIGPIPE).
+ */
+bool sendFrame(int fd, char type, const void* payload, size_t length) {
+    unsigned char header[FRAME_HEADER_SIZE];
+    uint32_t      networkLength = htonl((uint32_t) length);
+    struct iovec  vectors[2];
+    struct msghdr message;
+
+    header[0] = (unsigned char) type;
+    memcpy(header + 1, &networkLength, sizeof(networkLength));
+    vectors[0].iov_base = header;
+    vectors[0].iov_len  = FRAME_HEADER_SIZE;
+    vectors[1].iov_base = (void*) payload;
+    vectors[1].iov_len  = length;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov    = vectors;
+    message.msg_iovlen = length > 0 ? 2 : 1;
+
+    while (message.msg_iovlen > 0) {
+        ssize_t result = sendmsg(fd, &message, MSG_NOSIGNAL);
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        /* Skip whatever went out; a short send resumes mid-vector */
+        while (message.msg_iovlen > 0 && (size_t) result >= message.msg_iov->iov_len) {
+            result -= (ssize_t) message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base  = (char*) message.msg_iov->iov_base + result;
+            message.msg_iov->iov_len  -= (size_t) result;
+        }
+    }
+    return true;
+}
+
+/*
+ * fillFrameReader
+ *
+ * Reads whatever is available on 'fd' into 'reader'.  Returns what read()
+ * did: the byte count, 0 at end of file, or -1 on error, which includes a
+ * peer announcing a frame bigger than FRAME_MAX_PAYLOAD (errno EPROTO).
+ */
+ssize_t fillFrameReader(int fd, FrameReader* reader) {
+    ssize_t result;
+
+    if (reader->start > 0) {
+        memmove(reader->data, reader->data + reader->start, reader->end - reader->start);
+        reader->end   -= reader->start;
+        reader->start  = 0;
+    }
+    if (reader->end == reader->capacity) {
+        if (reader->capacity >= FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD) {
+            errno = EPROTO;
+            return -1;
+        }
+        reader->capacity = reader->capacity ? reader->capacity * 2 : AGENT_CHUNK_SIZE;
+        reader->data     = realloc(reader->data, reader->capacity);
+    }
+
+    do {
+        result = read(fd, reader->data + reader->end, reader->capacity - reader->end);
+    } while (result < 0 && errno == EINTR);
+
+    if (result > 0) {
+        reader->end += (size_t) result;
+    }
+    return result;
+}
+
+/*
+ * takeFrame
+ *
+ * Takes the next complete frame out of 'reader'.  Returns false if there
+ * isn't one yet.  The payload stays valid until the next fillFrameReader().
+ */
+bool takeFrame(FrameReader* reader, Frame* frame) {
+    size_t   available = reader->end - reader->start;
+    uint32_t length;
+
+    if (available < FRAME_HEADER_SIZE) {
+        return false;
+    }
+    memcpy(&length, reader->data + reader->start + 1, sizeof(length));
+    length = ntohl(length);
+    if (available < FRAME_HEADER_SIZE + (size_t) length) {
+        return false;
+    }
+
+    frame->type    = reader->data[reader->start];
+    frame->payload = reader->data + reader->start + FRAME_HEADER_SIZE;
+    frame->length  = length;
+    reader->start += FRAME_HEADER_SIZE + (size_t) length;
+    return true;
+}
+
+/*
+ * freeFrameReader
+ *
+ * Releases the buffer of 'reader'.
+ */
+void freeFrameReader(FrameReader* reader) {
+    free(reader->data);
+    reader->data     = NULL;
+    reader->start    = reader->end = reader->capacity = 0;
+}
+
+/*
+ * parseExitReport
+ *
+ * Decodes the payload of a FRAME_EXIT frame.  Returns false if it is
+ * malformed.
+ */
+bool parseExitReport(const Frame* frame, ExitReport* report) {
+    uint32_t words[3];
+
+    if (frame->type != FRAME_EXIT || frame->length != sizeof(words)) {
+        return false;
+    }
+    memcpy(words, frame->payload, sizeof(words));
+    report->status  = (int) ntohl(words[0]);
+    report->elapsed = (uint64_t) ntohl(words[1]) << 32 | ntohl(words[2]);
+    return true;
+}
+
+/*
+ * setLineRunner
+ *
+ * Tells the agent code how to run a command line: 'runLine' takes the
+ * line's tokens and returns its exit status.
+ */
+void setLineRunner(int (*runLine)(char** line)) {
+    lineRunner = runLine;
+}
+
+/*
+ * serveAgent
+ *
+ * Implements "shell --serve endpoint": listens on 'endpoint' and runs the
+ * command lines clients send.  Only returns (with 1) if the endpoint can't
+ * be set up, or it is a TCP endpoint and there is no secret to check
+ * clients against.
+ */
+int serveAgent(const char* endpoint) {
+    char* secret = NULL;
+    int   listenFd;
+
+    if (!isUnixEndpoint(endpoint)) {
+        if (getenv(AGENT_SECRET_VAR) == NULL || getenv(AGENT_SECRET_VAR)[0] == '\0') {
+            fprintf(stderr, "%s: %s must be set to serve over TCP\n", endpoint, AGENT_SECRET_VAR);
+            return 1;
+        }
+        secret = strdup(getenv(AGENT_SECRET_VAR));
+        unsetenv(AGENT_SECRET_VAR);
+    }
+    if ((listenFd = openEndpoint(endpoint, true)) < 0) {
+        free(secret);
+        return 1;
+    }
+
+    /* Ctrl-C stops the agent; connection handlers are reaped by the kernel */
+    signal(SIGINT, SIG_DFL);
+    signal(SIGCHLD, SIG_IGN);
+    fprintf(stderr, "agent %ld serving %s\n", (long) getpid(), endpoint);
+
+    for (;;) {
+        int   fd = shellTrack(accept4(listenFd, NULL, NULL, SOCK_CLOEXEC));
+        pid_t pid;
+
+        if (fd < 0) {
+            if (errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+        } else if (pid == 0) {
+            signal(SIGCHLD, SIG_DFL);
+            shellClose(listenFd);
+            serveConnection(fd, secret);
+            _exit(0);
+        }
+        shellClose(fd);
+    }
+}
+
+/*
+ * spawnLocalAgent
+ *
+ * Forks an agent serving one end of a socketpair.  Returns the other end
+ * (close it to make the agent exit), storing the agent's process ID in
+ * 'pid', or -1 after printing a message.
+ */
+int spawnLocalAgent(pid_t* pid) {
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    shellTrack(fds[0]);
+    shellTrack(fds[1]);
+
+    fflush(stdout);
+    *pid = fork();
+    if (*pid == 0) {
+        FdActionList actions = { .count = 0 };
+
+        /*
+         * Keep only the standard descriptors and our end, now descriptor 3:
+         * an inherited copy of another agent's socket would keep that agent
+         * from ever seeing its client hang up.
+         */
+        if (!addFdDup(&actions, 3, fds[1])) {
+            _exit(1);
+        }
+        applyFdActions(&actions);
+        forgetDirFds();
+        forgetSandboxPool();
+        forgetExecCache();
+        forgetCommandCache();
+        forgetAppendCache();
+        forgetReadBuffers();
+        signal(SIGINT, SIG_DFL);
+
+        serveConnection(3, NULL);
+        _exit(0);
+    }
+
+    shellClose(fds[1]);
+    if (*pid < 0) {
+        perror("fork");
+        shellClose(fds[0]);
+        return -1;
+    }
+    return fds[0];
+}
+
+/*
+ * openEndpoint
+ *
+ * Creates a socket for 'endpoint' and either connects it or, if
+ * 'listening', binds it and listens.  Returns -1 after printing a message
+ * on failure.
+ */
+static int openEndpoint(const char* endpoint, bool listening) {
+    if (strncmp(endpoint, "unix:", 5) == 0) {
+        return openUnixEndpoint(endpoint, endpoint + 5, listening);
+    } else if (strncmp(endpoint, "tcp:", 4) == 0) {
+        return openTcpEndpoint(endpoint, endpoint + 4, listening);
+    } else if (isUnixEndpoint(endpoint)) {
+        return openUnixEndpoint(endpoint, endpoint, listening);
+    }
+    return openTcpEndpoint(endpoint, endpoint, listening);
+}
+
+/*
+ * isUnixEndpoint
+ *
+ * Returns true if 'endpoint' names a Unix domain socket rather than a TCP
+ * address (see openEndpoint()).
+ */
+static bool isUnixEndpoint(const char* endpoint) {
+    return strncmp(endpoint, "unix:", 5) == 0
+           || (strncmp(endpoint, "tcp:", 4) != 0 && strchr(endpoint, '/') != NULL);
+}
+
+/*
+ * openUnixEndpoint
+ *
+ * openEndpoint() for the Unix domain socket 'path'.
+ */
+static int openUnixEndpoint(const char* endpoint, const char* path, bool listening) {
+    struct sockaddr_un address;
+    struct stat        info;
+    int                fd;
+    bool               ok;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", endpoint);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    fd = shellTrack(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    if (listening) {
+        /* A socket left behind by an agent that has gone away */
+        if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(path);
+        }
+        ok = bind(fd, (struct sockaddr*) &address, sizeof(address)) == 0
+             && listen(fd, AGENT_BACKLOG) == 0;
+    } else {
+        ok = connect(fd, (struct sockaddr*) &address, sizeof(address)) == 0;
+    }
+
+    if (!ok) {
+        perror(endpoint);
+        shellClose(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * openTcpEndpoint
+ *
+ * openEndpoint() for "host:port" in 'text'.  The host may be a bracketed
+ * IPv6 address; an empty one means the loopback address, so an agent only
+ * listens on other addresses when told to.
+ */
+static int openTcpEndpoint(const char* endpoint, const char* text, bool listening) {
+    const char*      colon = strrchr(text, ':');
+    struct addrinfo  hints;
+    struct addrinfo* results;
+    struct addrinfo* result;
+    char*            host;
+    int              error;
+    int              fd = -1;
+
+    if (colon == NULL || colon[1] == '\0') {
+        fprintf(stderr, "%s: expected unix:path or host:port\n", endpoint);
+        return -1;
+    }
+    if (text[0] == '[' && colon > text && colon[-1] == ']') {
+        host = strndup(text + 1, (size_t) (colon - text) - 2);
+    } else {
+        host = strndup(text, (size_t) (colon - text));
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = listening ? AI_PASSIVE : 0;
+
+    /* No host means loopback, not (as AI_PASSIVE would make it) every address */
+    error = getaddrinfo(host[0] != '\0' ? host : "127.0.0.1", colon + 1, &hints, &results);
+    free(host);
+    if (error != 0) {
+        fprintf(stderr, "%s: %s\n", endpoint, gai_strerror(error));
+        return -1;
+    }
+
+    for (result = results; result != NULL; result = result->ai_next) {
+        int  one = 1;
+        bool ok;
+
+        fd = shellTrack(socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC,
+                               result->ai_protocol));
+        if (fd < 0) {
+            continue;
+        }
+
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            ok = bind(fd, result->ai_addr, result->ai_addrlen) == 0
+                 && listen(fd, AGENT_BACKLOG) == 0;
+        } else {
+            ok = connect(fd, result->ai_addr, result->ai_addrlen) == 0;
+        }
+        if (ok) {
+            /* Frames are small and should go out as soon as they are sent */
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+
+        error = errno;
+        shellClose(fd);
+        errno = error;
+        fd    = -1;
+    }
+    freeaddrinfo(results);
+
+    if (fd < 0) {
+        perror(endpoint);
+    }
+    return fd;
+}
+
+/*
+ * serveConnection
+ *
+ * Runs the command lines sent on the connection 'fd' one at a time until
+ * the client hangs up.  If 'secret' is not NULL the client must present it
+ * first (see checkHello()).
+ */
+static void serveConnection(int fd, const char* secret) {
+    FrameReader reader = { NULL, 0, 0, 0 };
+    Frame       frame;
+    bool        open;
+
+    open = (secret == NULL || checkHello(fd, &reader, secret))
+           && sendFrame(fd, FRAME_READY, NULL, 0);
+
+    while (open) {
+        if (takeFrame(&reader, &frame)) {
+            if (frame.type == FRAME_COMMAND) {
+                char* text = strndup(frame.payload, frame.length);
+
+                open = runCommand(fd, text)
+                       && sendFrame(fd, FRAME_READY, NULL, 0);
+                free(text);
+            }
+        } else {
+            open = fillFrameReader(fd, &reader) > 0;
+        }
+    }
+    freeFrameReader(&reader);
+    shellClose(fd);
+}
+
+/*
+ * checkHello
+ *
+ * Reads the first frame on the connection 'fd' into 'reader' and checks
+ * it is a FRAME_HELLO holding 'secret', waiting no more than
+ * AGENT_HELLO_TIMEOUT seconds for it.  The comparison takes the same time
+ * however much of the secret matches.
+ *
+ * Returns true if the client presented the secret.
+ */
+static bool checkHello(int fd, FrameReader* reader, const char* secret) {
+    struct timeval timeout     = { AGENT_HELLO_TIMEOUT, 0 };
+    struct timeval none        = { 0, 0 };
+    size_t         length      = strlen(secret);
+    unsigned char  differences = 0;
+    Frame          frame;
+    size_t         i;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (!takeFrame(reader, &frame)) {
+        if (fillFrameReader(fd, reader) <= 0) {
+            return false;
+        }
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+
+    if (frame.type != FRAME_HELLO) {
+        fprintf(stderr, "agent: connection refused: no secret\n");
+        return false;
+    }
+    for (i = 0; i < length && i < frame.length; ++i) {
+        differences |= (unsigned char) (frame.payload[i] ^ secret[i]);
+    }
+    if (differences != 0 || frame.length != length) {
+        fprintf(stderr, "agent: connection refused: wrong secret\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * runCommand
+ *
+ * Runs the command line 'text' in a child, forwarding its output on 'fd'
+ * as it is produced, then reports its exit status and running time.
+ * Returns false if the client has gone away.
+ */
+static bool runCommand(int fd, const char* text) {
+    int             outPipe[2];
+    int             errPipe[2];
+    struct pollfd   polls[2];
+    struct timespec start;
+    struct timespec finish;
+    int             openCount = 2;
+    bool            connected = true;
+    char*           buffer;
+    pid_t           pid;
+    int             status;
+    int             i;
+
+    if (shellPipe(outPipe) < 0) {
+        perror("pipe");
+        return false;
+    }
+    if (shellPipe(errPipe) < 0) {
+        perror("pipe");
+        shellClose(outPipe[0]);
+        shellClose(outPipe[1]);
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fflush(stdout);
+    pid = fork();
+
+    if (pid == 0) {
+        int    null = open("/dev/null", O_RDONLY);
+        char** line;
+
+        dup2(null, STDIN_FILENO);
+        dup2(outPipe[1], STDOUT_FILENO);
+        dup2(errPipe[1], STDERR_FILENO);
+        close(null);
+        shellClose(outPipe[0]);
+        shellClose(outPipe[1]);
+        shellClose(errPipe[0]);
+        shellClose(errPipe[1]);
+        shellClose(fd);
+
+        line   = getArgListFromString(text);
+        status = line[0] != NULL ? lineRunner(line) : 0;
+        fflush(stdout);
+        _exit(status);
+    }
+
+    shellClose(outPipe[1]);
+    shellClose(errPipe[1]);
+    if (pid < 0) {
+        perror("fork");
+        shellClose(outPipe[0]);
+        shellClose(errPipe[0]);
+        return false;
+    }
+
+    /* Forward output until the command (and anything it left running) closes it */
+    buffer          = malloc(AGENT_CHUNK_SIZE);
+    polls[0].fd     = outPipe[0];
+    polls[0].events = POLLIN;
+    polls[1].fd     = errPipe[0];
+    polls[1].events = POLLIN;
+
+    while (openCount > 0) {
+        if (poll(polls, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        for (i = 0; i < 2; ++i) {
+            ssize_t count;
+
+            if (polls[i].fd < 0 || polls[i].revents == 0) {
+                continue;
+            }
+            count = read(polls[i].fd, buffer, AGENT_CHUNK_SIZE);
+            if (count > 0) {
+                /* Keep draining after the client goes, so the command can finish */
+                connected = connected && sendFrame(fd, i == 0 ? FRAME_STDOUT : FRAME_STDERR,
+                                                   buffer, (size_t) count);
+            } else if (count == 0 || errno != EINTR) {
+                shellClose(polls[i].fd);
+                polls[i].fd = -1;
+                openCount--;
+            }
+        }
+    }
+    for (i = 0; i < 2; ++i) {
+        if (polls[i].fd >= 0) {
+            shellClose(polls[i].fd);
+        }
+    }
+    free(buffer);
+
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+
+    status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return connected
+           && sendExit(fd, status,
+                       (uint64_t) ((int64_t) (finish.tv_sec - start.tv_sec) * 1000000000
+                                   + (finish.tv_nsec - start.tv_nsec)) / 1000);
+}
+
+/*
+ * sendExit
+ *
+ * Sends a FRAME_EXIT frame (see parseExitReport()).
+ */
+static bool sendExit(int fd, int status, uint64_t elapsed) {
+    uint32_t words[3];
+
+    words[0] = htonl((uint32_t) status);
+    words[1] = htonl((uint32_t) (elapsed >> 32));
+    words[2] = htonl((uint32_t) elapsed);
+    return sendFrame(fd, FRAME_EXIT, words, sizeof(words));
+}
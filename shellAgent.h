@@ -0,0 +1,90 @@
+/*
+ * shellAgent.h
+ *
+ * Agents are shells started with "shell --serve endpoint" that run command
+ * lines sent to them over a socket and stream back the output and exit
+ * status.  An endpoint is "unix:path" (or any path containing a '/') for a
+ * Unix domain socket, or "host:port" (optionally "tcp:host:port") for TCP.
+ * An agent given no host (":port") listens on the loopback address only;
+ * to be reachable from other machines it must be given one explicitly,
+ * such as 0.0.0.0 or [::].
+ *
+ * Anyone who can connect to an agent can run commands as its user.  A Unix
+ * domain socket is guarded by its file permissions; over TCP, both ends
+ * must share a secret in $SHELL_AGENT_SECRET, which the client sends in a
+ * FRAME_HELLO before anything else.  An agent will not serve TCP without
+ * one, and drops it from its environment so the commands it runs cannot
+ * read it.
+ *
+ * Everything on the connection is a frame: a one-byte type, a four-byte
+ * payload length in network order, and the payload.
+ *
+ * A local agent is the same thing on one end of a socketpair, so work can
+ * be shared out the same way whether the agents are near or far.
+ */
+#ifndef SHELL_AGENT_H
+#define SHELL_AGENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Frame types */
+#define FRAME_HELLO   'H'  /* Client to agent, over TCP: the shared secret */
+#define FRAME_COMMAND 'C'  /* Client to agent: a command line to run */
+#define FRAME_READY   'R'  /* Agent to client: ready for a command */
+#define FRAME_STDOUT  'O'  /* Agent to client: standard output data */
+#define FRAME_STDERR  'E'  /* Agent to client: standard error data */
+#define FRAME_EXIT    'X'  /* Agent to client: the command finished */
+
+#define FRAME_HEADER_SIZE 5
+
+/* Largest payload either side will accept */
+#define FRAME_MAX_PAYLOAD (1024 * 1024)
+
+/* Most output an agent puts in one frame */
+#define AGENT_CHUNK_SIZE (64 * 1024)
+
+/* Pending connections an agent's listening socket allows */
+#define AGENT_BACKLOG 64
+
+/* The environment variable holding the secret TCP connections must present */
+#define AGENT_SECRET_VAR "SHELL_AGENT_SECRET"
+
+/* Seconds a TCP client has to present the secret */
+#define AGENT_HELLO_TIMEOUT 10
+
+/* A frame taken from a FrameReader; 'payload' lives in the reader */
+typedef struct {
+    char        type;
+    const char* payload;
+    size_t      length;
+} Frame;
+
+/* Bytes received on a connection that have not been made into frames yet */
+typedef struct {
+    char*  data;
+    size_t start;     /* First byte not yet taken */
+    size_t end;       /* One past the last byte received */
+    size_t capacity;
+} FrameReader;
+
+/* The payload of a FRAME_EXIT frame, in host order */
+typedef struct {
+    int      status;   /* Exit status of the command line */
+    uint64_t elapsed;  /* How long it ran on the agent, in microseconds */
+} ExitReport;
+
+/* Function prototypes */
+int     connectAgent(const char* endpoint);
+bool    sendFrame(int fd, char type, const void* payload, size_t length);
+ssize_t fillFrameReader(int fd, FrameReader* reader);
+bool    takeFrame(FrameReader* reader, Frame* frame);
+void    freeFrameReader(FrameReader* reader);
+bool    parseExitReport(const Frame* frame, ExitReport* report);
+void    setLineRunner(int (*runLine)(char** line));
+int     serveAgent(const char* endpoint);
+int     spawnLocalAgent(pid_t* pid);
+
+#endif
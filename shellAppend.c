@@ -0,0 +1,377 @@
+/*
+ * shellAppend.c
+ *
+ * The append cache (see shellAppend.h).
+ *
+ * A redirection target is looked up by the device and inode its path
+ * names now (one fstatat() relative to the cached current directory), so
+ * a file that has been renamed, removed or replaced is simply a miss.  The
+ * cached descriptor is then checked with fstat() to still refer to that
+ * inode, and to a file that still has links (an inode number can be
+ * reused), before it is handed out.  Only regular files are cached:
+ * keeping a FIFO or terminal open would change what its other end sees.
+ * Nothing is cached while a redirection policy is in force, as the lookup
+ * does not follow it.
+ *
+ * A descriptor stays pinned while a layout uses it (until
+ * releaseFdLayout()), so planning one command never evicts the file an
+ * earlier redirection of the same command is using; when every entry is
+ * pinned, the file is opened as usual.
+ *
+ * Combined output is kept in a stdio stream per entry (fopencookie()),
+ * whose buffer of APPEND_COMBINE_SIZE bytes is written out to the cached
+ * descriptor when it fills, when the entry is dropped, and whenever
+ * flushAppends() is called: before the shell runs anything but another
+ * combinable 'echo' into the same file, and before it prompts or exits.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "shellAppend.h"
+#include "shellRedirect.h"
+#include "shellDirs.h"
+#include "shellFd.h"
+
+/* The open(2) flags of >> and &>>; only those targets are cached */
+#define APPEND_FLAGS (O_WRONLY | O_CREAT | O_APPEND)
+
+/* A file append redirections went to, kept open */
+typedef struct {
+    char*         path;     /* As first redirected to; NULL if the slot is free */
+    int           fd;
+    dev_t         dev;
+    ino_t         ino;
+    unsigned int  pins;     /* Layouts using the descriptor */
+    unsigned long lastUse;  /* For least-recently-used replacement */
+    FILE*         stream;   /* Combined output not yet written, or NULL */
+    char*         buffer;   /* The stream's buffer */
+} AppendEntry;
+
+static AppendEntry   appendEntries[APPEND_CACHE_SIZE];
+static unsigned long useClock     = 0;
+static bool          cacheEnabled = true;
+static bool          combining    = false;
+
+/* Function prototypes */
+static AppendEntry* findAppendEntry(const struct stat* info);
+static AppendEntry* freeAppendEntry(void);
+static void         dropAppendEntry(AppendEntry* entry);
+static void         closeAppendStream(AppendEntry* entry);
+static ssize_t      writeCombined(void* cookie, const char* data, size_t size);
+
+/*
+ * setAppendCache
+ *
+ * Turns the append cache on or off, and combining with it.  Turning
+ * combining off writes out what is held back; turning the cache off also
+ * closes every cached descriptor.
+ */
+void setAppendCache(bool enabled, bool combine) {
+    int i;
+
+    for (i = 0; i < APPEND_CACHE_SIZE; ++i) {
+        AppendEntry* entry = &appendEntries[i];
+
+        if (entry->path == NULL) {
+            continue;
+        }
+        if (!enabled && entry->pins == 0) {
+            dropAppendEntry(entry);
+        } else if (!combine) {
+            closeAppendStream(entry);
+        }
+    }
+    cacheEnabled = enabled;
+    combining    = enabled && combine;
+}
+
+/*
+ * openRedirectCached
+ *
+ * Opens the redirection target 'path' with 'flags' as openRedirectTarget()
+ * does, except that an append target gets the cache's descriptor for the
+ * file, which must be handed back with releaseAppendFd() rather than
+ * closed.
+ *
+ * Returns the descriptor, or -1 with errno set.
+ */
+int openRedirectCached(const char* path, int flags) {
+    struct stat  info;
+    AppendEntry* entry;
+    int          fd;
+
+    if (!cacheEnabled || flags != APPEND_FLAGS || !redirPolicyDefault()) {
+        return openRedirectTarget(path, flags, REDIRECT_MODE);
+    }
+
+    if (fstatat(cwdDirFd(), path, &info, 0) == 0) {
+        if (!S_ISREG(info.st_mode)) {
+            return openRedirectTarget(path, flags, REDIRECT_MODE);
+        }
+        if ((entry = findAppendEntry(&info)) != NULL) {
+            entry->lastUse = ++useClock;
+            entry->pins++;
+            return entry->fd;
+        }
+    }
+
+    fd = openRedirectTarget(path, flags, REDIRECT_MODE);
+    if (fd < 0 || fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)
+            || (entry = freeAppendEntry()) == NULL) {
+        return fd;
+    }
+
+    entry->path    = strdup(path);
+    entry->fd      = keepFd(fd);
+    entry->dev     = info.st_dev;
+    entry->ino     = info.st_ino;
+    entry->pins    = 1;
+    entry->lastUse = ++useClock;
+    return entry->fd;
+}
+
+/*
+ * releaseAppendFd
+ *
+ * Hands back 'fd' if it is one of the cache's (see openRedirectCached()).
+ *
+ * Returns true if it was, false if it is the caller's to close.
+ */
+bool releaseAppendFd(int fd) {
+    int i;
+
+    for (i = 0; i < APPEND_CACHE_SIZE; ++i) {
+        AppendEntry* entry = &appendEntries[i];
+
+        if (entry->path != NULL && entry->fd == fd) {
+            if (entry->pins > 0) {
+                entry->pins--;
+            }
+            if (entry->pins == 0 && !cacheEnabled) {
+                dropAppendEntry(entry);  /* Was in use when the cache was turned off */
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * appendStream
+ *
+ * Returns the stream that holds back output for the cached descriptor
+ * 'fd', or NULL if combining is off or 'fd' is not in the cache.
+ */
+FILE* appendStream(int fd) {
+    cookie_io_functions_t functions = { .write = writeCombined };
+    int                   i;
+
+    if (!combining) {
+        return NULL;
+    }
+
+    for (i = 0; i < APPEND_CACHE_SIZE; ++i) {
+        AppendEntry* entry = &appendEntries[i];
+
+        if (entry->path == NULL || entry->fd != fd) {
+            continue;
+        }
+        if (entry->stream == NULL) {
+            entry->buffer = malloc(APPEND_COMBINE_SIZE);
+            entry->stream = fopencookie(entry, "a", functions);
+            if (entry->buffer == NULL || entry->stream == NULL) {
+                closeAppendStream(entry);
+                return NULL;
+            }
+            setvbuf(entry->stream, entry->buffer, _IOFBF, APPEND_COMBINE_SIZE);
+        }
+        return entry->stream;
+    }
+    return NULL;
+}
+
+/*
+ * flushAppends
+ *
+ * Writes out all of the output held back for cached files.
+ */
+void flushAppends(void) {
+    int i;
+
+    for (i = 0; i < APPEND_CACHE_SIZE; ++i) {
+        if (appendEntries[i].stream != NULL) {
+            fflush(appendEntries[i].stream);
+        }
+    }
+}
+
+/*
+ * forgetAppendCache
+ *
+ * For a child whose descriptors above standard error have been closed (see
+ * applyFdActions()): forgets the cached descriptors.  Nothing is held back
+ * at the time, since the shell flushes before it forks.
+ */
+void forgetAppendCache(void) {
+    int i;
+
+    for (i = 0; i < APPEND_CACHE_SIZE; ++i) {
+        AppendEntry* entry = &appendEntries[i];
+
+        free(entry->path);
+        entry->path   = NULL;
+        entry->fd     = -1;
+        entry->pins   = 0;
+        entry->stream = NULL;
+        entry->buffer = NULL;
+    }
+}
+
+/*
+ * doAppendCache
+ *
+ * Implements the built-in 'appendcache' command, which turns the append
+ * cache on or off, or on with combining.  With no argument the current
+ * state is printed, along with the files kept open.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command.
+ */
+int doAppendCache(char** args) {
+    int i;
+
+    if (args[1] == NULL) {
+        printf("appendcache is %s\n", !cacheEnabled ? "off" : combining ? "combine" : "on");
+        for (i = 0; i < APPEND_CACHE_SIZE; ++i) {
+            if (appendEntries[i].path != NULL) {
+                printf("%4d  %s\n", appendEntries[i].fd, appendEntries[i].path);
+            }
+        }
+    } else if (args[2] == NULL && strcmp(args[1], "on") == 0) {
+        setAppendCache(true, false);
+    } else if (args[2] == NULL && strcmp(args[1], "combine") == 0) {
+        setAppendCache(true, true);
+    } else if (args[2] == NULL && strcmp(args[1], "off") == 0) {
+        setAppendCache(false, false);
+    } else {
+        printf("usage: appendcache [on|off|combine]\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * findAppendEntry
+ *
+ * Returns the entry for the file 'info' describes, or NULL if there is
+ * none or its descriptor no longer refers to that file (the entry is then
+ * dropped, unless in use).
+ */
+static AppendEntry* findAppendEntry(const struct stat* info) {
+    int i;
+
+    for (i = 0; i < APPEND_CACHE_SIZE; ++i) {
+        AppendEntry* entry = &appendEntries[i];
+        struct stat  cached;
+
+        if (entry->path == NULL || entry->dev != info->st_dev || entry->ino != info->st_ino) {
+            continue;
+        }
+        if (fstat(entry->fd, &cached) == 0 && cached.st_dev == entry->dev
+                && cached.st_ino == entry->ino && cached.st_nlink > 0) {
+            return entry;
+        }
+        if (entry->pins == 0) {
+            dropAppendEntry(entry);
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+/*
+ * freeAppendEntry
+ *
+ * Returns a free entry, dropping the least recently used one not in use if
+ * need be, or NULL if every entry is in use.
+ */
+static AppendEntry* freeAppendEntry(void) {
+    AppendEntry* oldest = NULL;
+    int          i;
+
+    for (i = 0; i < APPEND_CACHE_SIZE; ++i) {
+        AppendEntry* entry = &appendEntries[i];
+
+        if (entry->path == NULL) {
+            return entry;
+        }
+        if (entry->pins == 0 && (oldest == NULL || entry->lastUse < oldest->lastUse)) {
+            oldest = entry;
+        }
+    }
+    if (oldest != NULL) {
+        dropAppendEntry(oldest);
+    }
+    return oldest;
+}
+
+/*
+ * dropAppendEntry
+ *
+ * Writes out what 'entry' holds back, closes its descriptor and frees the
+ * slot.
+ */
+static void dropAppendEntry(AppendEntry* entry) {
+    closeAppendStream(entry);
+    shellClose(entry->fd);
+    free(entry->path);
+    entry->path = NULL;
+    entry->fd   = -1;
+}
+
+/*
+ * closeAppendStream
+ *
+ * Writes out what 'entry' holds back and closes its stream, if it has one.
+ */
+static void closeAppendStream(AppendEntry* entry) {
+    if (entry->stream != NULL) {
+        fclose(entry->stream);
+        entry->stream = NULL;
+    }
+    free(entry->buffer);
+    entry->buffer = NULL;
+}
+
+/*
+ * writeCombined
+ *
+ * The write function of an entry's stream ('cookie' is the entry): appends
+ * 'size' bytes of 'data' to its file, as few write()s as it takes.
+ *
+ * Returns the number of bytes written, or -1 on error.
+ */
+static ssize_t writeCombined(void* cookie, const char* data, size_t size) {
+    const AppendEntry* entry   = cookie;
+    size_t             written = 0;
+
+    while (written < size) {
+        ssize_t count = write(entry->fd, data + written, size - written);
+
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return written > 0 ? (ssize_t) written : -1;
+        }
+        written += (size_t) count;
+    }
+    return (ssize_t) written;
+}
@@ -0,0 +1,35 @@
+/*
+ * shellAppend.h
+ *
+ * The append cache ('appendcache') keeps the files most recently opened by
+ * append redirections (>> and &>>) open, so a command appending to the
+ * same file again, line after line, reuses one descriptor instead of
+ * opening and closing it each time.  Entries are keyed by device and inode
+ * and checked with fstat() before each reuse.
+ *
+ * With 'appendcache combine', what 'echo' appends to a cached file in the
+ * shell is also held back and written out with other appends to it in one
+ * write(), before anything else can see the file.
+ */
+#ifndef SHELL_APPEND_H
+#define SHELL_APPEND_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Append targets kept open */
+#define APPEND_CACHE_SIZE 8
+
+/* Most output held back for one file before it is written out */
+#define APPEND_COMBINE_SIZE 65536
+
+/* Function prototypes */
+void  setAppendCache(bool enabled, bool combine);
+int   openRedirectCached(const char* path, int flags);
+bool  releaseAppendFd(int fd);
+FILE* appendStream(int fd);
+void  flushAppends(void);
+void  forgetAppendCache(void);
+int   doAppendCache(char** args);
+
+#endif
@@ -0,0 +1,678 @@
+/*
+ * shellDirs.c
+ *
+ * Cached directory descriptors and openat2()-relative redirections (see
+ * shellDirs.h).
+ *
+ * A redirection target "dir/name" is opened as "name" relative to a cached
+ * descriptor for "dir" once "dir" has been redirected into a few times, so
+ * the kernel only walks the last component.  Targets without a slash are
+ * opened relative to the cached current directory.  Before a cached
+ * descriptor is used, one fstatat() of "dir" checks that the path still
+ * names the directory it was opened on; one that was moved, removed or
+ * replaced (or a symbolic link since retargeted) is dropped and the full
+ * path is opened instead.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include "shellDirs.h"
+#include "shellFd.h"
+
+/* A directory redirections have gone into, and maybe a descriptor for it */
+typedef struct {
+    char*         path;     /* NULL if the slot is free */
+    int           fd;       /* O_PATH descriptor, -1 until it is hot */
+    dev_t         dev;      /* The directory 'fd' was opened on */
+    ino_t         ino;
+    unsigned int  uses;
+    unsigned long lastUse;  /* For least-recently-used replacement */
+} RedirectDir;
+
+static RedirectDir   redirectDirs[REDIRECT_DIR_CACHE_SIZE];
+static unsigned long useClock = 0;
+
+/* O_PATH descriptor for the shell's current directory */
+static int cwdFd = -1;
+
+/* A directory the shell can return to without resolving its path */
+typedef struct {
+    char* path;  /* Logical path, as $PWD would show it */
+    int   fd;    /* O_PATH descriptor */
+} DirEntry;
+
+/* The pushd stack; dirStack[dirStackDepth - 1] is the most recent push */
+static DirEntry dirStack[MAX_DIR_STACK];
+static int      dirStackDepth = 0;
+
+/* Where "cd -" goes ($OLDPWD), or { NULL, -1 } */
+static DirEntry previousDir = { NULL, -1 };
+
+/* The logical current directory ($PWD) */
+static char* currentPath = NULL;
+
+/* RESOLVE_* flags applied to every redirection (see doRedirPolicy()) */
+static unsigned long long resolveFlags = 0;
+
+/* Function prototypes */
+static RedirectDir* findRedirectDir(const char* dir, size_t length);
+static void         dropRedirectDir(RedirectDir* entry);
+static int          openRelative(int dirFd, const char* path, int flags,
+                                 mode_t mode);
+static bool         changeDir(const char* path);
+static bool         enterDir(DirEntry* entry);
+static DirEntry     currentDir(void);
+static void         setCurrentPath(char* path);
+static char*        logicalPath(const char* path);
+static bool         hasDotDot(const char* path);
+static void         printDirs(void);
+
+/*
+ * initDirs
+ *
+ * Opens the descriptor for the current directory and works out $PWD: the
+ * inherited value is kept if it really names this directory, otherwise
+ * getcwd() is called (this once).
+ */
+void initDirs(void) {
+    const char* pwd = getenv("PWD");
+    struct stat here;
+    struct stat there;
+
+    if (cwdFd < 0) {
+        cwdFd = keepFd(shellOpen(".", O_PATH | O_DIRECTORY, 0));
+    }
+
+    if (pwd != NULL && pwd[0] == '/' && fstat(cwdDirFd(), &here) == 0
+            && stat(pwd, &there) == 0
+            && here.st_dev == there.st_dev && here.st_ino == there.st_ino) {
+        setCurrentPath(strdup(pwd));
+    } else {
+        setCurrentPath(getcwd(NULL, 0));
+    }
+}
+
+/*
+ * cwdDirFd
+ *
+ * Returns an O_PATH descriptor for the current directory, or AT_FDCWD if
+ * none could be opened.
+ */
+int cwdDirFd(void) {
+    return cwdFd >= 0 ? cwdFd : AT_FDCWD;
+}
+
+/*
+ * setCwdDirFd
+ *
+ * Replaces the cached current directory descriptor after a change of
+ * directory.  Takes ownership of 'fd'.  Cached relative redirection
+ * directories no longer mean the same thing and are dropped.
+ */
+void setCwdDirFd(int fd) {
+    int i;
+
+    if (cwdFd >= 0 && cwdFd != fd) {
+        shellClose(cwdFd);
+    }
+    cwdFd = keepFd(fd);
+
+    for (i = 0; i < REDIRECT_DIR_CACHE_SIZE; ++i) {
+        if (redirectDirs[i].path != NULL && redirectDirs[i].path[0] != '/') {
+            dropRedirectDir(&redirectDirs[i]);
+        }
+    }
+}
+
+/*
+ * forgetDirFds
+ *
+ * For a child whose descriptors above standard error have been closed (see
+ * applyFdActions()): forgets the cached directory descriptors, so that
+ * builtins run there resolve paths from the process's own current
+ * directory instead.
+ */
+void forgetDirFds(void) {
+    int i;
+
+    cwdFd = -1;
+    for (i = 0; i < REDIRECT_DIR_CACHE_SIZE; ++i) {
+        redirectDirs[i].fd = -1;
+    }
+}
+
+/*
+ * noteRedirectDir
+ *
+ * Records a use of the directory part of the redirection target 'path'.
+ * Once a directory has been used REDIRECT_DIR_HOT times it gets a cached
+ * descriptor (replacing the least recently used one if need be).
+ */
+void noteRedirectDir(const char* path) {
+    const char*  slash = strrchr(path, '/');
+    size_t       length;
+    RedirectDir* entry;
+    int          i;
+
+    if (slash == NULL) {
+        return;  /* Relative to the current directory, which is cached */
+    }
+    length = (slash == path) ? 1 : (size_t) (slash - path);
+
+    if ((entry = findRedirectDir(path, length)) == NULL) {
+        entry = &redirectDirs[0];
+        for (i = 1; i < REDIRECT_DIR_CACHE_SIZE; ++i) {
+            if (redirectDirs[i].lastUse < entry->lastUse) {
+                entry = &redirectDirs[i];
+            }
+        }
+        dropRedirectDir(entry);
+        entry->path = strndup(path, length);
+        entry->fd   = -1;
+        entry->dev  = 0;
+        entry->ino  = 0;
+        entry->uses = 0;
+    }
+
+    entry->lastUse = ++useClock;
+    if (++entry->uses >= REDIRECT_DIR_HOT && entry->fd < 0) {
+        struct stat info;
+
+        entry->fd = keepFd(shellOpen(entry->path, O_PATH | O_DIRECTORY, 0));
+        if (entry->fd >= 0 && fstat(entry->fd, &info) == 0) {
+            entry->dev = info.st_dev;
+            entry->ino = info.st_ino;
+        }
+    }
+}
+
+/*
+ * openRedirectTarget
+ *
+ * Opens the redirection target 'path' as open(2) would, but relative to a
+ * cached directory descriptor where there is one, and subject to the
+ * current redirection policy.  The descriptor is close-on-exec.
+ *
+ * Returns the new descriptor, or -1 with errno set.
+ */
+int openRedirectTarget(const char* path, int flags, mode_t mode) {
+    const char*  slash = strrchr(path, '/');
+    RedirectDir* entry;
+    struct stat  info;
+    int          fd;
+
+    if (slash == NULL || resolveFlags != 0) {
+        /* Policies are defined relative to the current directory */
+        return openRelative(cwdDirFd(), path, flags, mode);
+    }
+
+    entry = findRedirectDir(path, (slash == path) ? 1 : (size_t) (slash - path));
+    if (entry == NULL || entry->fd < 0 || slash[1] == '\0') {
+        return openRelative(cwdDirFd(), path, flags, mode);
+    }
+
+    if (fstatat(cwdDirFd(), entry->path, &info, 0) != 0 || info.st_dev != entry->dev
+            || info.st_ino != entry->ino) {
+        /* The path names another directory now (or none) */
+        dropRedirectDir(entry);
+        return openRelative(cwdDirFd(), path, flags, mode);
+    }
+
+    entry->lastUse = ++useClock;
+    fd = openRelative(entry->fd, slash + 1, flags, mode);
+    if (fd < 0 && (errno == ENOENT || errno == ESTALE)) {
+        /* The directory may have been replaced since we cached it */
+        dropRedirectDir(entry);
+        fd = openRelative(cwdDirFd(), path, flags, mode);
+    }
+    return fd;
+}
+
+/*
+ * redirPolicyDefault
+ *
+ * Returns true if redirection targets are resolved without restrictions.
+ */
+bool redirPolicyDefault(void) {
+    return resolveFlags == 0;
+}
+
+/*
+ * doRedirPolicy
+ *
+ * Implements the built-in 'redirpolicy' command, which restricts how
+ * redirection targets are resolved:
+ *
+ *     redirpolicy beneath     targets must lie beneath the current directory
+ *     redirpolicy nosymlinks  no symbolic links may be followed
+ *     redirpolicy default     no restrictions
+ *
+ * Several policies may be given at once.  With no arguments the current
+ * policy is printed.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doRedirPolicy(char** args) {
+    unsigned long long flags = 0;
+    int                i;
+
+    if (args[1] == NULL) {
+        printf("redirpolicy:%s%s%s\n",
+               resolveFlags == 0 ? " default" : "",
+               (resolveFlags & RESOLVE_BENEATH) ? " beneath" : "",
+               (resolveFlags & RESOLVE_NO_SYMLINKS) ? " nosymlinks" : "");
+        return 0;
+    }
+
+    for (i = 1; args[i] != NULL; ++i) {
+        if (strcmp(args[i], "beneath") == 0) {
+            flags |= RESOLVE_BENEATH;
+        } else if (strcmp(args[i], "nosymlinks") == 0) {
+            flags |= RESOLVE_NO_SYMLINKS;
+        } else if (strcmp(args[i], "default") != 0) {
+            printf("usage: redirpolicy [beneath] [nosymlinks] | default\n");
+            return 1;
+        }
+    }
+    resolveFlags = flags;
+    return 0;
+}
+
+/*
+ * doCd
+ *
+ * Implements the built-in 'cd' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        args[1] is the directory to change to; with no argument it is
+ *        $HOME, and "-" means the previous directory ($OLDPWD), which is
+ *        printed.
+ */
+int doCd(char** args) {
+    if (args[1] == NULL) {
+        const char* home = getenv("HOME");
+
+        if (home == NULL) {
+            printf("cd: HOME not set\n");
+            return 1;
+        }
+        return changeDir(home) ? 0 : 1;
+
+    } else if (strcmp(args[1], "-") == 0) {
+        DirEntry target = previousDir;
+
+        if (target.fd < 0) {
+            printf("cd: OLDPWD not set\n");
+            return 1;
+        }
+        previousDir.path = NULL;
+        previousDir.fd   = -1;
+        if (!enterDir(&target)) {
+            previousDir = target;
+            return 1;
+        }
+        printf("%s\n", currentPath);
+
+    } else {
+        return changeDir(args[1]) ? 0 : 1;
+    }
+    return 0;
+}
+
+/*
+ * doPushd
+ *
+ * Implements the built-in 'pushd' command, which saves the current
+ * directory on the stack and changes to args[1].  With no argument, the
+ * current directory and the top of the stack are exchanged.  The stack is
+ * then printed, as for 'dirs'.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doPushd(char** args) {
+    DirEntry here;
+
+    if (args[1] == NULL && dirStackDepth == 0) {
+        printf("pushd: no other directory\n");
+        return 1;
+    }
+    if (args[1] != NULL && dirStackDepth == MAX_DIR_STACK) {
+        printf("pushd: directory stack full\n");
+        return 1;
+    }
+
+    here = currentDir();
+    if (here.fd < 0) {
+        perror("pushd");
+        free(here.path);
+        return 1;
+    }
+
+    if (args[1] == NULL) {
+        DirEntry top = dirStack[dirStackDepth - 1];
+
+        if (!enterDir(&top)) {
+            shellClose(here.fd);
+            free(here.path);
+            return 1;
+        }
+        dirStack[dirStackDepth - 1] = here;
+
+    } else {
+        if (!changeDir(args[1])) {
+            shellClose(here.fd);
+            free(here.path);
+            return 1;
+        }
+        dirStack[dirStackDepth++] = here;
+    }
+
+    printDirs();
+    return 0;
+}
+
+/*
+ * doPopd
+ *
+ * Implements the built-in 'popd' command, which removes the top of the
+ * directory stack and changes to it, then prints the stack.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doPopd(char** args) {
+    (void) args;
+
+    if (dirStackDepth == 0) {
+        printf("popd: directory stack empty\n");
+        return 1;
+    }
+
+    if (!enterDir(&dirStack[dirStackDepth - 1])) {
+        return 1;
+    }
+    dirStackDepth--;
+    printDirs();
+    return 0;
+}
+
+/*
+ * doDirs
+ *
+ * Implements the built-in 'dirs' command, which prints the current
+ * directory followed by the directory stack, most recent first.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doDirs(char** args) {
+    (void) args;
+    printDirs();
+    return 0;
+}
+
+/*
+ * findRedirectDir
+ *
+ * Returns the cache entry for the directory named by the first 'length'
+ * characters of 'dir', or NULL if there is none.
+ */
+static RedirectDir* findRedirectDir(const char* dir, size_t length) {
+    int i;
+
+    for (i = 0; i < REDIRECT_DIR_CACHE_SIZE; ++i) {
+        const char* path = redirectDirs[i].path;
+
+        if (path != NULL && strncmp(path, dir, length) == 0
+                && path[length] == '\0') {
+            return &redirectDirs[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * dropRedirectDir
+ *
+ * Empties a cache entry, closing its descriptor.
+ */
+static void dropRedirectDir(RedirectDir* entry) {
+    if (entry->path != NULL && entry->fd >= 0) {
+        shellClose(entry->fd);
+    }
+    free(entry->path);
+    entry->path = NULL;
+    entry->fd   = -1;
+    entry->uses = 0;
+}
+
+/*
+ * openRelative
+ *
+ * Opens 'path' relative to 'dirFd' with openat2(), applying the current
+ * RESOLVE_* policy, and falls back to openat() on kernels without
+ * openat2() when no policy is in force.
+ */
+static int openRelative(int dirFd, const char* path, int flags, mode_t mode) {
+    struct open_how how;
+    int             fd;
+
+    memset(&how, 0, sizeof(how));
+    how.flags   = (unsigned long long) (flags | O_CLOEXEC);
+    how.mode    = (flags & O_CREAT) ? mode : 0;
+    how.resolve = resolveFlags;
+
+#ifdef SYS_openat2
+    fd = (int) syscall(SYS_openat2, dirFd, path, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS) {
+        return trackFd(fd, FD_SITE);
+    }
+#endif
+    if (resolveFlags != 0) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    fd = openat(dirFd, path, flags | O_CLOEXEC, mode);
+    return trackFd(fd, FD_SITE);
+}
+
+/*
+ * changeDir
+ *
+ * Changes to the directory 'path', remembering where we were for "cd -".
+ * A relative path without ".." components is opened relative to the cached
+ * current directory; otherwise the logical path is opened, so ".." undoes
+ * the last component of $PWD even if it was reached through a symlink.
+ *
+ * Returns false, after printing a message, if the directory can't be
+ * entered.
+ */
+static bool changeDir(const char* path) {
+    DirEntry target;
+    char*    logical = logicalPath(path);
+
+    if (path[0] != '/' && !hasDotDot(path)) {
+        target.fd = shellTrack(openat(cwdDirFd(), path,
+                                      O_PATH | O_DIRECTORY | O_CLOEXEC));
+    } else {
+        target.fd = shellOpen(logical != NULL ? logical : path,
+                              O_PATH | O_DIRECTORY, 0);
+    }
+    if (target.fd < 0) {
+        perror(path);
+        free(logical);
+        return false;
+    }
+
+    target.path = logical;
+    if (!enterDir(&target)) {
+        shellClose(target.fd);
+        free(target.path);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * enterDir
+ *
+ * Makes 'entry' the current directory with fchdir(), handing its
+ * descriptor and path over to the current directory cache.  The directory
+ * being left becomes the one "cd -" returns to.
+ *
+ * Returns false, after printing a message (and leaving 'entry' alone), if
+ * the directory can't be entered.
+ */
+static bool enterDir(DirEntry* entry) {
+    DirEntry here = currentDir();
+
+    if (fchdir(entry->fd) < 0) {
+        perror(entry->path != NULL ? entry->path : "fchdir");
+        if (here.fd >= 0) {
+            shellClose(here.fd);
+        }
+        free(here.path);
+        return false;
+    }
+
+    if (previousDir.fd >= 0) {
+        shellClose(previousDir.fd);
+    }
+    free(previousDir.path);
+    previousDir = here;
+
+    setCwdDirFd(entry->fd);
+    setCurrentPath(entry->path != NULL ? entry->path : getcwd(NULL, 0));
+    entry->path = NULL;
+    entry->fd   = -1;
+    return true;
+}
+
+/*
+ * currentDir
+ *
+ * Returns a new entry (its own descriptor and path) for the current
+ * directory.  The descriptor is -1 if it could not be duplicated.
+ */
+static DirEntry currentDir(void) {
+    DirEntry entry;
+
+    entry.fd   = keepFd(shellDup(cwdDirFd()));
+    entry.path = currentPath != NULL ? strdup(currentPath) : NULL;
+    return entry;
+}
+
+/*
+ * setCurrentPath
+ *
+ * Makes 'path' (which is taken over) the logical current directory and
+ * exports it, and the directory before it, as $PWD and $OLDPWD.
+ */
+static void setCurrentPath(char* path) {
+    if (currentPath != NULL) {
+        setenv("OLDPWD", currentPath, 1);
+    }
+    free(currentPath);
+    currentPath = path;
+    if (path != NULL) {
+        setenv("PWD", path, 1);
+    }
+}
+
+/*
+ * logicalPath
+ *
+ * Returns a newly allocated absolute version of 'path' interpreted relative
+ * to $PWD, with "." and ".." components (and repeated slashes) removed
+ * textually, or NULL if $PWD is unknown.
+ */
+static char* logicalPath(const char* path) {
+    size_t      size;
+    char*       result;
+    size_t      length = 0;
+    const char* p;
+
+    if (path[0] != '/' && currentPath == NULL) {
+        return NULL;
+    }
+
+    size   = strlen(path) + (currentPath != NULL ? strlen(currentPath) : 0) + 3;
+    result = malloc(size);
+    if (path[0] == '/') {
+        result[0] = '\0';
+    } else {
+        strcpy(result, currentPath);
+        length = strlen(result);
+        if (length == 1) {
+            length = 0;  /* "/" */
+        }
+    }
+
+    for (p = path; *p != '\0';) {
+        const char* end = strchrnul(p, '/');
+        size_t      component = (size_t) (end - p);
+
+        if (component == 0 || (component == 1 && p[0] == '.')) {
+            /* Nothing to add */
+        } else if (component == 2 && p[0] == '.' && p[1] == '.') {
+            while (length > 0 && result[length - 1] != '/') {
+                length--;
+            }
+            if (length > 0) {
+                length--;
+            }
+        } else {
+            result[length++] = '/';
+            memcpy(result + length, p, component);
+            length += component;
+        }
+        p = (*end == '/') ? end + 1 : end;
+    }
+
+    if (length == 0) {
+        result[length++] = '/';
+    }
+    result[length] = '\0';
+    return result;
+}
+
+/*
+ * hasDotDot
+ *
+ * Returns true if 'path' has a ".." component.
+ */
+static bool hasDotDot(const char* path) {
+    const char* p = path;
+
+    while ((p = strstr(p, "..")) != NULL) {
+        if ((p == path || p[-1] == '/') && (p[2] == '\0' || p[2] == '/')) {
+            return true;
+        }
+        p += 2;
+    }
+    return false;
+}
+
+/*
+ * printDirs
+ *
+ * Prints the current directory and then the directory stack, most recent
+ * first, on one line.
+ */
+static void printDirs(void) {
+    int i;
+
+    printf("%s", currentPath != NULL ? currentPath : ".");
+    for (i = dirStackDepth - 1; i >= 0; --i) {
+        printf(" %s", dirStack[i].path != NULL ? dirStack[i].path : "?");
+    }
+    printf("\n");
+}
@@ -0,0 +1,43 @@
+/*
+ * shellDirs.h
+ *
+ * The shell keeps an O_PATH descriptor for its current directory and for
+ * the directories it redirects into most often, and opens redirection
+ * targets relative to those with openat2() rather than resolving every
+ * path from scratch.
+ *
+ * The cd, pushd, popd and dirs builtins live here too.  Every directory on
+ * the stack (and the previous directory, for "cd -") keeps an O_PATH
+ * descriptor, so going back to one is an fchdir() with no path walk, and
+ * $PWD is tracked logically rather than with getcwd().
+ */
+#ifndef SHELL_DIRS_H
+#define SHELL_DIRS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* How many redirection directories to keep descriptors for */
+#define REDIRECT_DIR_CACHE_SIZE 8
+
+/* Uses before a redirection directory is worth a cached descriptor */
+#define REDIRECT_DIR_HOT 2
+
+/* Deepest the pushd stack may get */
+#define MAX_DIR_STACK 64
+
+/* Function prototypes */
+void initDirs(void);
+int  cwdDirFd(void);
+void setCwdDirFd(int fd);
+void forgetDirFds(void);
+void noteRedirectDir(const char* path);
+int  openRedirectTarget(const char* path, int flags, mode_t mode);
+bool redirPolicyDefault(void);
+int  doRedirPolicy(char** args);
+int  doCd(char** args);
+int  doPushd(char** args);
+int  doPopd(char** args);
+int  doDirs(char** args);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ * shellExec.c
+ *
+ * The exec cache (see shellExec.h).
+ *
+ * Each launch of a program by absolute path is counted.  Once a program
+ * has been launched EXEC_HOT times it gets an O_PATH descriptor, and an
+ * inotify watch is put on the inode that descriptor refers to (through
+ * /proc/self/fd, so there is no window in which the path could name some
+ * other file).  Replacing a program -- writing it, changing its
+ * attributes, or renaming or unlinking it, which changes its link count --
+ * raises an event on that inode; pending events are read before every
+ * lookup and the affected descriptors closed, so the next launch opens the
+ * new file.  When every slot is taken, the least launched (then least
+ * recently launched) program makes way for a new one.
+ *
+ * Only ELF binaries are cached: the kernel runs a script by passing its
+ * path to the interpreter, which it cannot do for a close-on-exec
+ * descriptor.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include "shellExec.h"
+#include "shellFd.h"
+
+/* Events meaning a cached program may no longer be the file at its path */
+#define EXEC_WATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+/* A program the shell has launched, and maybe a descriptor for it */
+typedef struct {
+    char*         path;      /* NULL if the slot is free */
+    int           fd;        /* O_PATH descriptor, -1 until it is hot */
+    int           watch;     /* inotify watch on the descriptor's inode */
+    bool          script;    /* Not an ELF binary, so never given one */
+    unsigned int  launches;
+    unsigned long lastLaunch;
+} ExecEntry;
+
+static ExecEntry     execEntries[EXEC_CACHE_SIZE];
+static unsigned long launchClock = 0;
+static bool          cacheEnabled = false;
+
+/* The inotify instance watching cached programs */
+static int inotifyFd = -1;
+
+/* Function prototypes */
+static ExecEntry* findExecEntry(const char* path);
+static void       openExecEntry(ExecEntry* entry);
+static void       dropExecFd(ExecEntry* entry);
+static void       readExecEvents(void);
+static bool       isElf(int fd);
+
+/*
+ * setExecCache
+ *
+ * Turns the exec cache on or off.  Turning it off closes every cached
+ * descriptor.
+ */
+void setExecCache(bool enabled) {
+    int i;
+
+    if (enabled && !cacheEnabled) {
+        for (i = 0; i < EXEC_CACHE_SIZE; ++i) {
+            execEntries[i].fd    = -1;
+            execEntries[i].watch = -1;
+        }
+    } else if (!enabled) {
+        for (i = 0; i < EXEC_CACHE_SIZE; ++i) {
+            dropExecFd(&execEntries[i]);
+            free(execEntries[i].path);
+            execEntries[i].path = NULL;
+        }
+        if (inotifyFd >= 0) {
+            shellClose(inotifyFd);
+            inotifyFd = -1;
+        }
+    }
+    cacheEnabled = enabled;
+}
+
+/*
+ * execCacheEnabled
+ *
+ * Returns true if the exec cache is on.
+ */
+bool execCacheEnabled(void) {
+    return cacheEnabled;
+}
+
+/*
+ * findExecFd
+ *
+ * Counts a launch of the program 'path' and returns a close-on-exec
+ * O_PATH descriptor for it, to be run with execveat(fd, "", ...,
+ * AT_EMPTY_PATH), or -1 if it has none.  The descriptor belongs to the
+ * cache.
+ */
+int findExecFd(const char* path) {
+    ExecEntry* entry;
+
+    if (!cacheEnabled || path[0] != '/') {
+        return -1;  /* A relative path depends on the current directory */
+    }
+    readExecEvents();
+
+    if ((entry = findExecEntry(path)) == NULL) {
+        int i;
+
+        entry = &execEntries[0];
+        for (i = 1; i < EXEC_CACHE_SIZE; ++i) {
+            ExecEntry* other = &execEntries[i];
+
+            if (other->launches < entry->launches || (other->launches == entry->launches
+                    && other->lastLaunch < entry->lastLaunch)) {
+                entry = other;
+            }
+        }
+        dropExecFd(entry);
+        free(entry->path);
+        entry->path     = strdup(path);
+        entry->script   = false;
+        entry->launches = 0;
+    }
+
+    entry->lastLaunch = ++launchClock;
+    if (++entry->launches >= EXEC_HOT && entry->fd < 0 && !entry->script) {
+        openExecEntry(entry);
+    }
+    return entry->fd;
+}
+
+/*
+ * forgetExecCache
+ *
+ * For a child whose descriptors above standard error have been closed (see
+ * applyFdActions()): forgets the cached descriptors and the inotify
+ * instance, so that programs it starts are found by path, and caches again
+ * from scratch.
+ */
+void forgetExecCache(void) {
+    int i;
+
+    for (i = 0; i < EXEC_CACHE_SIZE; ++i) {
+        execEntries[i].fd    = -1;
+        execEntries[i].watch = -1;
+    }
+    inotifyFd = -1;
+}
+
+/*
+ * doExecCache
+ *
+ * Implements the built-in 'execcache' command, which turns the exec cache
+ * on or off.  With no argument the current state is printed, along with
+ * the programs that have descriptors and how often each was launched.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command.
+ */
+int doExecCache(char** args) {
+    int i;
+
+    if (args[1] == NULL) {
+        printf("execcache is %s\n", cacheEnabled ? "on" : "off");
+        readExecEvents();
+        for (i = 0; i < EXEC_CACHE_SIZE; ++i) {
+            if (execEntries[i].fd >= 0) {
+                printf("%8u  %s\n", execEntries[i].launches, execEntries[i].path);
+            }
+        }
+    } else if (args[2] == NULL && strcmp(args[1], "on") == 0) {
+        setExecCache(true);
+    } else if (args[2] == NULL && strcmp(args[1], "off") == 0) {
+        setExecCache(false);
+    } else {
+        printf("usage: execcache [on|off]\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * findExecEntry
+ *
+ * Returns the entry for the program 'path', or NULL if it has none.
+ */
+static ExecEntry* findExecEntry(const char* path) {
+    int i;
+
+    for (i = 0; i < EXEC_CACHE_SIZE; ++i) {
+        if (execEntries[i].path != NULL && strcmp(execEntries[i].path, path) == 0) {
+            return &execEntries[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * openExecEntry
+ *
+ * Gives 'entry' a descriptor for its program, watched for changes.  Leaves
+ * it without one if the program cannot be opened, is not an ELF binary
+ * (which is remembered) or cannot be watched.
+ */
+static void openExecEntry(ExecEntry* entry) {
+    char link[32];
+    int  fd;
+
+    if (inotifyFd < 0) {
+        inotifyFd = keepFd(shellTrack(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)));
+        if (inotifyFd < 0) {
+            return;
+        }
+    }
+
+    if ((fd = shellOpen(entry->path, O_PATH, 0)) < 0) {
+        return;
+    }
+    if (!isElf(fd)) {
+        entry->script = true;
+        shellClose(fd);
+        return;
+    }
+
+    /* Links to one program share a watch: inotify returns the existing one */
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    if ((entry->watch = inotify_add_watch(inotifyFd, link, EXEC_WATCH_EVENTS)) < 0) {
+        shellClose(fd);
+        return;
+    }
+    entry->fd = keepFd(fd);
+}
+
+/*
+ * dropExecFd
+ *
+ * Closes the descriptor of 'entry', if it has one, and stops watching its
+ * program unless another entry (a link to it) still needs the watch.
+ */
+static void dropExecFd(ExecEntry* entry) {
+    int i;
+
+    if (entry->fd < 0) {
+        return;
+    }
+    shellClose(entry->fd);
+    entry->fd = -1;
+
+    for (i = 0; i < EXEC_CACHE_SIZE; ++i) {
+        if (&execEntries[i] != entry && execEntries[i].fd >= 0
+                && execEntries[i].watch == entry->watch) {
+            break;
+        }
+    }
+    if (i == EXEC_CACHE_SIZE) {
+        inotify_rm_watch(inotifyFd, entry->watch);
+    }
+    entry->watch = -1;
+}
+
+/*
+ * readExecEvents
+ *
+ * Reads pending inotify events and drops the descriptors of the programs
+ * they are about.
+ */
+static void readExecEvents(void) {
+    char    buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    if (inotifyFd < 0) {
+        return;
+    }
+
+    while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+        char* next = buffer;
+
+        while (next < buffer + length) {
+            const struct inotify_event* event = (const struct inotify_event*) next;
+            int                         i;
+
+            for (i = 0; i < EXEC_CACHE_SIZE; ++i) {
+                if (execEntries[i].fd >= 0 && execEntries[i].watch == event->wd) {
+                    dropExecFd(&execEntries[i]);
+                }
+            }
+            next += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/*
+ * isElf
+ *
+ * Returns true if the file 'fd' (an O_PATH descriptor) refers to starts
+ * like an ELF binary.
+ */
+static bool isElf(int fd) {
+    char link[32];
+    char magic[4];
+    int  file;
+    bool elf;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    if ((file = shellOpen(link, O_RDONLY, 0)) < 0) {
+        return false;
+    }
+    elf = pread(file, magic, sizeof(magic), 0) == sizeof(magic)
+          && memcmp(magic, "\177ELF", sizeof(magic)) == 0;
+    shellClose(file);
+    return elf;
+}
@@ -0,0 +1,29 @@
+/*
+ * shellExec.h
+ *
+ * The exec cache ('execcache on', or SHELL_EXEC_CACHE in the environment)
+ * keeps an O_PATH descriptor for each of the programs the shell launches
+ * most often, and starts them with execveat() on that descriptor instead
+ * of having the kernel resolve their paths again.  A cached descriptor is
+ * dropped as soon as inotify reports that its file was changed, moved,
+ * replaced or removed.
+ */
+#ifndef SHELL_EXEC_H
+#define SHELL_EXEC_H
+
+#include <stdbool.h>
+
+/* Programs whose launches are counted (and may get descriptors) */
+#define EXEC_CACHE_SIZE 32
+
+/* Launches before a program is worth a cached descriptor */
+#define EXEC_HOT 3
+
+/* Function prototypes */
+void setExecCache(bool enabled);
+bool execCacheEnabled(void);
+int  findExecFd(const char* path);
+void forgetExecCache(void);
+int  doExecCache(char** args);
+
+#endif
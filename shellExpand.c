@@ -0,0 +1,870 @@
+/*
+ * shellExpand.c
+ *
+ * Word expansion (see shellExpand.h).
+ *
+ * Words without a '$' are passed through as they are; the others are
+ * rebuilt in a buffer that grows as needed.  Variable names are looked up
+ * in place (see getVar()), so nothing is copied but the values.
+ *
+ * The string operators of ${...} work on the value where it is stored:
+ * patterns are matched against slices of it in place (see globMatch()),
+ * and only the part that survives is appended to the word.  Operands are
+ * used where they stand in the word unless they contain expansions of
+ * their own, so an operation allocates nothing but the word it builds.
+ *
+ * A word that is just ${name[@]} becomes one word per item of the array,
+ * copied straight out of the array into the words of the line; the items
+ * are never joined into a string to be split up again.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "shellExpand.h"
+#include "shellParser.h"
+#include "shellVars.h"
+#include "shellGlob.h"
+
+/* A word being expanded */
+typedef struct {
+    char*  data;
+    size_t length;
+    size_t capacity;
+} ExpandText;
+
+/* An operand of a ${...} operator: a pattern, replacement, offset or length */
+typedef struct {
+    const char* data;
+    size_t      length;
+    char*       expanded;  /* Where 'data' points if it had expansions of its own */
+} ExpandOperand;
+
+/* The status $? expands to */
+static int lastStatus = 0;
+
+/* Set when a ${...} failed with a message of its own (${name:?message}) */
+static bool reported = false;
+
+/* An array expanded inside a word (${name[@]}, ${name[*]}) */
+typedef struct {
+    const char* op;     /* The operator applied to each item, or the closing brace */
+    const char* close;
+    ExpandText* text;
+    bool        first;
+    bool        done;
+} ExpandItems;
+
+/* The words of the last line expanded, which of them were allocated, and their quotes */
+static char* words[MAX_ARGS + 1];
+static bool  allocated[MAX_ARGS + 1];
+static char  wordQuotes[MAX_ARGS + 1];
+static int   wordCount = 0;
+
+/* Function prototypes */
+static char* expandWord(const char* word);
+static bool  expandBraces(const char* word, const char** next, ExpandText* text);
+static bool  expandValue(const char* name, size_t length, const ExpandOperand* subscript,
+                         char prefix, const char* op, const char* close, ExpandText* text);
+static bool  applyDefault(const char* name, size_t length, const ExpandOperand* subscript,
+                          bool all, const char* op, const char* close, ExpandText* text);
+static bool  appendItem(const char* item, void* context);
+static bool  isArrayWord(const char* word, const char** name, size_t* length, bool* keys);
+static bool  addArrayWord(const char* item, void* context);
+static bool  applyOperator(const char* op, const char* close, const char* value,
+                           ExpandText* text);
+static void  removeAffix(const char* value, size_t length, const ExpandOperand* pattern,
+                         bool suffix, bool longest, ExpandText* text);
+static void  replacePattern(const char* value, size_t length, const ExpandOperand* pattern,
+                            const ExpandOperand* replacement, char anchor, bool all,
+                            ExpandText* text);
+static bool  takeSubstring(const char* value, size_t length, const ExpandOperand* offset,
+                           const ExpandOperand* count, ExpandText* text);
+static void  convertCase(const char* value, size_t length, const ExpandOperand* pattern,
+                         bool upper, bool all, ExpandText* text);
+static size_t matchAt(const char* value, size_t length, size_t start,
+                      const ExpandOperand* pattern);
+static bool  getOperand(const char* from, const char* to, ExpandOperand* operand);
+static bool  parseNumber(const ExpandOperand* operand, long* number);
+static const char* findClose(const char* from);
+static const char* findSeparator(const char* from, const char* to, char separator);
+static void  appendText(ExpandText* text, const char* data, size_t length);
+
+/*
+ * expandLine
+ *
+ * Expands the words of 'line', the command line just scanned (see
+ * getArgQuotes()).
+ *
+ * Returns the expanded words, NULL-terminated and valid until the next
+ * call, or NULL (after printing a message) if a word cannot be expanded.
+ */
+char** expandLine(char** line) {
+    const char* quotes = getArgQuotes();
+    const char* name;
+    size_t      length;
+    bool        keys;
+    int         i;
+
+    for (i = 0; i < wordCount; ++i) {
+        if (allocated[i]) {
+            free(words[i]);
+        }
+    }
+    wordCount = 0;
+
+    for (i = 0; line[i] != NULL; ++i) {
+        if (quotes[i] != '\'' && isArrayWord(line[i], &name, &length, &keys)) {
+            if (!visitArray(name, length, keys, addArrayWord, NULL)) {
+                words[wordCount] = NULL;
+                return NULL;
+            }
+            continue;
+        }
+
+        if (wordCount >= MAX_ARGS) {
+            fprintf(stderr, "too many arguments\n");
+            return NULL;
+        }
+        wordQuotes[wordCount] = quotes[i];
+        if (quotes[i] == '\'' || strchr(line[i], '$') == NULL) {
+            words[wordCount]     = line[i];
+            allocated[wordCount] = false;
+        } else if ((words[wordCount] = expandWord(line[i])) != NULL) {
+            allocated[wordCount] = true;
+        } else {
+            return NULL;
+        }
+        wordCount++;
+    }
+    words[wordCount] = NULL;
+    return words;
+}
+
+/*
+ * getWordQuotes
+ *
+ * Returns the quote ('"', '\'' or '\0' for none) around each of the words
+ * expandLine() last returned.  The items an array expanded into count as
+ * double-quoted.
+ */
+const char* getWordQuotes(void) {
+    return wordQuotes;
+}
+
+/*
+ * isAssignmentLine
+ *
+ * Returns true if every word of 'line', the command line just scanned, is
+ * an unquoted assignment (name=value, name[key]=value) or part of a list
+ * assignment (name=(item ...)), so the line sets variables rather than
+ * running a command.
+ */
+bool isAssignmentLine(char** line) {
+    const char* quotes = getArgQuotes();
+    int         i;
+
+    for (i = 0; line[i] != NULL; ++i) {
+        if (quotes[i] != '\0' || !isAssignment(line[i])) {
+            return false;
+        }
+        if (!isListAssignment(line[i])) {
+            continue;
+        }
+
+        /* The list goes on to an unquoted word ending in ')' */
+        for (; line[i] != NULL; ++i) {
+            if (quotes[i] == '\0' && line[i][strlen(line[i]) - 1] == ')') {
+                break;
+            }
+        }
+        if (line[i] == NULL) {
+            return false;
+        }
+    }
+    return i > 0;
+}
+
+/*
+ * setLastStatus
+ *
+ * Records 'status', the exit status of the command line just run, for $?.
+ */
+void setLastStatus(int status) {
+    lastStatus = status;
+}
+
+/*
+ * expandWord
+ *
+ * Returns (allocated) 'word' with each expansion in it replaced by its
+ * value, or NULL after printing a message if one is malformed.  A '$' that
+ * starts no expansion stands for itself.
+ */
+static char* expandWord(const char* word) {
+    ExpandText  text = { NULL, 0, 0 };
+    const char* p    = word;
+
+    appendText(&text, "", 0);
+    while (*p != '\0') {
+        const char* dollar = strchrnul(p, '$');
+        const char* name;
+        char        number[24];
+
+        appendText(&text, p, (size_t) (dollar - p));
+        if (*dollar == '\0') {
+            break;
+        }
+
+        p = dollar + 1;
+        if (*p == '{') {
+            if (!expandBraces(word, &p, &text)) {
+                free(text.data);
+                return NULL;
+            }
+        } else if (*p == '?' || *p == '$') {
+            snprintf(number, sizeof(number), "%d", *p == '?' ? lastStatus : (int) getpid());
+            appendText(&text, number, strlen(number));
+            p++;
+        } else if (isVarName(p, 1)) {
+            const char* value;
+
+            for (name = p++; isalnum((unsigned char) *p) || *p == '_'; ++p) {
+            }
+            if ((value = getVar(name, (size_t) (p - name))) != NULL) {
+                appendText(&text, value, strlen(value));
+            }
+        } else {
+            appendText(&text, "$", 1);
+        }
+    }
+    return text.data;
+}
+
+/*
+ * expandBraces
+ *
+ * Expands the ${...} at '*next' (just past the '$') in 'word' onto 'text',
+ * and moves '*next' past it:
+ *
+ *     ${name}                  the value
+ *     ${name[key]}             an item of an array (see getArrayItem())
+ *     ${name[@]} ${name[*]}    every item of an array, separated by blanks
+ *     ${!name[@]}              the keys (or indexes) of an array
+ *     ${#name} ${#name[key]}   the length of a value
+ *     ${#name[@]}              the number of items in an array
+ *     ${name#pat} ${name##pat} without the shortest/longest prefix matching pat
+ *                              (x=a.b.c: ${x#*.} is b.c, ${x##*.} is c)
+ *     ${name%pat} ${name%%pat} without the shortest/longest suffix matching pat
+ *                              (x=a.b.c: ${x%.*} is a.b, ${x%%.*} is a)
+ *     ${name/pat/rep}          the first (longest) match of pat replaced by rep;
+ *                              // replaces every match, /# one at the start,
+ *                              /% one at the end
+ *     ${name:-word}            word if name is unset or empty, else the value
+ *     ${name:=word}            the same, assigning word to name first
+ *     ${name:+word}            word if name is set and not empty, else nothing
+ *     ${name:?word}            the value, or a failure with the message word
+ *                              if name is unset or empty
+ *     ${name:off} ${name:off:len}  the bytes from off (from the end if
+ *                              negative, written (-n), as :- is the operator
+ *                              above), len of them (or up to len from the end
+ *                              if negative)
+ *     ${name^} ${name^^}       the first/every byte in upper case
+ *     ${name,} ${name,,}       the first/every byte in lower case, either
+ *                              optionally only those matching a pattern
+ *
+ * The operators work on an item (name[key]) as on a value, and on each
+ * item of name[@] in turn.
+ *
+ * Returns false, after printing a message, if it is malformed.
+ */
+static bool expandBraces(const char* word, const char** next, ExpandText* text) {
+    ExpandOperand subscript = { NULL, 0, NULL };
+    const char*   name      = *next + 1;
+    const char*   close     = findClose(name);
+    const char*   bracket   = NULL;
+    const char*   op;
+    char          prefix    = '\0';  /* The # of a length or ! of keys */
+    bool          done;
+
+    reported = false;
+    if (close != NULL && (name[0] == '#' || name[0] == '!') && close > name + 1) {
+        prefix = *name++;
+    }
+    for (op = name; close != NULL && op < close && (isalnum((unsigned char) *op) || *op == '_'); ++op) {
+    }
+    if (close != NULL && *op == '[') {
+        bracket = findSeparator(op + 1, close, ']');
+    }
+
+    done = close != NULL && isVarName(name, (size_t) (op - name))
+           && (*op != '[' || (bracket != NULL && getOperand(op + 1, bracket, &subscript)));
+    if (done) {
+        done = expandValue(name, (size_t) (op - name), bracket != NULL ? &subscript : NULL,
+                           prefix, bracket != NULL ? bracket + 1 : op, close, text);
+    }
+    free(subscript.expanded);
+    if (!done) {
+        if (!reported) {
+            fprintf(stderr, "%s: bad substitution\n", word);
+        }
+        return false;
+    }
+    *next = close + 1;
+    return true;
+}
+
+/*
+ * expandValue
+ *
+ * Appends to 'text' the variable named by the 'length' bytes at 'name',
+ * or the item(s) of it 'subscript' picks out if that is not NULL, with
+ * the 'prefix' ('#', '!' or '\0') and the operator from 'op' to 'close'
+ * (see expandBraces()) applied.
+ *
+ * Returns false if the combination is malformed.
+ */
+static bool expandValue(const char* name, size_t length, const ExpandOperand* subscript,
+                        char prefix, const char* op, const char* close, ExpandText* text) {
+    bool        all = subscript != NULL && subscript->length == 1
+                      && (subscript->data[0] == '@' || subscript->data[0] == '*');
+    const char* value;
+    char        number[24];
+
+    if ((prefix == '!' && !all) || (prefix != '\0' && op != close)) {
+        return false;
+    }
+
+    if (all && prefix == '#') {
+        snprintf(number, sizeof(number), "%zu", getArrayCount(name, length));
+        appendText(text, number, strlen(number));
+        return true;
+    }
+    if (op + 1 < close && op[0] == ':' && strchr("-=+?", op[1]) != NULL) {
+        return applyDefault(name, length, subscript, all, op, close, text);
+    }
+    if (all) {
+        ExpandItems items = { op, close, text, true, true };
+
+        visitArray(name, length, prefix == '!', appendItem, &items);
+        return items.done;
+    }
+
+    if (subscript != NULL) {
+        value = getArrayItem(name, length, subscript->data, subscript->length);
+    } else {
+        value = getVar(name, length);
+    }
+    if (value == NULL) {
+        value = "";
+    }
+    if (prefix == '#') {
+        snprintf(number, sizeof(number), "%zu", strlen(value));
+        appendText(text, number, strlen(number));
+        return true;
+    }
+    if (op == close) {
+        appendText(text, value, strlen(value));
+        return true;
+    }
+    return applyOperator(op, close, value, text);
+}
+
+/*
+ * applyDefault
+ *
+ * Applies the operator :-, :=, :+ or :? at 'op' (see expandBraces()) to
+ * the variable named by the 'length' bytes at 'name', or to the item
+ * 'subscript' picks out of it, or to 'all' its items, appending the
+ * result to 'text'.  Unset and empty count alike, and an array with no
+ * items is empty.  The word after the operator is expanded only if it is
+ * used.
+ *
+ * Returns false if the operator fails: :? on an empty value, after
+ * printing its message, or := on a whole array.
+ */
+static bool applyDefault(const char* name, size_t length, const ExpandOperand* subscript,
+                         bool all, const char* op, const char* close, ExpandText* text) {
+    ExpandOperand word  = { NULL, 0, NULL };
+    const char*   value = NULL;
+    char*         assignment;
+    bool          empty;
+    bool          done  = true;
+
+    if (all) {
+        empty = getArrayCount(name, length) == 0;
+    } else {
+        value = subscript != NULL ? getArrayItem(name, length, subscript->data, subscript->length)
+                                  : getVar(name, length);
+        empty = value == NULL || value[0] == '\0';
+    }
+
+    if (op[1] == '+' ? empty : !empty) {
+        /* The value itself, which for :+ is empty */
+        if (all) {
+            ExpandItems items = { close, close, text, true, true };
+
+            visitArray(name, length, false, appendItem, &items);
+        } else if (value != NULL) {
+            appendText(text, value, strlen(value));
+        }
+        return true;
+    }
+
+    if (!getOperand(op + 2, close, &word)) {
+        return false;
+    }
+    switch (op[1]) {
+    case '=':
+        if (all) {
+            done = false;
+        } else if (subscript != NULL) {
+            done = asprintf(&assignment, "%.*s[%.*s]=%.*s", (int) length, name,
+                            (int) subscript->length, subscript->data,
+                            (int) word.length, word.data) >= 0;
+        } else {
+            done = asprintf(&assignment, "%.*s=%.*s", (int) length, name,
+                            (int) word.length, word.data) >= 0;
+        }
+        if (done) {
+            done = assignVar(assignment);
+            free(assignment);
+        }
+        if (done) {
+            appendText(text, word.data, word.length);
+        }
+        break;
+    case '?':
+        if (word.length > 0) {
+            fprintf(stderr, "%.*s: %.*s\n", (int) length, name, (int) word.length, word.data);
+        } else {
+            fprintf(stderr, "%.*s: parameter null or not set\n", (int) length, name);
+        }
+        reported = true;
+        done     = false;
+        break;
+    default:
+        appendText(text, word.data, word.length);
+    }
+    free(word.expanded);
+    return done;
+}
+
+/*
+ * appendItem
+ *
+ * Appends 'item', one of the items of an array being expanded inside a
+ * word (the ExpandItems 'context'), with the operator applied to it.
+ *
+ * Returns false if the operator is malformed.
+ */
+static bool appendItem(const char* item, void* context) {
+    ExpandItems* items = context;
+
+    if (!items->first) {
+        appendText(items->text, " ", 1);
+    }
+    items->first = false;
+
+    if (items->op == items->close) {
+        appendText(items->text, item, strlen(item));
+    } else {
+        items->done = applyOperator(items->op, items->close, item, items->text);
+    }
+    return items->done;
+}
+
+/*
+ * isArrayWord
+ *
+ * Returns true if 'word' is just ${name[@]} or ${!name[@]} (or [*]),
+ * setting '*name' and '*length' to the name and '*keys' to whether it asks
+ * for keys.
+ */
+static bool isArrayWord(const char* word, const char** name, size_t* length, bool* keys) {
+    const char* p = word + 2;
+
+    if (word[0] != '$' || word[1] != '{') {
+        return false;
+    }
+    if ((*keys = *p == '!')) {
+        p++;
+    }
+    for (*name = p; isalnum((unsigned char) *p) || *p == '_'; ++p) {
+    }
+    *length = (size_t) (p - *name);
+    return isVarName(*name, *length) && (strcmp(p, "[@]}") == 0 || strcmp(p, "[*]}") == 0);
+}
+
+/*
+ * addArrayWord
+ *
+ * Adds (a copy of) 'item', an item of an array that makes up a word, to
+ * the words of the line being expanded.
+ *
+ * Returns false, after printing a message, if there are too many words.
+ */
+static bool addArrayWord(const char* item, void* context) {
+    (void) context;
+
+    if (wordCount >= MAX_ARGS) {
+        fprintf(stderr, "too many arguments\n");
+        return false;
+    }
+    words[wordCount]      = strdup(item);
+    allocated[wordCount]  = true;
+    wordQuotes[wordCount] = '"';
+    wordCount++;
+    return true;
+}
+
+/*
+ * applyOperator
+ *
+ * Applies the operator from 'op' to 'close' (the closing brace) of a
+ * ${...} to 'value', appending the result to 'text'.
+ *
+ * Returns false if the operator is malformed.
+ */
+static bool applyOperator(const char* op, const char* close, const char* value,
+                          ExpandText* text) {
+    ExpandOperand first   = { NULL, 0, NULL };
+    ExpandOperand second  = { NULL, 0, NULL };
+    size_t        length  = strlen(value);
+    const char*   from    = op + 1;
+    const char*   split   = NULL;
+    bool          doubled = false;  /* ##, %%, //, ^^ or ,, */
+    char          anchor  = '\0';   /* The # or % of /# or /% */
+    bool          done    = true;
+
+    if (*op != ':' && from < close && *from == *op) {
+        doubled = true;
+        from++;
+    } else if (*op == '/' && from < close && (*from == '#' || *from == '%')) {
+        anchor = *from++;
+    }
+    if (*op == '/' || *op == ':') {
+        split = findSeparator(from, close, *op);
+    }
+    if (!getOperand(from, split != NULL ? split : close, &first)
+            || (split != NULL && !getOperand(split + 1, close, &second))) {
+        free(first.expanded);
+        return false;
+    }
+
+    switch (*op) {
+    case '#':
+    case '%':
+        removeAffix(value, length, &first, *op == '%', doubled, text);
+        break;
+    case '/':
+        replacePattern(value, length, &first, &second, anchor, doubled, text);
+        break;
+    case ':':
+        done = takeSubstring(value, length, &first, split != NULL ? &second : NULL, text);
+        break;
+    case '^':
+    case ',':
+        convertCase(value, length, &first, *op == '^', doubled, text);
+        break;
+    default:
+        done = false;
+    }
+
+    free(first.expanded);
+    free(second.expanded);
+    return done;
+}
+
+/*
+ * removeAffix
+ *
+ * Appends the 'length' bytes of 'value' to 'text' without the shortest
+ * (or 'longest') prefix, or 'suffix', matching 'pattern'.
+ */
+static void removeAffix(const char* value, size_t length, const ExpandOperand* pattern,
+                        bool suffix, bool longest, ExpandText* text) {
+    size_t cut;
+    size_t i;
+
+    if (!hasGlobChars(pattern->data, pattern->length)) {
+        /* A literal prefix or suffix matches one way only */
+        if (pattern->length <= length && memcmp(suffix ? value + length - pattern->length : value,
+                                                pattern->data, pattern->length) == 0) {
+            if (suffix) {
+                appendText(text, value, length - pattern->length);
+            } else {
+                appendText(text, value + pattern->length, length - pattern->length);
+            }
+        } else {
+            appendText(text, value, length);
+        }
+        return;
+    }
+
+    for (i = 0; i <= length; ++i) {
+        cut = longest ? length - i : i;  /* Length of the affix tried */
+        if (suffix ? globMatch(pattern->data, pattern->length, value + length - cut, cut)
+                   : globMatch(pattern->data, pattern->length, value, cut)) {
+            if (suffix) {
+                appendText(text, value, length - cut);
+            } else {
+                appendText(text, value + cut, length - cut);
+            }
+            return;
+        }
+    }
+    appendText(text, value, length);
+}
+
+/*
+ * replacePattern
+ *
+ * Appends the 'length' bytes of 'value' to 'text' with the first match of
+ * 'pattern' (or 'all' of them) replaced by 'replacement'.  With an
+ * 'anchor' of '#' or '%' only a match at the start or end counts.  Each
+ * match is the longest one starting where it does.
+ */
+static void replacePattern(const char* value, size_t length, const ExpandOperand* pattern,
+                           const ExpandOperand* replacement, char anchor, bool all,
+                           ExpandText* text) {
+    bool   literal = !hasGlobChars(pattern->data, pattern->length);
+    size_t done    = 0;  /* Bytes of 'value' dealt with */
+    size_t i       = 0;
+    size_t end;
+
+    if (anchor == '#') {
+        end = matchAt(value, length, 0, pattern);
+        if (end > 0) {
+            appendText(text, replacement->data, replacement->length);
+            done = end;
+        }
+    } else if (anchor == '%') {
+        for (i = 0; i < length; ++i) {
+            if (globMatch(pattern->data, pattern->length, value + i, length - i)) {
+                appendText(text, value, i);
+                appendText(text, replacement->data, replacement->length);
+                done = length;
+                break;
+            }
+        }
+    } else if (pattern->length > 0) {
+        while (i < length) {
+            if (literal) {
+                /* A literal pattern is found with memmem() rather than tried everywhere */
+                const char* found = memmem(value + i, length - i, pattern->data, pattern->length);
+
+                if (found == NULL) {
+                    break;
+                }
+                i   = (size_t) (found - value);
+                end = i + pattern->length;
+            } else if ((end = matchAt(value, length, i, pattern)) == i) {
+                i++;
+                continue;
+            }
+
+            appendText(text, value + done, i - done);
+            appendText(text, replacement->data, replacement->length);
+            done = i = end;
+            if (!all) {
+                break;
+            }
+        }
+    }
+    appendText(text, value + done, length - done);
+}
+
+/*
+ * matchAt
+ *
+ * Returns the end of the longest non-empty match of 'pattern' starting at
+ * 'start' in the 'length' bytes of 'value', or 'start' if there is none.
+ */
+static size_t matchAt(const char* value, size_t length, size_t start,
+                      const ExpandOperand* pattern) {
+    size_t end;
+
+    for (end = length; end > start; --end) {
+        if (globMatch(pattern->data, pattern->length, value + start, end - start)) {
+            return end;
+        }
+    }
+    return start;
+}
+
+/*
+ * takeSubstring
+ *
+ * Appends to 'text' the bytes of 'value' (of 'length') from 'offset' on,
+ * or 'count' of them if it is not NULL.  A negative offset counts from the
+ * end; a negative count leaves that many bytes off the end.
+ *
+ * Returns false if the offset or count is not a number.
+ */
+static bool takeSubstring(const char* value, size_t length, const ExpandOperand* offset,
+                          const ExpandOperand* count, ExpandText* text) {
+    long start;
+    long end = (long) length;
+
+    if (!parseNumber(offset, &start) || (count != NULL && !parseNumber(count, &end))) {
+        return false;
+    }
+    if (start < 0) {
+        start += (long) length;
+    }
+    if (count != NULL) {
+        end = end < 0 ? (long) length + end : start + end;
+    }
+    if (start < 0 || start > (long) length || end < start) {
+        return true;
+    }
+    if (end > (long) length) {
+        end = (long) length;
+    }
+    appendText(text, value + start, (size_t) (end - start));
+    return true;
+}
+
+/*
+ * convertCase
+ *
+ * Appends the 'length' bytes of 'value' to 'text' with the first byte, or
+ * 'all' of them, converted to upper (or lower) case; with a 'pattern',
+ * only bytes matching it are converted.
+ */
+static void convertCase(const char* value, size_t length, const ExpandOperand* pattern,
+                        bool upper, bool all, ExpandText* text) {
+    size_t start = text->length;
+    size_t i;
+
+    appendText(text, value, length);
+    for (i = 0; i < (all ? length : (length > 0 ? 1 : 0)); ++i) {
+        char* c = &text->data[start + i];
+
+        if (pattern->length == 0 || globMatch(pattern->data, pattern->length, c, 1)) {
+            *c = (char) (upper ? toupper((unsigned char) *c) : tolower((unsigned char) *c));
+        }
+    }
+}
+
+/*
+ * getOperand
+ *
+ * Sets 'operand' to the text from 'from' to 'to', expanded if it contains
+ * a '$'.
+ *
+ * Returns false, after printing a message, if it cannot be expanded.
+ */
+static bool getOperand(const char* from, const char* to, ExpandOperand* operand) {
+    char* copy;
+
+    operand->data     = from;
+    operand->length   = (size_t) (to - from);
+    operand->expanded = NULL;
+    if (memchr(from, '$', operand->length) == NULL) {
+        return true;
+    }
+
+    copy              = strndup(from, operand->length);
+    operand->expanded = expandWord(copy);
+    free(copy);
+    if (operand->expanded == NULL) {
+        return false;
+    }
+    operand->data   = operand->expanded;
+    operand->length = strlen(operand->expanded);
+    return true;
+}
+
+/*
+ * parseNumber
+ *
+ * Sets '*number' to the (decimal, possibly negative) integer 'operand'
+ * holds; a negative one may be written in parentheses, (-n).
+ *
+ * Returns false if it does not hold one.
+ */
+static bool parseNumber(const ExpandOperand* operand, long* number) {
+    char   digits[24];
+    char*  end;
+    size_t length = operand->length;
+    size_t start  = 0;
+
+    if (length >= 2 && operand->data[0] == '(' && operand->data[length - 1] == ')') {
+        start   = 1;
+        length -= 2;
+    }
+    if (length == 0 || length >= sizeof(digits)) {
+        return false;
+    }
+    memcpy(digits, operand->data + start, length);
+    digits[length] = '\0';
+    *number        = strtol(digits, &end, 10);
+    return *end == '\0';
+}
+
+/*
+ * findClose
+ *
+ * Returns the '}' closing the ${ whose name starts at 'from', skipping
+ * nested ${...} and quoted characters, or NULL if there is none.
+ */
+static const char* findClose(const char* from) {
+    int depth = 1;
+
+    for (; *from != '\0'; ++from) {
+        if (*from == '\\' && from[1] != '\0') {
+            from++;
+        } else if (*from == '$' && from[1] == '{') {
+            depth++;
+            from++;
+        } else if (*from == '}' && --depth == 0) {
+            return from;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * findSeparator
+ *
+ * Returns the first 'separator' between 'from' and 'to' that is neither
+ * quoted nor inside a nested ${...}, or NULL if there is none.
+ */
+static const char* findSeparator(const char* from, const char* to, char separator) {
+    int depth = 0;
+
+    for (; from < to; ++from) {
+        if (*from == '\\' && from + 1 < to) {
+            from++;
+        } else if (*from == '$' && from + 1 < to && from[1] == '{') {
+            depth++;
+            from++;
+        } else if (*from == '}' && depth > 0) {
+            depth--;
+        } else if (*from == separator && depth == 0) {
+            return from;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * appendText
+ *
+ * Appends the 'length' bytes at 'data' to 'text', which stays
+ * NUL-terminated.
+ */
+static void appendText(ExpandText* text, const char* data, size_t length) {
+    if (text->length + length + 1 > text->capacity) {
+        text->capacity = (text->length + length + 1) * 2;
+        text->data     = realloc(text->data, text->capacity);
+    }
+    memcpy(text->data + text->length, data, length);
+    text->length += length;
+    text->data[text->length] = '\0';
+}
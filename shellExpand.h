@@ -0,0 +1,31 @@
+/*
+ * shellExpand.h
+ *
+ * Before a command line runs, $name, ${name}, $? (the status of the last
+ * command line) and $$ (the shell's process ID) in its words are replaced
+ * by their values.  Words that were single-quoted are left as they are,
+ * and a value never splits into more than one word; only a word that is
+ * just ${name[@]} becomes a word for each item of the array.
+ *
+ * Inside ${...} a value can also be cut down or changed on the way:
+ * ${#name} (its length), ${name#pat} and ${name##pat} (without a prefix),
+ * ${name%pat} and ${name%%pat} (without a suffix), ${name/pat/rep} (with
+ * a match replaced; //, /# and /% as in bash), ${name:off:len} (a
+ * substring) and ${name^}, ${name^^}, ${name,}, ${name,,} (case
+ * conversion).  Patterns are shell patterns (see shellGlob.h).
+ *
+ * Arrays are expanded with ${name[key]} (an item), ${name[@]} (every
+ * item), ${!name[@]} (every key) and ${#name[@]} (how many there are).
+ */
+#ifndef SHELL_EXPAND_H
+#define SHELL_EXPAND_H
+
+#include <stdbool.h>
+
+/* Function prototypes */
+char**      expandLine(char** line);
+const char* getWordQuotes(void);
+bool        isAssignmentLine(char** line);
+void        setLastStatus(int status);
+
+#endif
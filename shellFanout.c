@@ -0,0 +1,329 @@
+/*
+ * shellFanout.c
+ *
+ * Implements the built-in 'fanout' command:
+ *
+ *     fanout [-q] endpoint ... -- command line
+ *
+ * The command line is sent to every agent at once, and their output is
+ * streamed back as it arrives, one epoll loop serving every connection.
+ * Each line is prefixed with the endpoint it came from; lines the command
+ * wrote to standard error go to standard error.  Afterwards a summary on
+ * standard error gives each agent's exit status, how long the command ran
+ * there and the round trip, then the totals (-q leaves it out).
+ *
+ * The agent scans the command line again, so a pipeline or redirection
+ * meant for the agents must be quoted as one argument.  The exit status is
+ * 0 if the command succeeded on every agent and 1 otherwise.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "shellFanout.h"
+#include "shellAgent.h"
+#include "shellFd.h"
+
+/* The unfinished last line of one output stream */
+typedef struct {
+    char*  data;
+    size_t length;
+    size_t capacity;
+} PartialLine;
+
+/* One agent the command line was sent to */
+typedef struct {
+    const char*     endpoint;
+    int             fd;          /* -1 once the connection is finished */
+    FrameReader     reader;
+    PartialLine     partial[2];  /* Standard output, standard error */
+    bool            done;        /* Its exit frame arrived */
+    ExitReport      report;
+    struct timespec sent;
+    uint64_t        roundTrip;   /* Microseconds from sending to the exit frame */
+} FanoutAgent;
+
+/* Function prototypes */
+static void     handleFrame(FanoutAgent* agent, const Frame* frame);
+static void     emitOutput(FanoutAgent* agent, int stream, const char* data,
+                           size_t length);
+static void     writeLine(FanoutAgent* agent, int stream, const char* data,
+                          size_t length);
+static void     finishAgent(int epollFd, FanoutAgent* agent);
+static uint64_t microsecondsSince(const struct timespec* start);
+static void     printSummary(const FanoutAgent* agents, int count);
+
+/*
+ * doFanout
+ *
+ * Implements the built-in 'fanout' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        The endpoints come before "--" and the command line after it.
+ *
+ * Returns the exit status of the command.
+ */
+int doFanout(char** args) {
+    struct epoll_event events[FANOUT_MAX_EVENTS];
+    FanoutAgent*       agents;
+    char*              command;
+    size_t             commandLength = 0;
+    bool               quiet  = false;
+    int                first  = 1;
+    int                count  = 0;
+    int                active = 0;
+    int                status = 0;
+    int                epollFd;
+    int                i;
+
+    if (args[first] != NULL && strcmp(args[first], "-q") == 0) {
+        quiet = true;
+        first++;
+    }
+    while (args[first + count] != NULL && strcmp(args[first + count], "--") != 0) {
+        count++;
+    }
+    if (count == 0 || args[first + count] == NULL || args[first + count + 1] == NULL) {
+        printf("usage: fanout [-q] endpoint ... -- command line\n");
+        return 1;
+    }
+
+    /* The agents get the words after "--" back as one line */
+    for (i = first + count + 1; args[i] != NULL; ++i) {
+        commandLength += strlen(args[i]) + 1;
+    }
+    command    = malloc(commandLength);
+    command[0] = '\0';
+    for (i = first + count + 1; args[i] != NULL; ++i) {
+        strcat(command, args[i]);
+        if (args[i + 1] != NULL) {
+            strcat(command, " ");
+        }
+    }
+
+    epollFd = shellTrack(epoll_create1(EPOLL_CLOEXEC));
+    if (epollFd < 0) {
+        perror("epoll_create1");
+        free(command);
+        return 1;
+    }
+
+    fflush(stdout);
+    agents = calloc((size_t) count, sizeof(FanoutAgent));
+    for (i = 0; i < count; ++i) {
+        FanoutAgent*       agent = &agents[i];
+        struct epoll_event event;
+
+        agent->endpoint = args[first + i];
+        agent->fd       = connectAgent(agent->endpoint);
+        if (agent->fd < 0) {
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &agent->sent);
+        event.events   = EPOLLIN;
+        event.data.ptr = agent;
+        if (!sendFrame(agent->fd, FRAME_COMMAND, command, strlen(command))
+                || epoll_ctl(epollFd, EPOLL_CTL_ADD, agent->fd, &event) < 0) {
+            perror(agent->endpoint);
+            shellClose(agent->fd);
+            agent->fd = -1;
+            continue;
+        }
+        active++;
+    }
+    free(command);
+
+    while (active > 0) {
+        int ready = epoll_wait(epollFd, events, FANOUT_MAX_EVENTS, -1);
+
+        for (i = 0; i < ready; ++i) {
+            FanoutAgent* agent = events[i].data.ptr;
+            ssize_t      bytes = fillFrameReader(agent->fd, &agent->reader);
+            Frame        frame;
+
+            while (!agent->done && takeFrame(&agent->reader, &frame)) {
+                handleFrame(agent, &frame);
+            }
+            if (agent->done || bytes <= 0) {
+                if (!agent->done) {
+                    fprintf(stderr, "fanout: %s: connection lost\n", agent->endpoint);
+                }
+                finishAgent(epollFd, agent);
+                active--;
+            }
+        }
+    }
+    shellClose(epollFd);
+    fflush(stdout);
+
+    for (i = 0; i < count; ++i) {
+        if (!agents[i].done || agents[i].report.status != 0) {
+            status = 1;
+        }
+    }
+    if (!quiet) {
+        printSummary(agents, count);
+    }
+    free(agents);
+    return status;
+}
+
+/*
+ * handleFrame
+ *
+ * Acts on one frame from 'agent'.
+ */
+static void handleFrame(FanoutAgent* agent, const Frame* frame) {
+    switch (frame->type) {
+    case FRAME_STDOUT:
+        emitOutput(agent, 0, frame->payload, frame->length);
+        break;
+
+    case FRAME_STDERR:
+        emitOutput(agent, 1, frame->payload, frame->length);
+        break;
+
+    case FRAME_EXIT:
+        if (parseExitReport(frame, &agent->report)) {
+            agent->done      = true;
+            agent->roundTrip = microsecondsSince(&agent->sent);
+        }
+        break;
+
+    default:
+        /* FRAME_READY, and anything newer than us */
+        break;
+    }
+}
+
+/*
+ * emitOutput
+ *
+ * Prints each complete line in 'data' with the agent's prefix, holding
+ * back an unfinished last line until the rest of it arrives.
+ */
+static void emitOutput(FanoutAgent* agent, int stream, const char* data,
+                       size_t length) {
+    PartialLine* partial = &agent->partial[stream];
+    const char*  end     = data + length;
+
+    while (data < end) {
+        const char* newline = memchr(data, '\n', (size_t) (end - data));
+
+        if (newline == NULL) {
+            size_t rest = (size_t) (end - data);
+
+            if (partial->length + rest > partial->capacity) {
+                partial->capacity = (partial->length + rest) * 2;
+                partial->data     = realloc(partial->data, partial->capacity);
+            }
+            memcpy(partial->data + partial->length, data, rest);
+            partial->length += rest;
+            return;
+        }
+
+        writeLine(agent, stream, data, (size_t) (newline - data));
+        data = newline + 1;
+    }
+}
+
+/*
+ * writeLine
+ *
+ * Prints the held-back part of a line, then 'data', with the agent's
+ * prefix.
+ */
+static void writeLine(FanoutAgent* agent, int stream, const char* data,
+                      size_t length) {
+    PartialLine* partial = &agent->partial[stream];
+    FILE*        out     = stream == 0 ? stdout : stderr;
+
+    fputs(agent->endpoint, out);
+    fputs(": ", out);
+    fwrite(partial->data != NULL ? partial->data : "", 1, partial->length, out);
+    fwrite(data, 1, length, out);
+    fputc('\n', out);
+    partial->length = 0;
+}
+
+/*
+ * finishAgent
+ *
+ * Closes the connection to 'agent' and prints any output line it left
+ * unfinished.
+ */
+static void finishAgent(int epollFd, FanoutAgent* agent) {
+    int stream;
+
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, agent->fd, NULL);
+    shellClose(agent->fd);
+    agent->fd = -1;
+    freeFrameReader(&agent->reader);
+
+    for (stream = 0; stream < 2; ++stream) {
+        if (agent->partial[stream].length > 0) {
+            writeLine(agent, stream, "", 0);
+        }
+        free(agent->partial[stream].data);
+    }
+}
+
+/*
+ * microsecondsSince
+ *
+ * Returns the microseconds elapsed since 'start' (CLOCK_MONOTONIC).
+ */
+static uint64_t microsecondsSince(const struct timespec* start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) ((int64_t) (now.tv_sec - start->tv_sec) * 1000000000
+                       + (now.tv_nsec - start->tv_nsec)) / 1000;
+}
+
+/*
+ * printSummary
+ *
+ * Prints each agent's result and the totals on standard error.
+ */
+static void printSummary(const FanoutAgent* agents, int count) {
+    const FanoutAgent* slowest   = NULL;
+    int                succeeded = 0;
+    int                failed    = 0;
+    int                i;
+
+    for (i = 0; i < count; ++i) {
+        const FanoutAgent* agent = &agents[i];
+
+        if (!agent->done) {
+            fprintf(stderr, "%s: no result\n", agent->endpoint);
+            continue;
+        }
+        fprintf(stderr, "%s: exit %d, %.3f s on the agent, %.3f s round trip\n",
+                agent->endpoint, agent->report.status,
+                agent->report.elapsed / 1e6, agent->roundTrip / 1e6);
+
+        if (agent->report.status == 0) {
+            succeeded++;
+        } else {
+            failed++;
+        }
+        if (slowest == NULL || agent->roundTrip > slowest->roundTrip) {
+            slowest = agent;
+        }
+    }
+
+    fprintf(stderr, "fanout: %d agents: %d succeeded, %d failed, %d no result",
+            count, succeeded, failed, count - succeeded - failed);
+    if (slowest != NULL) {
+        fprintf(stderr, "; slowest %s (%.3f s)", slowest->endpoint,
+                slowest->roundTrip / 1e6);
+    }
+    fputc('\n', stderr);
+}
@@ -0,0 +1,16 @@
+/*
+ * shellFanout.h
+ *
+ * The built-in 'fanout' command, which runs one command line on many
+ * agents (see shellAgent.h) at once.
+ */
+#ifndef SHELL_FANOUT_H
+#define SHELL_FANOUT_H
+
+/* Most events taken from epoll at a time */
+#define FANOUT_MAX_EVENTS 64
+
+/* Function prototypes */
+int  doFanout(char** args);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * shellFd.c
+ *
+ * Close-on-exec descriptor wrappers and the fd leak audit (see shellFd.h).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include "shellFd.h"
+
+/* The code site that created each descriptor, or NULL if unknown */
+static const char* fdSite[FD_TRACK_MAX];
+
+/* Descriptors open when the audit last looked; these are not leaks */
+static bool fdKnown[FD_TRACK_MAX];
+
+static bool auditEnabled = false;
+
+/* Function prototypes */
+static void snapshotOpenFds(void);
+
+/*
+ * trackedOpen
+ *
+ * open(2) with O_CLOEXEC added, recording 'site' as the creator.
+ */
+int trackedOpen(const char* path, int flags, mode_t mode, const char* site) {
+    return trackFd(open(path, flags | O_CLOEXEC, mode), site);
+}
+
+/*
+ * trackedPipe
+ *
+ * pipe(2) with both ends close-on-exec, recording 'site' as the creator.
+ */
+int trackedPipe(int fds[2], const char* site) {
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    trackFd(fds[0], site);
+    trackFd(fds[1], site);
+    return 0;
+}
+
+/*
+ * trackedDup
+ *
+ * dup(2), close-on-exec, recording 'site' as the creator.
+ */
+int trackedDup(int fd, const char* site) {
+    return trackFd(fcntl(fd, F_DUPFD_CLOEXEC, 0), site);
+}
+
+/*
+ * trackFd
+ *
+ * Records 'site' as the creator of 'fd', which was obtained some other way
+ * (e.g., dirfd(), socket()).  Negative descriptors are passed through so
+ * calls can be wrapped directly.
+ *
+ * Returns 'fd'.
+ */
+int trackFd(int fd, const char* site) {
+    if (fd >= 0 && fd < FD_TRACK_MAX) {
+        fdSite[fd] = site;
+    }
+    return fd;
+}
+
+/*
+ * trackedClose
+ *
+ * close(2), forgetting where the descriptor came from.
+ */
+int trackedClose(int fd) {
+    if (fd >= 0 && fd < FD_TRACK_MAX) {
+        fdSite[fd]  = NULL;
+        fdKnown[fd] = false;
+    }
+    return close(fd);
+}
+
+/*
+ * keepFd
+ *
+ * Marks 'fd' as one the shell deliberately keeps open (e.g., a cached
+ * directory descriptor), so the audit does not report it.  A descriptor
+ * below FD_SHELL_BASE is first moved above it, out of the user's way.
+ *
+ * Returns 'fd', or the descriptor it was moved to.
+ */
+int keepFd(int fd) {
+    if (fd >= 0 && fd < FD_SHELL_BASE) {
+        int moved = fcntl(fd, F_DUPFD_CLOEXEC, FD_SHELL_BASE);
+
+        if (moved >= 0) {
+            trackFd(moved, fdSite[fd]);
+            trackedClose(fd);
+            fd = moved;
+        }
+    }
+    if (fd >= 0 && fd < FD_TRACK_MAX) {
+        fdKnown[fd] = true;
+    }
+    return fd;
+}
+
+/*
+ * markUserFd
+ *
+ * Records that the user opened 'fd' (with 'exec'), so the audit does not
+ * report it.
+ */
+void markUserFd(int fd) {
+    if (fd >= 0 && fd < FD_TRACK_MAX) {
+        fdSite[fd]  = "exec";
+        fdKnown[fd] = true;
+    }
+}
+
+/*
+ * setFdAudit
+ *
+ * Turns the fd leak audit on or off.  Whatever is open when it is turned on
+ * is taken as the baseline.
+ */
+void setFdAudit(bool enabled) {
+    auditEnabled = enabled;
+    if (enabled) {
+        snapshotOpenFds();
+    }
+}
+
+/*
+ * fdAuditEnabled
+ *
+ * Returns true if the fd leak audit is on.
+ */
+bool fdAuditEnabled(void) {
+    return auditEnabled;
+}
+
+/*
+ * fdAuditCheck
+ *
+ * If the audit is on, lists /proc/self/fd and reports every descriptor that
+ * was not open last time, along with what it refers to and the code site
+ * that created it.  Each leak is reported once.
+ *
+ * command - The name of the command that just finished, for the report.
+ */
+void fdAuditCheck(const char* command) {
+    DIR*           directory;
+    struct dirent* entry;
+
+    if (!auditEnabled) {
+        return;
+    }
+
+    if ((directory = opendir("/proc/self/fd")) == NULL) {
+        perror("fd audit: /proc/self/fd");
+        return;
+    }
+
+    while ((entry = readdir(directory)) != NULL) {
+        char    link[64];
+        char    target[PATH_MAX];
+        ssize_t length;
+        int     fd = atoi(entry->d_name);
+
+        if (entry->d_name[0] == '.' || fd == dirfd(directory)
+                || fd >= FD_TRACK_MAX || fdKnown[fd]) {
+            continue;
+        }
+
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        if ((length = readlink(link, target, sizeof(target) - 1)) < 0) {
+            length = 0;
+        }
+        target[length] = '\0';
+
+        fprintf(stderr, "fd audit: after '%s': fd %d -> %s leaked (opened at %s)\n",
+                command, fd, target, fdSite[fd] != NULL ? fdSite[fd] : "unknown site");
+        fdKnown[fd] = true;
+    }
+
+    closedir(directory);
+}
+
+/*
+ * snapshotOpenFds
+ *
+ * Marks exactly the descriptors currently open as known.
+ */
+static void snapshotOpenFds(void) {
+    int fd;
+
+    for (fd = 0; fd < FD_TRACK_MAX; ++fd) {
+        fdKnown[fd] = fcntl(fd, F_GETFD) >= 0;
+    }
+}
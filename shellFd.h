@@ -0,0 +1,47 @@
+/*
+ * shellFd.h
+ *
+ * Every descriptor the shell opens for its own use is created close-on-exec
+ * through the wrappers below, which also remember the code site that
+ * created it.  When the fd audit is on, the shell compares /proc/self/fd
+ * against that record after every command and reports anything leaked.
+ */
+#ifndef SHELL_FD_H
+#define SHELL_FD_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Descriptors above this are not tracked (or audited) */
+#define FD_TRACK_MAX 1024
+
+/*
+ * Descriptors the shell keeps open are moved to this or above, leaving the
+ * ones below (the 0-9 redirections must support) to 'exec 3>file'
+ */
+#define FD_SHELL_BASE 10
+
+#define FD_STRINGIFY(x) #x
+#define FD_TOSTRING(x)  FD_STRINGIFY(x)
+#define FD_SITE         __FILE__ ":" FD_TOSTRING(__LINE__)
+
+/* Close-on-exec replacements for open(), pipe(), dup() and close() */
+#define shellOpen(path, flags, mode) trackedOpen((path), (flags), (mode), FD_SITE)
+#define shellPipe(fds)               trackedPipe((fds), FD_SITE)
+#define shellDup(fd)                 trackedDup((fd), FD_SITE)
+#define shellTrack(fd)               trackFd((fd), FD_SITE)
+#define shellClose(fd)               trackedClose(fd)
+
+/* Function prototypes */
+int  trackedOpen(const char* path, int flags, mode_t mode, const char* site);
+int  trackedPipe(int fds[2], const char* site);
+int  trackedDup(int fd, const char* site);
+int  trackFd(int fd, const char* site);
+int  trackedClose(int fd);
+int  keepFd(int fd);
+void markUserFd(int fd);
+void setFdAudit(bool enabled);
+bool fdAuditEnabled(void);
+void fdAuditCheck(const char* command);
+
+#endif
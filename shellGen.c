@@ -0,0 +1,340 @@
+/*
+ * shellGen.c
+ *
+ * Implements built-in versions of two generators:
+ *
+ *     seq [-s separator] [first [increment]] last
+ *     yes [string ...]
+ *
+ * Both fill a large block and write it whole.  'seq' keeps the current
+ * number as a decimal string and increments it in place, so counting by
+ * one costs a short copy per number rather than a printf(); other
+ * increments (and negative numbers) go through a small integer formatter.
+ * Only integers are supported.
+ *
+ * 'yes' fills its block once and then hands the same pages to the pipe
+ * again and again with vmsplice(), so nothing is copied at all.  That is
+ * only safe because the block never changes; 'seq' reuses its block, so
+ * it write()s.  When standard output is a pipe its capacity is raised so
+ * that each block goes in with one system call.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "shellGen.h"
+
+/* Room for any long long, its sign and a terminator */
+#define NUMBER_SIZE 24
+
+/* Function prototypes */
+static bool   parseNumber(const char* text, long long* value);
+static size_t formatNumber(char* out, long long value);
+static bool   isPipe(int fd);
+static bool   writeBlock(const char* data, size_t length);
+
+/*
+ * doSeq
+ *
+ * Implements the built-in 'seq' command, which prints the numbers from
+ * 'first' (default 1) to 'last' in steps of 'increment' (default 1).
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command.
+ */
+int doSeq(char** args) {
+    const char* separator = "\n";
+    long long   numbers[3];
+    long long   first     = 1;
+    long long   increment = 1;
+    long long   last;
+    size_t      separatorLength;
+    int         operands;
+    int         i = 1;
+    char*       block;
+    size_t      used   = 0;
+    int         status = 0;
+
+    if (args[i] != NULL && strncmp(args[i], "-s", 2) == 0) {
+        separator = args[i][2] != '\0' ? args[i] + 2 : args[++i];
+        ++i;
+    }
+    for (operands = 0; separator != NULL && args[i + operands] != NULL; ++operands) {
+        if (operands == 3 || !parseNumber(args[i + operands], &numbers[operands])) {
+            operands = -1;
+            break;
+        }
+    }
+    if (separator == NULL || operands < 1) {
+        printf("usage: seq [-s separator] [first [increment]] last  (integers only)\n");
+        return 1;
+    }
+
+    last = numbers[operands - 1];
+    if (operands >= 2) {
+        first = numbers[0];
+    }
+    if (operands == 3) {
+        increment = numbers[1];
+    }
+    if (increment == 0) {
+        printf("seq: the increment must not be zero\n");
+        return 1;
+    }
+    if ((increment > 0 && first > last) || (increment < 0 && first < last)) {
+        return 0;
+    }
+
+    separatorLength = strlen(separator);
+    fflush(stdout);
+    if (isPipe(STDOUT_FILENO)) {
+        fcntl(STDOUT_FILENO, F_SETPIPE_SZ, GEN_PIPE_SIZE);
+    }
+    block = malloc(GEN_BLOCK_SIZE + NUMBER_SIZE + separatorLength);
+
+    if (increment == 1 && first >= 0) {
+        /* Count in a decimal string: digits[start..NUMBER_SIZE) is the number */
+        char               digits[NUMBER_SIZE];
+        size_t             start = NUMBER_SIZE - formatNumber(digits, first);
+        unsigned long long count = (unsigned long long) (last - first) + 1;
+
+        memmove(digits + start, digits, NUMBER_SIZE - start);
+        for (;;) {
+            size_t length = NUMBER_SIZE - start;
+            size_t d;
+
+            memcpy(block + used, digits + start, length);
+            used += length;
+            if (--count == 0) {
+                break;
+            }
+            memcpy(block + used, separator, separatorLength);
+            used += separatorLength;
+
+            /* Add one, carrying as far as needed */
+            for (d = NUMBER_SIZE - 1; digits[d] == '9' && d > start; --d) {
+                digits[d] = '0';
+            }
+            if (digits[d] == '9') {
+                digits[d]        = '0';
+                digits[--start]  = '1';
+            } else {
+                digits[d]++;
+            }
+
+            if (used >= GEN_BLOCK_SIZE) {
+                if (!writeBlock(block, used)) {
+                    status = 1;
+                    break;
+                }
+                used = 0;
+            }
+        }
+    } else {
+        long long value = first;
+
+        for (;;) {
+            used += formatNumber(block + used, value);
+            /* Stop at 'last'; the distance is taken unsigned so nothing overflows */
+            if (increment > 0
+                    ? (unsigned long long) last - (unsigned long long) value
+                      < (unsigned long long) increment
+                    : (unsigned long long) value - (unsigned long long) last
+                      < 0ULL - (unsigned long long) increment) {
+                break;
+            }
+            value += increment;
+            memcpy(block + used, separator, separatorLength);
+            used += separatorLength;
+
+            if (used >= GEN_BLOCK_SIZE) {
+                if (!writeBlock(block, used)) {
+                    status = 1;
+                    break;
+                }
+                used = 0;
+            }
+        }
+    }
+
+    if (status == 0) {
+        block[used++] = '\n';
+        status        = writeBlock(block, used) ? 0 : 1;
+    }
+    free(block);
+    return status;
+}
+
+/*
+ * doYes
+ *
+ * Implements the built-in 'yes' command, which prints its arguments (or
+ * "y") on a line, over and over, until the reader goes away.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command (only ever on a write error).
+ */
+int doYes(char** args) {
+    long   pageSize = sysconf(_SC_PAGESIZE);
+    char*  line;
+    size_t lineLength = 0;
+    size_t blockSize;
+    size_t used;
+    char*  block;
+    bool   splice;
+    int    i;
+
+    for (i = 1; args[i] != NULL; ++i) {
+        lineLength += strlen(args[i]) + 1;
+    }
+    if (lineLength == 0) {
+        lineLength = 2;
+    }
+    line = malloc(lineLength + 1);
+    line[0] = '\0';
+    for (i = 1; args[i] != NULL; ++i) {
+        strcat(line, args[i]);
+        strcat(line, args[i + 1] != NULL ? " " : "\n");
+    }
+    if (args[1] == NULL) {
+        strcpy(line, "y\n");
+    }
+
+    /* As many whole lines as fill the block (at least one), page aligned */
+    blockSize = GEN_BLOCK_SIZE > lineLength
+                ? GEN_BLOCK_SIZE - GEN_BLOCK_SIZE % lineLength : lineLength;
+    block     = aligned_alloc((size_t) pageSize,
+                               (blockSize + (size_t) pageSize - 1) / (size_t) pageSize
+                               * (size_t) pageSize);
+    for (used = 0; used < blockSize; used += lineLength) {
+        memcpy(block + used, line, lineLength);
+    }
+    free(line);
+
+    fflush(stdout);
+    splice = isPipe(STDOUT_FILENO);
+    if (splice) {
+        fcntl(STDOUT_FILENO, F_SETPIPE_SZ, GEN_PIPE_SIZE);
+    }
+
+    for (;;) {
+        if (splice) {
+            struct iovec vector = { block, blockSize };
+
+            while (vector.iov_len > 0) {
+                ssize_t result = vmsplice(STDOUT_FILENO, &vector, 1, 0);
+
+                if (result < 0 && errno == EINTR) {
+                    continue;
+                } else if (result < 0) {
+                    break;
+                }
+                vector.iov_base  = (char*) vector.iov_base + result;
+                vector.iov_len  -= (size_t) result;
+            }
+            if (vector.iov_len == 0) {
+                continue;
+            }
+            if (errno != EINVAL && errno != ENOSYS) {
+                break;
+            }
+
+            /* Not a pipe vmsplice() can fill after all; finish with write() */
+            splice = false;
+            if (!writeBlock(vector.iov_base, vector.iov_len)) {
+                break;
+            }
+        } else if (!writeBlock(block, blockSize)) {
+            break;
+        }
+    }
+
+    free(block);
+    return 1;
+}
+
+/*
+ * parseNumber
+ *
+ * Parses the integer 'text' into 'value'.  Returns false if it isn't one.
+ */
+static bool parseNumber(const char* text, long long* value) {
+    char* end;
+
+    errno  = 0;
+    *value = strtoll(text, &end, 10);
+    return *text != '\0' && *end == '\0' && errno == 0;
+}
+
+/*
+ * formatNumber
+ *
+ * Writes 'value' in decimal to 'out' (without a terminator) and returns
+ * the number of characters written.
+ */
+static size_t formatNumber(char* out, long long value) {
+    char               digits[NUMBER_SIZE];
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long) value
+                                             : (unsigned long long) value;
+    size_t             count  = 0;
+    size_t             length = 0;
+
+    do {
+        digits[count++] = (char) ('0' + magnitude % 10);
+        magnitude      /= 10;
+    } while (magnitude != 0);
+
+    if (value < 0) {
+        out[length++] = '-';
+    }
+    while (count > 0) {
+        out[length++] = digits[--count];
+    }
+    return length;
+}
+
+/*
+ * isPipe
+ *
+ * Returns true if 'fd' is a pipe (or FIFO).
+ */
+static bool isPipe(int fd) {
+    struct stat info;
+
+    return fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+/*
+ * writeBlock
+ *
+ * Writes all 'length' bytes of 'data' to standard output.  Returns false,
+ * after printing a message for anything but a closed pipe, on error.
+ */
+static bool writeBlock(const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t result = write(STDOUT_FILENO, data, length);
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EPIPE) {
+                perror("write");
+            }
+            return false;
+        }
+        data   += result;
+        length -= (size_t) result;
+    }
+    return true;
+}
@@ -0,0 +1,20 @@
+/*
+ * shellGen.h
+ *
+ * The built-in generators 'seq' and 'yes', which produce their output in
+ * large pre-formatted blocks.
+ */
+#ifndef SHELL_GEN_H
+#define SHELL_GEN_H
+
+/* Size of each block of output */
+#define GEN_BLOCK_SIZE (256 * 1024)
+
+/* Capacity asked for when standard output is a pipe */
+#define GEN_PIPE_SIZE (1024 * 1024)
+
+/* Function prototypes */
+int  doSeq(char** args);
+int  doYes(char** args);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * shellGlob.c
+ *
+ * Shell pattern matching (see shellGlob.h).
+ *
+ * Matching runs left to right, remembering only the most recent '*': on a
+ * mismatch that '*' is made to swallow one more byte and matching resumes
+ * after it.  Earlier stars never need revisiting, so a match takes time
+ * proportional to the pattern times the text at worst, and no recursion.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "shellGlob.h"
+
+/* Function prototypes */
+static bool matchOne(const char* pattern, size_t patternLength, size_t* at, unsigned char c);
+static bool matchSet(const char* pattern, size_t patternLength, size_t* at, unsigned char c);
+
+/*
+ * globMatch
+ *
+ * Returns true if all 'length' bytes of 'text' match the 'patternLength'
+ * bytes of 'pattern'.
+ */
+bool globMatch(const char* pattern, size_t patternLength, const char* text, size_t length) {
+    size_t p     = 0;
+    size_t t     = 0;
+    size_t starP = SIZE_MAX;  /* Just after the last '*' seen */
+    size_t starT = 0;         /* Where the text was when it was seen */
+
+    while (t < length) {
+        if (p < patternLength && pattern[p] == '*') {
+            starP = ++p;
+            starT = t;
+            continue;
+        }
+        if (p < patternLength && matchOne(pattern, patternLength, &p, (unsigned char) text[t])) {
+            t++;
+            continue;
+        }
+        if (starP == SIZE_MAX) {
+            return false;
+        }
+        p = starP;
+        t = ++starT;
+    }
+
+    while (p < patternLength && pattern[p] == '*') {
+        p++;
+    }
+    return p == patternLength;
+}
+
+/*
+ * hasGlobChars
+ *
+ * Returns true if the 'length' bytes of 'pattern' contain anything but
+ * literal characters, so it cannot simply be compared.
+ */
+bool hasGlobChars(const char* pattern, size_t length) {
+    size_t i;
+
+    for (i = 0; i < length; ++i) {
+        if (pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '[' || pattern[i] == '\\') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * matchOne
+ *
+ * Tries the pattern element at '*at' (not a '*') against the byte 'c',
+ * moving '*at' past the element if it matches.
+ *
+ * Returns true if it does.
+ */
+static bool matchOne(const char* pattern, size_t patternLength, size_t* at, unsigned char c) {
+    size_t p = *at;
+
+    if (pattern[p] == '?') {
+        *at = p + 1;
+        return true;
+    }
+    if (pattern[p] == '[') {
+        size_t end = p;
+
+        if (matchSet(pattern, patternLength, &end, c)) {
+            *at = end;
+            return true;
+        }
+        if (end != p) {
+            return false;  /* A set, which 'c' is not in */
+        }
+    }
+    if (pattern[p] == '\\' && p + 1 < patternLength) {
+        p++;
+    }
+    if ((unsigned char) pattern[p] == c) {
+        *at = p + 1;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * matchSet
+ *
+ * Tries the set ([...]) at '*at' against the byte 'c'.  If the set is
+ * well formed, '*at' is moved past it; otherwise (no closing ']') it is
+ * left alone and the '[' is an ordinary character.
+ *
+ * Returns true if 'c' is in the set.
+ */
+static bool matchSet(const char* pattern, size_t patternLength, size_t* at, unsigned char c) {
+    size_t p       = *at + 1;
+    bool   negated = false;
+    bool   found   = false;
+    bool   first   = true;
+
+    if (p < patternLength && (pattern[p] == '!' || pattern[p] == '^')) {
+        negated = true;
+        p++;
+    }
+
+    for (; p < patternLength; first = false) {
+        unsigned char low;
+        unsigned char high;
+
+        if (pattern[p] == ']' && !first) {
+            *at = p + 1;
+            return found != negated;
+        }
+        if (pattern[p] == '\\' && p + 1 < patternLength) {
+            p++;
+        }
+        low = high = (unsigned char) pattern[p++];
+
+        if (p + 1 < patternLength && pattern[p] == '-' && pattern[p + 1] != ']') {
+            p++;
+            if (pattern[p] == '\\' && p + 1 < patternLength) {
+                p++;
+            }
+            high = (unsigned char) pattern[p++];
+        }
+        if (c >= low && c <= high) {
+            found = true;
+        }
+    }
+    return false;
+}
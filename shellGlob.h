@@ -0,0 +1,20 @@
+/*
+ * shellGlob.h
+ *
+ * Shell pattern matching: * (any run of bytes), ? (any byte), [...] (a
+ * set or range of bytes, negated by a leading ! or ^) and \ (quotes the
+ * next character).  Patterns and text are both given as a pointer and a
+ * length, so a pattern can be tried against any slice of a value where it
+ * lies.
+ */
+#ifndef SHELL_GLOB_H
+#define SHELL_GLOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Function prototypes */
+bool globMatch(const char* pattern, size_t patternLength, const char* text, size_t length);
+bool hasGlobChars(const char* pattern, size_t length);
+
+#endif
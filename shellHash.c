@@ -0,0 +1,735 @@
+/*
+ * shellHash.c
+ *
+ * Implements the built-in 'hashsum' command:
+ *
+ *     hashsum [-a sha256|crc32c|xxh64] [-j threads] [-r] file...
+ *
+ * Each file is hashed by one of a pool of worker threads, reading through
+ * a large page-aligned buffer, and results are printed in the order the
+ * files were given (sha256sum style: "digest  name").  With -r,
+ * directories are expanded through the shell's traversal engine.
+ *
+ * CRC32C uses the SSE4.2 crc32 instruction and SHA-256 the SHA extensions
+ * when the processor has them (checked once, at run time); otherwise
+ * portable implementations are used.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HASH_X86 1
+#endif
+#include "shellHash.h"
+#include "shellWalk.h"
+#include "shellDirs.h"
+#include "shellFd.h"
+
+typedef enum { HASH_SHA256, HASH_CRC32C, HASH_XXH64 } HashAlgorithm;
+
+/* One file to hash and, once a worker is done with it, its digest */
+typedef struct {
+    char* path;
+    char  digest[65];  /* Hex; empty if the file could not be read */
+    int   error;       /* errno, if it could not */
+} HashJob;
+
+/* Work shared by all of the workers of one hashsum */
+typedef struct {
+    HashAlgorithm   algorithm;
+    HashJob*        jobs;
+    size_t          count;
+    size_t          capacity;
+    size_t          next;     /* Next job to hand out */
+    pthread_mutex_t lock;
+} HashWork;
+
+/* Running state of each algorithm */
+typedef struct {
+    uint32_t state[8];
+    uint8_t  block[64];
+    size_t   blockLength;
+    uint64_t totalLength;
+} Sha256;
+
+typedef struct {
+    uint64_t acc[4];
+    uint8_t  stripe[32];
+    size_t   stripeLength;
+    uint64_t totalLength;
+} Xxh64;
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+/* Processor features, probed once */
+static bool haveSse42 = false;
+static bool haveShaNi = false;
+
+static uint32_t crc32cTable[256];
+
+/* Function prototypes */
+static void     probeCpu(void);
+static bool     addInput(HashWork* work, const char* path, bool recursive);
+static bool     collectFiles(WalkDir* dir, void* context);
+static void     addJob(HashWork* work, char* path);
+static void*    hashWorker(void* context);
+static void     hashFile(HashAlgorithm algorithm, HashJob* job, uint8_t* buffer);
+static void     sha256Init(Sha256* sha);
+static void     sha256Update(Sha256* sha, const uint8_t* data, size_t length);
+static void     sha256Final(Sha256* sha, uint8_t digest[32]);
+static void     sha256Blocks(uint32_t state[8], const uint8_t* data, size_t blocks);
+static uint32_t crc32cUpdate(uint32_t crc, const uint8_t* data, size_t length);
+static void     xxh64Init(Xxh64* xxh);
+static void     xxh64Update(Xxh64* xxh, const uint8_t* data, size_t length);
+static uint64_t xxh64Final(const Xxh64* xxh);
+static void     toHex(char* out, const uint8_t* bytes, size_t length);
+
+/**
+ * doHashsum
+ *
+ * Implements the built-in 'hashsum' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doHashsum(char** args) {
+    HashWork  work;
+    pthread_t threads[HASH_MAX_THREADS];
+    long      threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    bool      recursive   = false;
+    int       started     = 0;
+    int       status      = 0;
+    int       i;
+    size_t    j;
+
+    memset(&work, 0, sizeof(work));
+    work.algorithm = HASH_SHA256;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-'; ++i) {
+        if (strcmp(args[i], "-r") == 0) {
+            recursive = true;
+        } else if (strcmp(args[i], "-a") == 0 && args[i + 1] != NULL) {
+            const char* name = args[++i];
+
+            if (strcmp(name, "sha256") == 0) {
+                work.algorithm = HASH_SHA256;
+            } else if (strcmp(name, "crc32c") == 0) {
+                work.algorithm = HASH_CRC32C;
+            } else if (strcmp(name, "xxh64") == 0) {
+                work.algorithm = HASH_XXH64;
+            } else {
+                printf("hashsum: unknown algorithm '%s'\n", name);
+                return 1;
+            }
+        } else if (strcmp(args[i], "-j") == 0 && args[i + 1] != NULL) {
+            threadCount = atol(args[++i]);
+        } else {
+            printf("usage: hashsum [-a sha256|crc32c|xxh64] [-j threads] [-r] file...\n");
+            return 1;
+        }
+    }
+    if (args[i] == NULL) {
+        printf("usage: hashsum [-a sha256|crc32c|xxh64] [-j threads] [-r] file...\n");
+        return 1;
+    }
+
+    probeCpu();
+
+    for (; args[i] != NULL; ++i) {
+        addInput(&work, args[i], recursive);
+    }
+
+    if (threadCount < 1) {
+        threadCount = 1;
+    }
+    if ((size_t) threadCount > work.count) {
+        threadCount = (long) work.count;
+    }
+    if (threadCount > HASH_MAX_THREADS) {
+        threadCount = HASH_MAX_THREADS;
+    }
+
+    pthread_mutex_init(&work.lock, NULL);
+    for (started = 0; started < threadCount; ++started) {
+        if (pthread_create(&threads[started], NULL, hashWorker, &work) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        hashWorker(&work);  /* No threads to be had; do it ourselves */
+    }
+    for (i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&work.lock);
+
+    for (j = 0; j < work.count; ++j) {
+        if (work.jobs[j].error != 0) {
+            fprintf(stderr, "hashsum: %s: %s\n", work.jobs[j].path,
+                    strerror(work.jobs[j].error));
+            status = 1;
+        } else {
+            printf("%s  %s\n", work.jobs[j].digest, work.jobs[j].path);
+        }
+        free(work.jobs[j].path);
+    }
+    free(work.jobs);
+    return status;
+}
+
+/*
+ * probeCpu
+ *
+ * Checks for SSE4.2 (crc32) and the SHA extensions, and builds the table
+ * for the portable CRC32C.
+ */
+static void probeCpu(void) {
+    static bool probed = false;
+    uint32_t    i;
+
+    if (probed) {
+        return;
+    }
+    probed = true;
+
+#ifdef HASH_X86
+    {
+        unsigned int eax, ebx, ecx, edx;
+
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            haveSse42 = (ecx & bit_SSE4_2) != 0;
+            /* SHA-NI also needs SSSE3 and SSE4.1 for the shuffles */
+            if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+                haveShaNi = (ebx & (1u << 29)) != 0 && haveSse42;
+            }
+        }
+    }
+#endif
+
+    for (i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        int      k;
+
+        for (k = 0; k < 8; ++k) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+        }
+        crc32cTable[i] = crc;
+    }
+}
+
+/*
+ * addInput
+ *
+ * Queues the file 'path', or with 'recursive', every regular file beneath
+ * the directory 'path'.
+ */
+static bool addInput(HashWork* work, const char* path, bool recursive) {
+    struct stat info;
+
+    if (recursive && stat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+        return walkTree(path, 0, WALK_ALL | WALK_RECURSIVE, collectFiles, work);
+    }
+    addJob(work, strdup(path));
+    return true;
+}
+
+/*
+ * collectFiles
+ *
+ * Walk callback: queues the regular files of one directory, in name order.
+ */
+static bool collectFiles(WalkDir* dir, void* context) {
+    HashWork* work = context;
+    size_t    first = work->count;
+    size_t    i;
+
+    for (i = 0; i < dir->count; ++i) {
+        if (dir->entries[i].type == DT_REG) {
+            addJob(work, joinPath(dir->path, dir->entries[i].name));
+        }
+    }
+
+    /* Directories come back in readdir order; print them predictably */
+    for (i = first + 1; i < work->count; ++i) {
+        HashJob job = work->jobs[i];
+        size_t  k   = i;
+
+        while (k > first && strcmp(work->jobs[k - 1].path, job.path) > 0) {
+            work->jobs[k] = work->jobs[k - 1];
+            k--;
+        }
+        work->jobs[k] = job;
+    }
+    return true;
+}
+
+/*
+ * addJob
+ *
+ * Appends a job for 'path' (which is taken over) to the work list.
+ */
+static void addJob(HashWork* work, char* path) {
+    if (work->count == work->capacity) {
+        work->capacity = work->capacity ? work->capacity * 2 : 64;
+        work->jobs     = realloc(work->jobs, work->capacity * sizeof(HashJob));
+    }
+    memset(&work->jobs[work->count], 0, sizeof(HashJob));
+    work->jobs[work->count++].path = path;
+}
+
+/*
+ * hashWorker
+ *
+ * Thread body: takes jobs off the shared list until there are none left.
+ */
+static void* hashWorker(void* context) {
+    HashWork* work   = context;
+    uint8_t*  buffer = NULL;
+
+    if (posix_memalign((void**) &buffer, HASH_BUFFER_ALIGN, HASH_BUFFER_SIZE) != 0) {
+        return NULL;
+    }
+
+    for (;;) {
+        HashJob* job = NULL;
+
+        pthread_mutex_lock(&work->lock);
+        if (work->next < work->count) {
+            job = &work->jobs[work->next++];
+        }
+        pthread_mutex_unlock(&work->lock);
+
+        if (job == NULL) {
+            break;
+        }
+        hashFile(work->algorithm, job, buffer);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/*
+ * hashFile
+ *
+ * Reads the job's file through 'buffer' and stores its digest (or the
+ * error that stopped us) in the job.
+ */
+static void hashFile(HashAlgorithm algorithm, HashJob* job, uint8_t* buffer) {
+    Sha256   sha;
+    Xxh64    xxh;
+    uint32_t crc = 0xFFFFFFFFu;
+    ssize_t  length;
+    int      fd = shellOpen(job->path, O_RDONLY, 0);
+
+    if (fd < 0) {
+        job->error = errno;
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    sha256Init(&sha);
+    xxh64Init(&xxh);
+
+    while ((length = read(fd, buffer, HASH_BUFFER_SIZE)) > 0) {
+        switch (algorithm) {
+        case HASH_SHA256: sha256Update(&sha, buffer, (size_t) length);   break;
+        case HASH_CRC32C: crc = crc32cUpdate(crc, buffer, (size_t) length); break;
+        case HASH_XXH64:  xxh64Update(&xxh, buffer, (size_t) length);   break;
+        }
+    }
+    if (length < 0) {
+        job->error = errno;
+        shellClose(fd);
+        return;
+    }
+    shellClose(fd);
+
+    switch (algorithm) {
+    case HASH_SHA256: {
+        uint8_t digest[32];
+
+        sha256Final(&sha, digest);
+        toHex(job->digest, digest, sizeof(digest));
+        break;
+    }
+    case HASH_CRC32C:
+        snprintf(job->digest, sizeof(job->digest), "%08x", crc ^ 0xFFFFFFFFu);
+        break;
+
+    case HASH_XXH64:
+        snprintf(job->digest, sizeof(job->digest), "%016llx",
+                 (unsigned long long) xxh64Final(&xxh));
+        break;
+    }
+}
+
+/*
+ * sha256Init, sha256Update, sha256Final
+ *
+ * Streaming SHA-256 over sha256Blocks().
+ */
+static void sha256Init(Sha256* sha) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->blockLength = 0;
+    sha->totalLength = 0;
+}
+
+static void sha256Update(Sha256* sha, const uint8_t* data, size_t length) {
+    sha->totalLength += length;
+
+    if (sha->blockLength > 0) {
+        size_t take = 64 - sha->blockLength;
+
+        if (take > length) {
+            take = length;
+        }
+        memcpy(sha->block + sha->blockLength, data, take);
+        sha->blockLength += take;
+        data             += take;
+        length           -= take;
+        if (sha->blockLength < 64) {
+            return;
+        }
+        sha256Blocks(sha->state, sha->block, 1);
+        sha->blockLength = 0;
+    }
+
+    if (length >= 64) {
+        sha256Blocks(sha->state, data, length / 64);
+        data   += length & ~(size_t) 63;
+        length &= 63;
+    }
+
+    memcpy(sha->block, data, length);
+    sha->blockLength = length;
+}
+
+static void sha256Final(Sha256* sha, uint8_t digest[32]) {
+    uint64_t bits = sha->totalLength * 8;
+    int      i;
+
+    sha->block[sha->blockLength++] = 0x80;
+    if (sha->blockLength > 56) {
+        memset(sha->block + sha->blockLength, 0, 64 - sha->blockLength);
+        sha256Blocks(sha->state, sha->block, 1);
+        sha->blockLength = 0;
+    }
+    memset(sha->block + sha->blockLength, 0, 56 - sha->blockLength);
+    for (i = 0; i < 8; ++i) {
+        sha->block[63 - i] = (uint8_t) (bits >> (8 * i));
+    }
+    sha256Blocks(sha->state, sha->block, 1);
+
+    for (i = 0; i < 8; ++i) {
+        digest[4 * i]     = (uint8_t) (sha->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t) (sha->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t) (sha->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t) sha->state[i];
+    }
+}
+
+#ifdef HASH_X86
+/*
+ * sha256BlocksShaNi
+ *
+ * SHA-256 compression with the SHA extensions: each sha256rnds2 does two
+ * rounds, and sha256msg1/msg2 extend the message schedule four words at a
+ * time.
+ */
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha256BlocksShaNi(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+    __m128i       abef;
+    __m128i       cdgh;
+    __m128i       tmp;
+
+    /* Rearrange the state into the ABEF/CDGH halves the instructions use */
+    tmp  = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[0]), 0xB1);
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[4]), 0x1B);
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    for (; blocks > 0; --blocks, data += 64) {
+        __m128i w[4];
+        __m128i abefSave = abef;
+        __m128i cdghSave = cdgh;
+        int     i;
+
+        for (i = 0; i < 16; ++i) {
+            __m128i message;
+
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 16 * i)),
+                                        byteSwap);
+            } else {
+                /* W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16] */
+                __m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+
+                next     = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3],
+                                                               w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
+            }
+
+            message = _mm_add_epi32(w[i & 3],
+                                    _mm_loadu_si128((const __m128i*) &sha256K[4 * i]));
+            cdgh    = _mm_sha256rnds2_epu32(cdgh, abef, message);
+            message = _mm_shuffle_epi32(message, 0x0E);
+            abef    = _mm_sha256rnds2_epu32(abef, cdgh, message);
+        }
+
+        abef = _mm_add_epi32(abef, abefSave);
+        cdgh = _mm_add_epi32(cdgh, cdghSave);
+    }
+
+    /* And back to ABCD/EFGH */
+    tmp  = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i*) &state[0], _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i*) &state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+/*
+ * crc32cHardware
+ *
+ * CRC32C with the SSE4.2 crc32 instruction, eight bytes at a time.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t length) {
+    uint64_t crc64 = crc;
+
+    for (; length >= 8; length -= 8, data += 8) {
+        uint64_t word;
+
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; length > 0; --length, ++data) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * sha256Blocks
+ *
+ * Runs the SHA-256 compression function over 'blocks' 64-byte blocks.
+ */
+static void sha256Blocks(uint32_t state[8], const uint8_t* data, size_t blocks) {
+#ifdef HASH_X86
+    if (haveShaNi) {
+        sha256BlocksShaNi(state, data, blocks);
+        return;
+    }
+#endif
+
+    for (; blocks > 0; --blocks, data += 64) {
+        uint32_t w[64];
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        int      t;
+
+        for (t = 0; t < 16; ++t) {
+            w[t] = (uint32_t) data[4 * t] << 24 | (uint32_t) data[4 * t + 1] << 16
+                 | (uint32_t) data[4 * t + 2] << 8 | data[4 * t + 3];
+        }
+        for (t = 16; t < 64; ++t) {
+            uint32_t s0 = ROTR32(w[t - 15], 7) ^ ROTR32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = ROTR32(w[t - 2], 17) ^ ROTR32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        for (t = 0; t < 64; ++t) {
+            uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+            uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256K[t] + w[t];
+            uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+            uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+/*
+ * crc32cUpdate
+ *
+ * Continues a CRC32C (Castagnoli) over 'length' bytes of 'data'.
+ */
+static uint32_t crc32cUpdate(uint32_t crc, const uint8_t* data, size_t length) {
+#ifdef HASH_X86
+    if (haveSse42) {
+        return crc32cHardware(crc, data, length);
+    }
+#endif
+    for (; length > 0; --length, ++data) {
+        crc = crc32cTable[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+/*
+ * xxh64Round
+ *
+ * One XXH64 accumulator step.
+ */
+static inline uint64_t xxh64Round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    acc  = ROTL64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;  /* XXH64 is defined little-endian, as is x86 */
+}
+
+/*
+ * xxh64Init, xxh64Update, xxh64Final
+ *
+ * Streaming XXH64 with a seed of 0.
+ */
+static void xxh64Init(Xxh64* xxh) {
+    xxh->acc[0]       = XXH_PRIME1 + XXH_PRIME2;
+    xxh->acc[1]       = XXH_PRIME2;
+    xxh->acc[2]       = 0;
+    xxh->acc[3]       = 0 - XXH_PRIME1;
+    xxh->stripeLength = 0;
+    xxh->totalLength  = 0;
+}
+
+static void xxh64Update(Xxh64* xxh, const uint8_t* data, size_t length) {
+    xxh->totalLength += length;
+
+    if (xxh->stripeLength > 0) {
+        size_t take = 32 - xxh->stripeLength;
+
+        if (take > length) {
+            take = length;
+        }
+        memcpy(xxh->stripe + xxh->stripeLength, data, take);
+        xxh->stripeLength += take;
+        data              += take;
+        length            -= take;
+        if (xxh->stripeLength < 32) {
+            return;
+        }
+        xxh->acc[0] = xxh64Round(xxh->acc[0], read64(xxh->stripe));
+        xxh->acc[1] = xxh64Round(xxh->acc[1], read64(xxh->stripe + 8));
+        xxh->acc[2] = xxh64Round(xxh->acc[2], read64(xxh->stripe + 16));
+        xxh->acc[3] = xxh64Round(xxh->acc[3], read64(xxh->stripe + 24));
+        xxh->stripeLength = 0;
+    }
+
+    for (; length >= 32; length -= 32, data += 32) {
+        xxh->acc[0] = xxh64Round(xxh->acc[0], read64(data));
+        xxh->acc[1] = xxh64Round(xxh->acc[1], read64(data + 8));
+        xxh->acc[2] = xxh64Round(xxh->acc[2], read64(data + 16));
+        xxh->acc[3] = xxh64Round(xxh->acc[3], read64(data + 24));
+    }
+
+    memcpy(xxh->stripe, data, length);
+    xxh->stripeLength = length;
+}
+
+static uint64_t xxh64Final(const Xxh64* xxh) {
+    const uint8_t* p      = xxh->stripe;
+    size_t         length = xxh->stripeLength;
+    uint64_t       hash;
+    int            i;
+
+    if (xxh->totalLength >= 32) {
+        hash = ROTL64(xxh->acc[0], 1) + ROTL64(xxh->acc[1], 7)
+             + ROTL64(xxh->acc[2], 12) + ROTL64(xxh->acc[3], 18);
+        for (i = 0; i < 4; ++i) {
+            hash ^= xxh64Round(0, xxh->acc[i]);
+            hash  = hash * XXH_PRIME1 + XXH_PRIME4;
+        }
+    } else {
+        hash = XXH_PRIME5;  /* acc[2] is the seed, i.e. 0 */
+    }
+    hash += xxh->totalLength;
+
+    for (; length >= 8; length -= 8, p += 8) {
+        hash ^= xxh64Round(0, read64(p));
+        hash  = ROTL64(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (length >= 4) {
+        uint32_t word;
+
+        memcpy(&word, p, sizeof(word));
+        hash ^= (uint64_t) word * XXH_PRIME1;
+        hash  = ROTL64(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p      += 4;
+        length -= 4;
+    }
+    for (; length > 0; --length, ++p) {
+        hash ^= *p * XXH_PRIME5;
+        hash  = ROTL64(hash, 11) * XXH_PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+ * toHex
+ *
+ * Writes 'length' bytes as lowercase hex (plus a terminator) into 'out'.
+ */
+static void toHex(char* out, const uint8_t* bytes, size_t length) {
+    static const char hexDigits[] = "0123456789abcdef";
+    size_t            i;
+
+    for (i = 0; i < length; ++i) {
+        out[2 * i]     = hexDigits[bytes[i] >> 4];
+        out[2 * i + 1] = hexDigits[bytes[i] & 0xF];
+    }
+    out[2 * length] = '\0';
+}
@@ -0,0 +1,20 @@
+/*
+ * shellHash.h
+ *
+ * The built-in 'hashsum' command, which checksums many files at once on a
+ * pool of threads.
+ */
+#ifndef SHELL_HASH_H
+#define SHELL_HASH_H
+
+/* Size (and alignment) of each worker's read buffer */
+#define HASH_BUFFER_SIZE (1024 * 1024)
+#define HASH_BUFFER_ALIGN 4096
+
+/* Most worker threads hashsum will start */
+#define HASH_MAX_THREADS 64
+
+/* Function prototypes */
+int  doHashsum(char** args);
+
+#endif
@@ -0,0 +1,474 @@
+/*
+ * shellJobs.c
+ *
+ * The reaper and the job table (see shellJobs.h).
+ *
+ * While the shell waits for a foreground command it blocks SIGCHLD and
+ * reads it from a signalfd instead.  Each time one arrives, waitid(P_ALL)
+ * is called until there is nothing left to collect (SIGCHLD does not
+ * queue, so one signal may stand for many children); the raw system call
+ * also returns each child's rusage.  Finished children are handed out in
+ * batches: the foreground command's goes to the waiter, the rest to the
+ * background jobs they belong to.  Outside of a wait SIGCHLD stays
+ * unblocked, so programs the shell starts inherit the usual signal mask.
+ *
+ * Background jobs live in an open-addressed hash table keyed by process
+ * ID, so marking one done costs the same with thousands of them running.
+ * Finished jobs are announced, with their CPU time, before the next
+ * prompt.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "shellJobs.h"
+#include "shellFd.h"
+
+#define JOB_TABLE_MASK (JOB_TABLE_SIZE - 1)
+
+/* A background job; 'pid' is 0 in a free slot */
+typedef struct {
+    pid_t         pid;
+    int           id;
+    bool          done;
+    int           status;   /* Wait status, once done */
+    struct rusage usage;    /* Once done */
+    char*         command;
+} Job;
+
+/* A child collected by the reaper but not yet handed out */
+typedef struct {
+    pid_t         pid;
+    int           status;
+    struct rusage usage;
+} Reaped;
+
+static Job jobs[JOB_TABLE_SIZE];
+static int jobCount  = 0;
+static int nextJobId = 1;
+
+/* The foreground children (a pipeline) being waited for, if any */
+static pid_t*        foregroundPids  = NULL;
+static int           foregroundCount = 0;
+static int           foregroundLeft  = 0;
+static int           foregroundStatus;
+static struct rusage foregroundUsage;
+
+/* The signalfd for SIGCHLD, and the process it was made in */
+static int   reaperFd  = -1;
+static pid_t reaperPid = 0;
+
+/* Function prototypes */
+static int    childSignalFd(const sigset_t* mask);
+static int    reapChildren(bool block);
+static int    waitStatus(const siginfo_t* info);
+static size_t slotFor(pid_t pid);
+static Job*   findJob(pid_t pid);
+static void   removeJob(Job* job);
+static int    sortedJobs(Job** list);
+static int    compareJobs(const void* a, const void* b);
+static void   printJob(const Job* job);
+
+/*
+ * canAddJob
+ *
+ * Returns true if there is room in the job table for another job.
+ */
+bool canAddJob(void) {
+    return jobCount < JOB_TABLE_SIZE / 2;
+}
+
+/*
+ * addJob
+ *
+ * Records the background job 'pid', running the command 'line'.  Returns
+ * its job number.  There must be room (see canAddJob()).
+ */
+int addJob(pid_t pid, char** line) {
+    size_t slot   = slotFor(pid);
+    size_t length = 1;
+    Job*   job;
+    int    i;
+
+    while (jobs[slot].pid != 0) {
+        slot = (slot + 1) & JOB_TABLE_MASK;
+    }
+    job = &jobs[slot];
+    memset(job, 0, sizeof(*job));
+
+    for (i = 0; line[i] != NULL; ++i) {
+        length += strlen(line[i]) + 1;
+    }
+    job->command    = malloc(length);
+    job->command[0] = '\0';
+    for (i = 0; line[i] != NULL; ++i) {
+        strcat(job->command, line[i]);
+        if (line[i + 1] != NULL) {
+            strcat(job->command, " ");
+        }
+    }
+
+    job->pid = pid;
+    job->id  = nextJobId++;
+    jobCount++;
+    return job->id;
+}
+
+/*
+ * waitForForeground
+ *
+ * Waits for the 'count' foreground children in 'pids' (the processes of a
+ * pipeline) to finish, meanwhile collecting any other children that do.
+ * Entries are set to 0 as they are collected; ones that are 0 (or -1) to
+ * begin with were never started.  Stores the resource usage of the last in
+ * 'usage' (if not NULL) and returns its wait status -- exit status 1 if it
+ * was never started.
+ */
+int waitForForeground(pid_t* pids, int count, struct rusage* usage) {
+    struct signalfd_siginfo signals[REAP_BATCH];
+    sigset_t                childSignal;
+    sigset_t                previous;
+    int                     fd;
+    int                     i;
+
+    sigemptyset(&childSignal);
+    sigaddset(&childSignal, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignal, &previous);
+    fd = childSignalFd(&childSignal);
+
+    foregroundPids   = pids;
+    foregroundCount  = count;
+    foregroundLeft   = 0;
+    foregroundStatus = W_EXITCODE(1, 0);
+    memset(&foregroundUsage, 0, sizeof(foregroundUsage));
+    for (i = 0; i < count; ++i) {
+        foregroundLeft += pids[i] > 0;
+    }
+
+    /* Collect first: the children may have finished before SIGCHLD was blocked */
+    for (;;) {
+        if (reapChildren(fd < 0) < 0 || foregroundLeft == 0) {
+            break;
+        }
+        if (fd >= 0 && read(fd, signals, sizeof(signals)) < 0 && errno != EINTR) {
+            perror("read(signalfd)");
+            fd = -1;
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &previous, NULL);
+    foregroundCount = 0;
+    if (usage != NULL) {
+        *usage = foregroundUsage;
+    }
+    return foregroundStatus;
+}
+
+/*
+ * jobFinished
+ *
+ * Hands the child 'pid', which finished with the wait status 'status'
+ * (using 'usage', which may be NULL), to whoever is waiting for it.  For
+ * code that reaps children of its own (xargs) as well as for the reaper.
+ */
+void jobFinished(pid_t pid, int status, const struct rusage* usage) {
+    Job* job;
+    int  i;
+
+    for (i = 0; i < foregroundCount; ++i) {
+        if (foregroundPids[i] == pid && pid > 0) {
+            foregroundPids[i] = 0;
+            foregroundLeft--;
+            if (i == foregroundCount - 1) {
+                foregroundStatus = status;
+                if (usage != NULL) {
+                    foregroundUsage = *usage;
+                }
+            }
+            return;
+        }
+    }
+
+    if ((job = findJob(pid)) != NULL) {
+        job->done   = true;
+        job->status = status;
+        if (usage != NULL) {
+            job->usage = *usage;
+        }
+    }
+}
+
+/*
+ * jobsRunning
+ *
+ * Returns true if any background job has yet to finish.
+ */
+bool jobsRunning(void) {
+    int i;
+
+    if (jobCount == 0) {
+        return false;
+    }
+    reapChildren(false);
+
+    for (i = 0; i < JOB_TABLE_SIZE; ++i) {
+        if (jobs[i].pid != 0 && !jobs[i].done) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * reportJobs
+ *
+ * Announces (and forgets) background jobs that have finished.  Called
+ * before each prompt; costs nothing when there are no jobs.
+ */
+void reportJobs(void) {
+    static Job*  list[JOB_TABLE_SIZE / 2];
+    static pid_t finished[JOB_TABLE_SIZE / 2];
+    int          count;
+    int          done = 0;
+    int          i;
+
+    if (jobCount == 0) {
+        return;
+    }
+    reapChildren(false);
+
+    count = sortedJobs(list);
+    for (i = 0; i < count; ++i) {
+        if (list[i]->done) {
+            printJob(list[i]);
+            finished[done++] = list[i]->pid;
+        }
+    }
+    for (i = 0; i < done; ++i) {
+        removeJob(findJob(finished[i]));
+    }
+}
+
+/*
+ * doJobs
+ *
+ * Implements the built-in 'jobs' command, which lists the background jobs.
+ * Finished ones are listed once and then forgotten.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command.
+ */
+int doJobs(char** args) {
+    static Job* list[JOB_TABLE_SIZE / 2];
+    int         count;
+    int         i;
+
+    if (args[1] != NULL) {
+        printf("usage: jobs\n");
+        return 1;
+    }
+    if (jobCount == 0) {
+        return 0;
+    }
+
+    /* Finished jobs are printed (and forgotten) first, then the rest */
+    reportJobs();
+    count = sortedJobs(list);
+    for (i = 0; i < count; ++i) {
+        printJob(list[i]);
+    }
+    return 0;
+}
+
+/*
+ * childSignalFd
+ *
+ * Returns the signalfd for 'mask' (SIGCHLD), or -1 if there is none.
+ */
+static int childSignalFd(const sigset_t* mask) {
+    if (reaperPid != getpid()) {
+        /* New to this process; an inherited one may have been closed (see applyFdActions()) */
+        reaperFd = signalfd(-1, mask, SFD_CLOEXEC);
+        if (reaperFd < 0) {
+            perror("signalfd");
+        } else {
+            reaperFd = keepFd(shellTrack(reaperFd));
+        }
+        reaperPid = getpid();
+    }
+    return reaperFd;
+}
+
+/*
+ * reapChildren
+ *
+ * Collects every child that has finished and hands each out, REAP_BATCH
+ * at a time.  If 'block', waits for at least one.  Returns how many were
+ * collected, or -1 if there are no children to wait for.
+ */
+static int reapChildren(bool block) {
+    Reaped batch[REAP_BATCH];
+    int    count = 0;
+    int    total = 0;
+    int    i;
+
+    for (;;) {
+        siginfo_t info;
+        long      result;
+
+        /* glibc's waitid() has no rusage argument; the system call does */
+        info.si_pid = 0;
+        result      = syscall(SYS_waitid, P_ALL, 0, &info,
+                              WEXITED | (block && total + count == 0 ? 0 : WNOHANG),
+                              &batch[count].usage);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (result == 0 && info.si_pid != 0) {
+            batch[count].pid    = info.si_pid;
+            batch[count].status = waitStatus(&info);
+            count++;
+        }
+        if (count == REAP_BATCH || result < 0 || info.si_pid == 0) {
+            for (i = 0; i < count; ++i) {
+                jobFinished(batch[i].pid, batch[i].status, &batch[i].usage);
+            }
+            total += count;
+            count  = 0;
+        }
+        if (result < 0) {
+            return total > 0 ? total : -1;
+        }
+        if (info.si_pid == 0) {
+            return total;
+        }
+    }
+}
+
+/*
+ * waitStatus
+ *
+ * Returns the wait status (as from waitpid()) that 'info' describes.
+ */
+static int waitStatus(const siginfo_t* info) {
+    switch (info->si_code) {
+    case CLD_EXITED:
+        return W_EXITCODE(info->si_status, 0);
+    case CLD_DUMPED:
+        return info->si_status | WCOREFLAG;
+    default:
+        return info->si_status;
+    }
+}
+
+/*
+ * slotFor
+ *
+ * Returns the slot the job 'pid' would have if there were no collisions.
+ */
+static size_t slotFor(pid_t pid) {
+    return ((uint32_t) pid * UINT32_C(2654435761)) & JOB_TABLE_MASK;
+}
+
+/*
+ * findJob
+ *
+ * Returns the job 'pid', or NULL if there is none.
+ */
+static Job* findJob(pid_t pid) {
+    size_t slot;
+
+    for (slot = slotFor(pid); jobs[slot].pid != 0; slot = (slot + 1) & JOB_TABLE_MASK) {
+        if (jobs[slot].pid == pid) {
+            return &jobs[slot];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * removeJob
+ *
+ * Removes 'job' from the table, moving back any later entries of the same
+ * run that would otherwise no longer be found.
+ */
+static void removeJob(Job* job) {
+    size_t hole = (size_t) (job - jobs);
+    size_t next;
+
+    free(job->command);
+    for (next = (hole + 1) & JOB_TABLE_MASK; jobs[next].pid != 0;
+         next = (next + 1) & JOB_TABLE_MASK) {
+        size_t home = slotFor(jobs[next].pid);
+
+        /* It can fill the hole unless its home lies between the hole and it */
+        if (((next - home) & JOB_TABLE_MASK) >= ((next - hole) & JOB_TABLE_MASK)) {
+            jobs[hole] = jobs[next];
+            hole       = next;
+        }
+    }
+    memset(&jobs[hole], 0, sizeof(jobs[hole]));
+
+    if (--jobCount == 0) {
+        nextJobId = 1;
+    }
+}
+
+/*
+ * sortedJobs
+ *
+ * Fills 'list' with the jobs in order of job number and returns how many
+ * there are.
+ */
+static int sortedJobs(Job** list) {
+    int count = 0;
+    int slot;
+
+    for (slot = 0; slot < JOB_TABLE_SIZE; ++slot) {
+        if (jobs[slot].pid != 0) {
+            list[count++] = &jobs[slot];
+        }
+    }
+    qsort(list, (size_t) count, sizeof(Job*), compareJobs);
+    return count;
+}
+
+/*
+ * compareJobs
+ *
+ * qsort() comparison of two Job pointers by job number.
+ */
+static int compareJobs(const void* a, const void* b) {
+    const Job* first  = *(Job* const*) a;
+    const Job* second = *(Job* const*) b;
+
+    return (first->id > second->id) - (first->id < second->id);
+}
+
+/*
+ * printJob
+ *
+ * Prints one line about 'job'.
+ */
+static void printJob(const Job* job) {
+    if (!job->done) {
+        printf("[%d] %ld Running  %s\n", job->id, (long) job->pid, job->command);
+        return;
+    }
+    printf("[%d] %ld Done (%d)  %s  (%.3fs user, %.3fs system)\n",
+           job->id, (long) job->pid,
+           WIFEXITED(job->status) ? WEXITSTATUS(job->status) : 128 + WTERMSIG(job->status),
+           job->command,
+           job->usage.ru_utime.tv_sec + job->usage.ru_utime.tv_usec / 1e6,
+           job->usage.ru_stime.tv_sec + job->usage.ru_stime.tv_usec / 1e6);
+}
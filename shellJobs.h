@@ -0,0 +1,31 @@
+/*
+ * shellJobs.h
+ *
+ * Children are reaped in one place: on SIGCHLD (read from a signalfd) the
+ * shell collects every child that has finished, with its resource usage,
+ * and hands each to whoever is waiting for it -- the foreground command
+ * or the table of background jobs.
+ */
+#ifndef SHELL_JOBS_H
+#define SHELL_JOBS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* Slots in the job table (a power of two); at most half are used */
+#define JOB_TABLE_SIZE 8192
+
+/* Children reaped before they are handed out */
+#define REAP_BATCH 64
+
+/* Function prototypes */
+bool canAddJob(void);
+int  addJob(pid_t pid, char** line);
+int  waitForForeground(pid_t* pids, int count, struct rusage* usage);
+void jobFinished(pid_t pid, int status, const struct rusage* usage);
+bool jobsRunning(void);
+void reportJobs(void);
+int  doJobs(char** args);
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ * shellLs.c
+ *
+ * Implements a built-in version of the 'ls' command supporting
+ *
+ *     -l  long format (mode, links, owner, group, size, time)
+ *     -a  include names beginning with '.'
+ *     -R  list subdirectories recursively
+ *     -S  sort by size, largest first
+ *     -t  sort by modification time, newest first
+ *
+ * Directories are read through the shell's traversal engine with statx()
+ * asking only for the fields the options need.  Owner and group names are
+ * looked up once per id for the life of the shell, and each directory's
+ * listing is formatted into one buffer and written with a single write().
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "shellLs.h"
+#include "shellWalk.h"
+#include "shellDirs.h"
+
+/* Options for one 'ls' invocation */
+typedef struct {
+    bool longFormat;
+    bool all;
+    bool recursive;
+    bool bySize;
+    bool byTime;
+    bool headers;  /* Print "dir:" before each listing */
+    bool first;    /* Nothing has been listed yet */
+} LsOptions;
+
+/* Output accumulated for one directory */
+typedef struct {
+    char*  data;
+    size_t length;
+    size_t capacity;
+} OutBuffer;
+
+/* One slot of a uid/gid -> name cache */
+typedef struct {
+    bool         used;
+    unsigned int id;
+    char*        name;
+} IdName;
+
+static IdName userCache[ID_CACHE_SIZE];
+static IdName groupCache[ID_CACHE_SIZE];
+
+/* Function prototypes */
+static bool        listDir(WalkDir* dir, void* context);
+static void        listFile(const char* path, LsOptions* options);
+static void        formatEntry(OutBuffer* out, int dirFd, const WalkEntry* entry,
+                               const int* widths);
+static void        formatMode(char* mode, unsigned int bits);
+static const char* formatTime(long long seconds);
+static int         compareEntries(const void* a, const void* b, void* context);
+static IdName*     lookupId(IdName* cache, unsigned int id);
+static void        append(OutBuffer* out, const char* text, size_t length);
+static void        flushBuffer(OutBuffer* out);
+static int         digits(unsigned long long value);
+
+/**
+ * doLs
+ *
+ * Implements a built-in version of the 'ls' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        Options come first; the remaining arguments are the files and
+ *        directories to list.  If there are none, the current directory is
+ *        assumed.
+ */
+int doLs(char** args) {
+    LsOptions    options;
+    unsigned int mask  = 0;
+    int          flags = 0;
+    int          i;
+    int          operands;
+
+    memset(&options, 0, sizeof(options));
+    options.first = true;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; ++i) {
+        const char* option;
+
+        for (option = args[i] + 1; *option != '\0'; ++option) {
+            switch (*option) {
+            case 'l': options.longFormat = true; break;
+            case 'a': options.all        = true; break;
+            case 'R': options.recursive  = true; break;
+            case 'S': options.bySize     = true; break;
+            case 't': options.byTime     = true; break;
+            default:
+                printf("ls: invalid option -- '%c'\n", *option);
+                printf("usage: ls [-alRSt] [file ...]\n");
+                return 1;
+            }
+        }
+    }
+
+    /* Ask statx() only for what the options need */
+    if (options.longFormat) {
+        mask |= STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE
+              | STATX_MTIME | STATX_BLOCKS;
+    }
+    if (options.bySize) {
+        mask |= STATX_SIZE;
+    }
+    if (options.byTime) {
+        mask |= STATX_MTIME;
+    }
+    flags |= options.all ? WALK_ALL : 0;
+    flags |= options.recursive ? WALK_RECURSIVE : 0;
+
+    operands        = 0;
+    while (args[i + operands] != NULL) {
+        operands++;
+    }
+    options.headers = options.recursive || operands > 1;
+
+    /* Keep our output in order with anything already buffered by stdio */
+    fflush(stdout);
+
+    if (operands == 0) {
+        return walkTree(".", mask, flags, listDir, &options) ? 0 : 1;
+    }
+
+    for (; args[i] != NULL; ++i) {
+        struct statx stx;
+        int          follow = options.longFormat ? AT_SYMLINK_NOFOLLOW : 0;
+
+        /* As with ls, -l shows a symbolic link to a directory as the link */
+        if (statx(cwdDirFd(), args[i], follow | AT_STATX_DONT_SYNC, STATX_TYPE,
+                  &stx) < 0) {
+            perror(args[i]);
+        } else if (S_ISDIR(stx.stx_mode)) {
+            walkTree(args[i], mask, flags, listDir, &options);
+        } else {
+            listFile(args[i], &options);
+        }
+    }
+    return 0;
+}
+
+/*
+ * userName
+ *
+ * Returns the name of user 'uid' (or its number as text), looking it up
+ * only the first time it is asked for.
+ */
+const char* userName(unsigned int uid) {
+    IdName* slot = lookupId(userCache, uid);
+
+    if (slot->name == NULL) {
+        struct passwd* entry = getpwuid(uid);
+
+        if (entry != NULL) {
+            slot->name = strdup(entry->pw_name);
+        } else if (asprintf(&slot->name, "%u", uid) < 0) {
+            slot->name = NULL;
+            return "?";
+        }
+    }
+    return slot->name;
+}
+
+/*
+ * groupName
+ *
+ * Returns the name of group 'gid' (or its number as text), looking it up
+ * only the first time it is asked for.
+ */
+const char* groupName(unsigned int gid) {
+    IdName* slot = lookupId(groupCache, gid);
+
+    if (slot->name == NULL) {
+        struct group* entry = getgrgid(gid);
+
+        if (entry != NULL) {
+            slot->name = strdup(entry->gr_name);
+        } else if (asprintf(&slot->name, "%u", gid) < 0) {
+            slot->name = NULL;
+            return "?";
+        }
+    }
+    return slot->name;
+}
+
+/*
+ * listDir
+ *
+ * Walk callback: sorts and prints one directory.
+ */
+static bool listDir(WalkDir* dir, void* context) {
+    LsOptions*         options = context;
+    OutBuffer          out     = { NULL, 0, 0 };
+    int                widths[4] = { 0, 0, 0, 0 };  /* links, user, group, size */
+    unsigned long long blocks  = 0;
+    size_t             i;
+
+    qsort_r(dir->entries, dir->count, sizeof(WalkEntry), compareEntries, options);
+
+    if (options->headers) {
+        if (!options->first) {
+            append(&out, "\n", 1);
+        }
+        append(&out, dir->path, strlen(dir->path));
+        append(&out, ":\n", 2);
+    }
+    options->first = false;
+
+    if (options->longFormat) {
+        char total[32];
+        int  length;
+
+        for (i = 0; i < dir->count; ++i) {
+            const struct statx* stx = &dir->entries[i].stx;
+            int                 width;
+
+            blocks += stx->stx_blocks;
+            if ((width = digits(stx->stx_nlink)) > widths[0]) {
+                widths[0] = width;
+            }
+            if ((width = (int) strlen(userName(stx->stx_uid))) > widths[1]) {
+                widths[1] = width;
+            }
+            if ((width = (int) strlen(groupName(stx->stx_gid))) > widths[2]) {
+                widths[2] = width;
+            }
+            if ((width = digits(stx->stx_size)) > widths[3]) {
+                widths[3] = width;
+            }
+        }
+
+        /* Like ls, report the total in 1K blocks */
+        length = snprintf(total, sizeof(total), "total %llu\n", blocks / 2);
+        append(&out, total, (size_t) length);
+    }
+
+    for (i = 0; i < dir->count; ++i) {
+        if (options->longFormat) {
+            formatEntry(&out, dir->dirFd, &dir->entries[i], widths);
+        } else {
+            append(&out, dir->entries[i].name, strlen(dir->entries[i].name));
+            append(&out, "\n", 1);
+        }
+    }
+
+    flushBuffer(&out);
+    return true;
+}
+
+/*
+ * listFile
+ *
+ * Prints a single file named on the command line.
+ */
+static void listFile(const char* path, LsOptions* options) {
+    OutBuffer out = { NULL, 0, 0 };
+    WalkEntry entry;
+
+    options->first = false;
+    entry.name = path;
+    entry.type = DT_REG;
+
+    if (options->longFormat) {
+        int widths[4] = { 0, 0, 0, 0 };
+
+        if (statx(cwdDirFd(), path, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                  STATX_BASIC_STATS, &entry.stx) < 0) {
+            perror(path);
+            return;
+        }
+        formatEntry(&out, cwdDirFd(), &entry, widths);
+    } else {
+        append(&out, path, strlen(path));
+        append(&out, "\n", 1);
+    }
+    flushBuffer(&out);
+}
+
+/*
+ * formatEntry
+ *
+ * Appends the long-format line for 'entry' to 'out'.
+ *
+ * dirFd  - Descriptor of the directory holding the entry (for symlinks)
+ * widths - Column widths for links, user, group and size
+ */
+static void formatEntry(OutBuffer* out, int dirFd, const WalkEntry* entry,
+                        const int* widths) {
+    const struct statx* stx = &entry->stx;
+    char                mode[11];
+    char                line[512];
+    int                 length;
+
+    formatMode(mode, stx->stx_mode);
+    length = snprintf(line, sizeof(line), "%s %*u %-*s %-*s %*llu %s ",
+                      mode, widths[0], stx->stx_nlink,
+                      widths[1], userName(stx->stx_uid),
+                      widths[2], groupName(stx->stx_gid),
+                      widths[3], (unsigned long long) stx->stx_size,
+                      formatTime(stx->stx_mtime.tv_sec));
+    if (length > (int) sizeof(line) - 1) {
+        length = (int) sizeof(line) - 1;
+    }
+    append(out, line, (size_t) length);
+    append(out, entry->name, strlen(entry->name));
+
+    if (S_ISLNK(stx->stx_mode)) {
+        char    target[4096];
+        ssize_t targetLength = readlinkat(dirFd, entry->name, target, sizeof(target));
+
+        if (targetLength >= 0) {
+            append(out, " -> ", 4);
+            append(out, target, (size_t) targetLength);
+        }
+    }
+    append(out, "\n", 1);
+}
+
+/*
+ * formatMode
+ *
+ * Writes the "drwxr-xr-x" form of 'bits' into 'mode' (11 characters).
+ */
+static void formatMode(char* mode, unsigned int bits) {
+    static const char types[] = "?pc?d?b?-?l?s???";  /* Indexed by S_IFMT >> 12 */
+
+    mode[0] = types[(bits & S_IFMT) >> 12];
+    mode[1] = (bits & S_IRUSR) ? 'r' : '-';
+    mode[2] = (bits & S_IWUSR) ? 'w' : '-';
+    mode[3] = (bits & S_ISUID) ? ((bits & S_IXUSR) ? 's' : 'S')
+                               : ((bits & S_IXUSR) ? 'x' : '-');
+    mode[4] = (bits & S_IRGRP) ? 'r' : '-';
+    mode[5] = (bits & S_IWGRP) ? 'w' : '-';
+    mode[6] = (bits & S_ISGID) ? ((bits & S_IXGRP) ? 's' : 'S')
+                               : ((bits & S_IXGRP) ? 'x' : '-');
+    mode[7] = (bits & S_IROTH) ? 'r' : '-';
+    mode[8] = (bits & S_IWOTH) ? 'w' : '-';
+    mode[9] = (bits & S_ISVTX) ? ((bits & S_IXOTH) ? 't' : 'T')
+                               : ((bits & S_IXOTH) ? 'x' : '-');
+    mode[10] = '\0';
+}
+
+/*
+ * formatTime
+ *
+ * Returns 'seconds' formatted as ls does ("Oct 18 11:13", or "Oct 18  2025"
+ * for times more than six months away).  Files in a directory tend to share
+ * timestamps, so the last result is reused when the minute is the same.
+ */
+static const char* formatTime(long long seconds) {
+    static char      text[32];
+    static long long lastMinute = -1;
+    static bool      lastRecent = false;
+    time_t           now        = time(NULL);
+    bool             recent     = seconds > (long long) now - 183LL * 24 * 3600
+                               && seconds < (long long) now + 3600;
+    time_t           when       = (time_t) seconds;
+    struct tm        local;
+
+    if (seconds / 60 == lastMinute && recent == lastRecent) {
+        return text;
+    }
+
+    localtime_r(&when, &local);
+    strftime(text, sizeof(text), recent ? "%b %e %H:%M" : "%b %e  %Y", &local);
+    lastMinute = seconds / 60;
+    lastRecent = recent;
+    return text;
+}
+
+/*
+ * compareEntries
+ *
+ * qsort_r() comparison: by size or time (descending) if asked for, then by
+ * name.
+ */
+static int compareEntries(const void* a, const void* b, void* context) {
+    const WalkEntry* left    = a;
+    const WalkEntry* right   = b;
+    const LsOptions* options = context;
+
+    if (options->bySize && left->stx.stx_size != right->stx.stx_size) {
+        return left->stx.stx_size < right->stx.stx_size ? 1 : -1;
+    }
+    if (options->byTime) {
+        const struct statx_timestamp* l = &left->stx.stx_mtime;
+        const struct statx_timestamp* r = &right->stx.stx_mtime;
+
+        if (l->tv_sec != r->tv_sec) {
+            return l->tv_sec < r->tv_sec ? 1 : -1;
+        }
+        if (l->tv_nsec != r->tv_nsec) {
+            return l->tv_nsec < r->tv_nsec ? 1 : -1;
+        }
+    }
+    return strcmp(left->name, right->name);
+}
+
+/*
+ * lookupId
+ *
+ * Returns the slot of 'cache' for 'id' (open addressing, linear probing),
+ * claiming an empty one if 'id' has not been seen.  If the cache is full,
+ * the home slot is recycled.
+ */
+static IdName* lookupId(IdName* cache, unsigned int id) {
+    unsigned int home = (id * 2654435761u) & (ID_CACHE_SIZE - 1);
+    unsigned int i;
+
+    for (i = 0; i < ID_CACHE_SIZE; ++i) {
+        IdName* slot = &cache[(home + i) & (ID_CACHE_SIZE - 1)];
+
+        if (!slot->used) {
+            slot->used = true;
+            slot->id   = id;
+            slot->name = NULL;
+            return slot;
+        }
+        if (slot->id == id) {
+            return slot;
+        }
+    }
+
+    free(cache[home].name);
+    cache[home].id   = id;
+    cache[home].name = NULL;
+    return &cache[home];
+}
+
+/*
+ * append
+ *
+ * Appends 'length' bytes of 'text' to 'out', growing it as needed.
+ */
+static void append(OutBuffer* out, const char* text, size_t length) {
+    if (out->length + length > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity : 8192;
+
+        while (out->length + length > capacity) {
+            capacity *= 2;
+        }
+        out->data     = realloc(out->data, capacity);
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->length, text, length);
+    out->length += length;
+}
+
+/*
+ * flushBuffer
+ *
+ * Writes 'out' to standard output and releases it.
+ */
+static void flushBuffer(OutBuffer* out) {
+    size_t written = 0;
+
+    while (written < out->length) {
+        ssize_t result = write(STDOUT_FILENO, out->data + written,
+                               out->length - written);
+
+        if (result <= 0) {
+            perror("ls: write");
+            break;
+        }
+        written += (size_t) result;
+    }
+    free(out->data);
+    out->data   = NULL;
+    out->length = out->capacity = 0;
+}
+
+/*
+ * digits
+ *
+ * Returns the number of decimal digits in 'value'.
+ */
+static int digits(unsigned long long value) {
+    int count = 1;
+
+    while (value >= 10) {
+        value /= 10;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,17 @@
+/*
+ * shellLs.h
+ *
+ * The built-in 'ls' command.
+ */
+#ifndef SHELL_LS_H
+#define SHELL_LS_H
+
+/* Slots in the uid -> name and gid -> name caches (a power of two) */
+#define ID_CACHE_SIZE 256
+
+/* Function prototypes */
+int         doLs(char** args);
+const char* userName(unsigned int uid);
+const char* groupName(unsigned int gid);
+
+#endif
@@ -0,0 +1,507 @@
+/*
+ * shellMatch.c
+ *
+ * The pattern cache and the commands that match with it (see
+ * shellMatch.h).
+ *
+ * The cache is a small table searched by hash, as the other caches are;
+ * when it is full the entry least recently used is compiled over.  Turned
+ * off, it compiles every pattern afresh for each match, for comparison.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <regex.h>
+#include "shellMatch.h"
+#include "shellGlob.h"
+#include "shellVars.h"
+
+/* The kinds of pattern */
+typedef enum {
+    PATTERN_GLOB,
+    PATTERN_REGEX
+} PatternKind;
+
+/* How a compiled pattern is matched */
+typedef enum {
+    MATCHER_LITERAL,  /* The text is the literal */
+    MATCHER_PREFIX,   /* The text starts with it */
+    MATCHER_SUFFIX,   /* The text ends with it */
+    MATCHER_INFIX,    /* The text contains it */
+    MATCHER_GLOB,     /* globMatch() */
+    MATCHER_REGEX     /* regexec() */
+} MatcherType;
+
+/* A compiled pattern; 'pattern' is NULL in a free entry */
+typedef struct {
+    char*         pattern;
+    size_t        patternLength;
+    PatternKind   kind;
+    unsigned long hash;
+    MatcherType   type;
+    char*         literal;        /* The literal part of the pattern, unquoted */
+    size_t        literalLength;
+    regex_t       regex;          /* MATCHER_REGEX */
+    size_t        groups;         /* Groups a regular expression match records */
+    unsigned long lastUse;        /* For least-recently-used replacement */
+    unsigned long matches;
+} MatchEntry;
+
+static MatchEntry    matchEntries[MATCH_CACHE_SIZE];
+static MatchEntry    uncached;  /* The pattern compiled last with the cache off */
+static unsigned long useClock     = 0;
+static bool          cacheEnabled = true;
+
+static const char* matcherNames[] = { "literal", "prefix", "suffix", "infix", "glob", "regex" };
+
+/* Function prototypes */
+static MatchEntry*   findMatchEntry(const char* pattern, PatternKind kind);
+static bool          compilePattern(MatchEntry* entry, const char* pattern, PatternKind kind,
+                                    unsigned long hash);
+static void          compileGlob(MatchEntry* entry);
+static bool          compileRegex(MatchEntry* entry);
+static void          freeMatchEntry(MatchEntry* entry);
+static bool          runMatcher(MatchEntry* entry, const char* text, regmatch_t* groups);
+static void          setRematch(const char* text, const regmatch_t* groups, size_t count);
+static unsigned long hashPattern(const char* pattern, PatternKind kind);
+
+/*
+ * setMatchCache
+ *
+ * Turns the pattern cache on or off; turning it off drops every pattern
+ * compiled.
+ */
+void setMatchCache(bool enabled) {
+    int i;
+
+    cacheEnabled = enabled;
+    freeMatchEntry(&uncached);
+    if (!enabled) {
+        for (i = 0; i < MATCH_CACHE_SIZE; ++i) {
+            freeMatchEntry(&matchEntries[i]);
+        }
+    }
+}
+
+/*
+ * matchGlob
+ *
+ * Returns true if all of 'text' matches the shell pattern 'pattern' (see
+ * shellGlob.h).
+ */
+bool matchGlob(const char* text, const char* pattern) {
+    return runMatcher(findMatchEntry(pattern, PATTERN_GLOB), text, NULL);
+}
+
+/*
+ * matchRegex
+ *
+ * Matches 'text' against the extended regular expression 'pattern',
+ * leaving what matched, and what each group matched, in $BASH_REMATCH.
+ *
+ * Returns 0 if it matches, 1 if it does not, or 2 (after printing a
+ * message) if 'pattern' is not a regular expression.
+ */
+int matchRegex(const char* text, const char* pattern) {
+    MatchEntry* entry = findMatchEntry(pattern, PATTERN_REGEX);
+    regmatch_t  groups[MATCH_GROUPS];
+
+    if (entry == NULL) {
+        return 2;
+    }
+    if (!runMatcher(entry, text, groups)) {
+        setRematch(text, groups, 0);
+        return 1;
+    }
+    setRematch(text, groups, entry->groups);
+    return 0;
+}
+
+/*
+ * doTest
+ *
+ * Implements the built-in '[[' command:
+ *
+ *     [[ [!] string (== | = | != | =~) pattern ]]
+ *     [[ [!] [-z | -n] string ]]
+ *
+ * Tests whether 'string' matches the shell pattern (==, =) or does not
+ * (!=), or matches the extended regular expression (=~, see matchRegex()),
+ * or whether it is empty (-z) or not (-n, or no operator).  ! inverts the
+ * test.  Patterns are used as they are, so characters they should match
+ * literally are quoted with \.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns 0 if the test is true, 1 if it is false or 2 if it is malformed.
+ */
+int doTest(char** args) {
+    char** words  = args + 1;
+    bool   negate = false;
+    bool   result;
+    int    status;
+    int    count;
+
+    for (count = 0; words[count] != NULL; ++count) {
+    }
+    if (count > 0 && strcmp(words[count - 1], "]]") == 0) {
+        count--;
+    } else {
+        count = 0;
+    }
+    if (count > 1 && strcmp(words[0], "!") == 0) {
+        negate = true;
+        words++;
+        count--;
+    }
+
+    if (count == 1) {
+        result = words[0][0] != '\0';
+    } else if (count == 2 && (strcmp(words[0], "-z") == 0 || strcmp(words[0], "-n") == 0)) {
+        result = (words[1][0] == '\0') == (words[0][1] == 'z');
+    } else if (count == 3 && (strcmp(words[1], "==") == 0 || strcmp(words[1], "=") == 0)) {
+        result = matchGlob(words[0], words[2]);
+    } else if (count == 3 && strcmp(words[1], "!=") == 0) {
+        result = !matchGlob(words[0], words[2]);
+    } else if (count == 3 && strcmp(words[1], "=~") == 0) {
+        if ((status = matchRegex(words[0], words[2])) == 2) {
+            return 2;
+        }
+        result = status == 0;
+    } else {
+        printf("usage: [[ [!] string (== | != | =~) pattern ]] or [[ [!] [-z | -n] string ]]\n");
+        return 2;
+    }
+    return result != negate ? 0 : 1;
+}
+
+/*
+ * doCase
+ *
+ * Implements the built-in 'case' command:
+ *
+ *     case word in pattern ...
+ *
+ * Tests 'word' against each shell pattern in turn.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns 0 if one of the patterns matches, or 1 if none does.
+ */
+int doCase(char** args) {
+    int i;
+
+    if (args[1] == NULL || args[2] == NULL || strcmp(args[2], "in") != 0) {
+        printf("usage: case word in pattern ...\n");
+        return 2;
+    }
+    for (i = 3; args[i] != NULL; ++i) {
+        if (matchGlob(args[1], args[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * doMatchCache
+ *
+ * Implements the built-in 'matchcache' command, which turns the pattern
+ * cache on or off.  With no argument the current state is printed, along
+ * with the patterns compiled, how each is matched and how often it was.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command.
+ */
+int doMatchCache(char** args) {
+    int i;
+
+    if (args[1] == NULL) {
+        printf("matchcache is %s\n", cacheEnabled ? "on" : "off");
+        for (i = 0; i < MATCH_CACHE_SIZE; ++i) {
+            if (matchEntries[i].pattern != NULL) {
+                printf("%8lu  %-5s  %-7s  %s\n", matchEntries[i].matches,
+                       matchEntries[i].kind == PATTERN_GLOB ? "glob" : "regex",
+                       matcherNames[matchEntries[i].type], matchEntries[i].pattern);
+            }
+        }
+    } else if (args[2] == NULL && strcmp(args[1], "on") == 0) {
+        setMatchCache(true);
+    } else if (args[2] == NULL && strcmp(args[1], "off") == 0) {
+        setMatchCache(false);
+    } else {
+        printf("usage: matchcache [on|off]\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * findMatchEntry
+ *
+ * Returns the entry holding 'pattern' of 'kind' compiled, compiling it
+ * over the least recently used entry if there is none, or NULL (after
+ * printing a message) if it cannot be compiled.
+ */
+static MatchEntry* findMatchEntry(const char* pattern, PatternKind kind) {
+    unsigned long hash   = hashPattern(pattern, kind);
+    MatchEntry*   oldest = NULL;
+    int           i;
+
+    if (!cacheEnabled) {
+        freeMatchEntry(&uncached);
+        return compilePattern(&uncached, pattern, kind, hash) ? &uncached : NULL;
+    }
+
+    for (i = 0; i < MATCH_CACHE_SIZE; ++i) {
+        MatchEntry* entry = &matchEntries[i];
+
+        if (entry->pattern != NULL && entry->hash == hash && entry->kind == kind
+                && strcmp(entry->pattern, pattern) == 0) {
+            entry->lastUse = ++useClock;
+            return entry;
+        }
+        /* Free entries have a 'lastUse' of 0, so they go first */
+        if (oldest == NULL || entry->lastUse < oldest->lastUse) {
+            oldest = entry;
+        }
+    }
+
+    freeMatchEntry(oldest);
+    if (!compilePattern(oldest, pattern, kind, hash)) {
+        return NULL;
+    }
+    oldest->lastUse = ++useClock;
+    return oldest;
+}
+
+/*
+ * compilePattern
+ *
+ * Compiles 'pattern' of 'kind' (with hash 'hash') into the free 'entry'.
+ *
+ * Returns false, after printing a message and leaving 'entry' free, if it
+ * cannot be compiled.
+ */
+static bool compilePattern(MatchEntry* entry, const char* pattern, PatternKind kind,
+                           unsigned long hash) {
+    entry->pattern       = strdup(pattern);
+    entry->patternLength = strlen(pattern);
+    entry->kind          = kind;
+    entry->hash          = hash;
+    entry->groups        = 1;
+    entry->matches       = 0;
+
+    if (kind == PATTERN_GLOB) {
+        compileGlob(entry);
+    } else if (!compileRegex(entry)) {
+        freeMatchEntry(entry);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * compileGlob
+ *
+ * Compiles the shell pattern of 'entry': at most a '*' at either end of a
+ * literal is matched by comparing the literal, anything else by
+ * globMatch().
+ */
+static void compileGlob(MatchEntry* entry) {
+    const char* pattern  = entry->pattern;
+    size_t      start    = 0;
+    size_t      end      = entry->patternLength;
+    bool        leading  = false;
+    bool        trailing = false;
+    size_t      escapes  = 0;
+    size_t      i;
+
+    if (end > 0 && pattern[0] == '*') {
+        leading = true;
+        start   = 1;
+    }
+    /* A '*' at the end is quoted by an odd number of backslashes before it */
+    for (i = end - 1; end > start && i > start && pattern[i - 1] == '\\'; --i) {
+        escapes++;
+    }
+    if (end > start && pattern[end - 1] == '*' && escapes % 2 == 0) {
+        trailing = true;
+        end--;
+    }
+
+    entry->literal       = malloc(end - start + 1);
+    entry->literalLength = 0;
+    for (i = start; i < end; ++i) {
+        if (pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '[') {
+            entry->type = MATCHER_GLOB;
+            return;
+        }
+        if (pattern[i] == '\\' && i + 1 < end) {
+            i++;
+        }
+        entry->literal[entry->literalLength++] = pattern[i];
+    }
+
+    if (leading) {
+        entry->type = trailing ? MATCHER_INFIX : MATCHER_SUFFIX;
+    } else {
+        entry->type = trailing ? MATCHER_PREFIX : MATCHER_LITERAL;
+    }
+}
+
+/*
+ * compileRegex
+ *
+ * Compiles the extended regular expression of 'entry': a literal,
+ * optionally anchored with ^ and $, is matched by comparing it, anything
+ * else by regexec().
+ *
+ * Returns false, after printing a message, if it is not a regular
+ * expression.
+ */
+static bool compileRegex(MatchEntry* entry) {
+    const char* pattern = entry->pattern;
+    size_t      start   = pattern[0] == '^' ? 1 : 0;
+    size_t      end     = entry->patternLength;
+    bool        anchor  = end > start && pattern[end - 1] == '$';
+    char        message[256];
+    int         error;
+
+    if (anchor) {
+        end--;
+    }
+    if (strcspn(pattern + start, ".[]()*+?{}|^$\\") >= end - start) {
+        entry->literal       = strndup(pattern + start, end - start);
+        entry->literalLength = end - start;
+        if (start == 1) {
+            entry->type = anchor ? MATCHER_LITERAL : MATCHER_PREFIX;
+        } else {
+            entry->type = anchor ? MATCHER_SUFFIX : MATCHER_INFIX;
+        }
+        return true;
+    }
+
+    if ((error = regcomp(&entry->regex, pattern, REG_EXTENDED)) != 0) {
+        regerror(error, &entry->regex, message, sizeof(message));
+        fprintf(stderr, "%s: %s\n", pattern, message);
+        return false;
+    }
+    entry->type   = MATCHER_REGEX;
+    entry->groups = entry->regex.re_nsub + 1 < MATCH_GROUPS ? entry->regex.re_nsub + 1
+                                                            : MATCH_GROUPS;
+    return true;
+}
+
+/*
+ * freeMatchEntry
+ *
+ * Frees what 'entry' holds, leaving it free.
+ */
+static void freeMatchEntry(MatchEntry* entry) {
+    if (entry->pattern == NULL) {
+        return;
+    }
+    if (entry->type == MATCHER_REGEX) {
+        regfree(&entry->regex);
+    }
+    free(entry->pattern);
+    free(entry->literal);
+    entry->pattern = NULL;
+    entry->literal = NULL;
+    entry->lastUse = 0;
+}
+
+/*
+ * runMatcher
+ *
+ * Matches 'text' against the compiled pattern in 'entry' (NULL if it
+ * could not be compiled, which nothing matches).  If 'groups' is not NULL
+ * the match, and each group of a regular expression, is recorded in it.
+ *
+ * Returns true if 'text' matches.
+ */
+static bool runMatcher(MatchEntry* entry, const char* text, regmatch_t* groups) {
+    size_t      length = strlen(text);
+    const char* found  = NULL;
+    size_t      start  = 0;
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    switch (entry->type) {
+    case MATCHER_LITERAL:
+        found = length == entry->literalLength ? text : NULL;
+        break;
+    case MATCHER_PREFIX:
+        found = length >= entry->literalLength ? text : NULL;
+        break;
+    case MATCHER_SUFFIX:
+        found = length >= entry->literalLength ? text + length - entry->literalLength : NULL;
+        break;
+    case MATCHER_INFIX:
+        found = memmem(text, length, entry->literal, entry->literalLength);
+        break;
+    case MATCHER_GLOB:
+        if (!globMatch(entry->pattern, entry->patternLength, text, length)) {
+            return false;
+        }
+        entry->matches++;
+        return true;
+    case MATCHER_REGEX:
+        if (regexec(&entry->regex, text, groups != NULL ? entry->groups : 0, groups, 0) != 0) {
+            return false;
+        }
+        entry->matches++;
+        return true;
+    }
+
+    if (found == NULL || memcmp(found, entry->literal, entry->literalLength) != 0) {
+        return false;
+    }
+    start = (size_t) (found - text);
+    if (groups != NULL) {
+        groups[0].rm_so = (regoff_t) start;
+        groups[0].rm_eo = (regoff_t) (start + entry->literalLength);
+    }
+    entry->matches++;
+    return true;
+}
+
+/*
+ * setRematch
+ *
+ * Sets $BASH_REMATCH to the parts of 'text' the first 'count' of 'groups'
+ * matched ("" for a group that did not take part).
+ */
+static void setRematch(const char* text, const regmatch_t* groups, size_t count) {
+    char** items = count > 0 ? malloc(count * sizeof(char*)) : NULL;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        if (groups[i].rm_so < 0) {
+            items[i] = strdup("");
+        } else {
+            items[i] = strndup(text + groups[i].rm_so, (size_t) (groups[i].rm_eo - groups[i].rm_so));
+        }
+    }
+    setArrayItems("BASH_REMATCH", items, count);
+}
+
+/*
+ * hashPattern
+ *
+ * Returns the FNV-1a hash of 'pattern', salted with its 'kind'.
+ */
+static unsigned long hashPattern(const char* pattern, PatternKind kind) {
+    unsigned long hash = 2166136261UL ^ (unsigned long) kind;
+
+    for (; *pattern != '\0'; ++pattern) {
+        hash = (hash ^ (unsigned char) *pattern) * 16777619UL;
+    }
+    return hash;
+}
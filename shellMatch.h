@@ -0,0 +1,35 @@
+/*
+ * shellMatch.h
+ *
+ * Pattern matching for the built-in '[[' and 'case' commands, through a
+ * cache of compiled patterns ('matchcache').  Each distinct pattern is
+ * compiled once, the first time it is used, and kept, least recently used
+ * first out, so matching the same pattern over and over (a script testing
+ * line after line) costs only the match.
+ *
+ * Compiling picks the cheapest way to match a pattern: a shell pattern
+ * that is a literal, prefix*, *suffix or *infix* (and a regular
+ * expression that is a literal, ^literal, literal$ or ^literal$) is
+ * matched with memcmp() or memmem(); any other is matched with
+ * globMatch() or a regex_t compiled by regcomp().
+ */
+#ifndef SHELL_MATCH_H
+#define SHELL_MATCH_H
+
+#include <stdbool.h>
+
+/* Compiled patterns kept */
+#define MATCH_CACHE_SIZE 64
+
+/* Groups of a regular expression match recorded in $BASH_REMATCH, the whole match included */
+#define MATCH_GROUPS 16
+
+/* Function prototypes */
+void setMatchCache(bool enabled);
+bool matchGlob(const char* text, const char* pattern);
+int  matchRegex(const char* text, const char* pattern);
+int  doTest(char** args);
+int  doCase(char** args);
+int  doMatchCache(char** args);
+
+#endif
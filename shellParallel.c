@@ -0,0 +1,587 @@
+/*
+ * shellParallel.c
+ *
+ * Implements the built-in 'parallel' command:
+ *
+ *     parallel [-j jobs] [-S endpoint[,endpoint...]] [-r retries]
+ *              command template [::: argument ...]
+ *
+ * One task is made from the template for each argument (or, without
+ * ":::", each line of standard input) by replacing every "{}" with the
+ * argument, or appending the argument if there is no "{}".  The tasks are
+ * run by a pool of agents: -j local ones (one per CPU by default, none by
+ * default when -S is given) plus the remote agents listed with -S.
+ *
+ * The queue is pull-based: an agent is only given a task when it says it
+ * is ready, so fast agents simply take more of the work.  If an agent goes
+ * away in the middle of a task, the task goes back to the front of the
+ * queue for another agent, up to -r times (PARALLEL_RETRIES by default); a
+ * command that merely fails is not retried.  Each task's output is held
+ * until every task before it has been printed, so results come out in the
+ * order of the arguments.
+ *
+ * The exit status is 0 if every task succeeded and 1 otherwise.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include "shellParallel.h"
+#include "shellAgent.h"
+#include "shellFd.h"
+
+/* Output captured from a task (standard output or standard error) */
+typedef struct {
+    char*  data;
+    size_t length;
+    size_t capacity;
+} Capture;
+
+/* One command line to run */
+typedef struct {
+    char*   command;
+    Capture output[2];
+    int     attempts;  /* Agents it has been handed to */
+    int     status;
+    bool    done;
+} Task;
+
+/* An agent taking part */
+typedef struct {
+    const char* name;   /* The endpoint, or "local" */
+    int         fd;     /* -1 once it has gone */
+    pid_t       pid;    /* For local agents, else -1 */
+    FrameReader reader;
+    long        task;   /* The task it is running, or -1 */
+    bool        idle;   /* It is ready and waiting for a task */
+} Worker;
+
+/* Everything one 'parallel' invocation keeps track of */
+typedef struct {
+    Task*   tasks;
+    size_t  taskCount;
+    size_t* queue;       /* Circular; holds each unfinished task at most once */
+    size_t  queueHead;
+    size_t  queueCount;
+    size_t  completed;
+    size_t  printed;     /* Tasks before this one have been printed */
+    Worker  workers[PARALLEL_MAX_WORKERS];
+    int     workerCount;
+    int     active;      /* Workers still connected */
+    int     retries;
+    int     epollFd;
+} ParallelRun;
+
+/* Function prototypes */
+static char** readLines(size_t* count);
+static char*  makeCommand(const char* template, const char* argument);
+static void   startWorkers(ParallelRun* run, char** args, int first, long jobs);
+static bool   addWorker(ParallelRun* run, const char* name, int fd, pid_t pid);
+static void   dispatch(ParallelRun* run, Worker* worker);
+static void   handleFrame(ParallelRun* run, Worker* worker, const Frame* frame);
+static void   loseWorker(ParallelRun* run, Worker* worker);
+static void   requeue(ParallelRun* run, size_t task);
+static void   finishTask(ParallelRun* run, size_t task, int status);
+static void   printResults(ParallelRun* run);
+static void   capture(Capture* capture, const char* data, size_t length);
+
+/*
+ * doParallel
+ *
+ * Implements the built-in 'parallel' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command.
+ */
+int doParallel(char** args) {
+    static ParallelRun run;
+    struct epoll_event events[PARALLEL_MAX_WORKERS];
+    char**             arguments;
+    char*              template;
+    size_t             templateLength = 0;
+    size_t             argumentCount  = 0;
+    bool               fromStdin;
+    long               jobs   = -1;
+    int                status = 0;
+    int                first;
+    int                last;
+    int                i;
+    size_t             t;
+
+    memset(&run, 0, sizeof(run));
+    run.retries = PARALLEL_RETRIES;
+    run.epollFd = -1;
+
+    /* Options; -S may be given more than once, so endpoints are added below */
+    for (first = 1; args[first] != NULL && args[first][0] == '-'; first += 2) {
+        char* end;
+
+        if (args[first + 1] == NULL || args[first][1] == '\0' || args[first][2] != '\0'
+                || strchr("jSr", args[first][1]) == NULL) {
+            printf("usage: parallel [-j jobs] [-S endpoint[,endpoint...]] [-r retries] "
+                   "command [::: argument ...]\n");
+            return 1;
+        }
+        if (args[first][1] == 'S') {
+            continue;
+        }
+        errno = 0;
+        if (args[first][1] == 'j') {
+            jobs = strtol(args[first + 1], &end, 10);
+        } else {
+            run.retries = (int) strtol(args[first + 1], &end, 10);
+        }
+        if (*end != '\0' || errno != 0 || jobs < -1 || run.retries < 0) {
+            printf("parallel: invalid number '%s'\n", args[first + 1]);
+            return 1;
+        }
+    }
+
+    /* The template runs up to ":::" */
+    for (last = first; args[last] != NULL && strcmp(args[last], ":::") != 0; ++last) {
+        templateLength += strlen(args[last]) + 1;
+    }
+    if (last == first) {
+        printf("usage: parallel [-j jobs] [-S endpoint[,endpoint...]] [-r retries] "
+               "command [::: argument ...]\n");
+        return 1;
+    }
+    template    = malloc(templateLength);
+    template[0] = '\0';
+    for (i = first; i < last; ++i) {
+        strcat(template, args[i]);
+        if (i + 1 < last) {
+            strcat(template, " ");
+        }
+    }
+
+    fromStdin = args[last] == NULL;
+    if (fromStdin) {
+        arguments = readLines(&argumentCount);
+    } else {
+        arguments     = &args[last + 1];
+        while (arguments[argumentCount] != NULL) {
+            argumentCount++;
+        }
+    }
+
+    run.taskCount = argumentCount;
+    run.tasks     = calloc(argumentCount > 0 ? argumentCount : 1, sizeof(Task));
+    run.queue     = malloc((argumentCount > 0 ? argumentCount : 1) * sizeof(size_t));
+    for (t = 0; t < argumentCount; ++t) {
+        run.tasks[t].command = makeCommand(template, arguments[t]);
+        run.queue[t]         = t;
+    }
+    run.queueCount = argumentCount;
+    free(template);
+    if (fromStdin) {
+        for (t = 0; t < argumentCount; ++t) {
+            free(arguments[t]);
+        }
+        free(arguments);
+    }
+
+    fflush(stdout);
+    run.epollFd = shellTrack(epoll_create1(EPOLL_CLOEXEC));
+    if (run.epollFd < 0) {
+        perror("epoll_create1");
+    } else {
+        startWorkers(&run, args, first, jobs);
+    }
+    if (run.active == 0 && run.taskCount > 0) {
+        fprintf(stderr, "parallel: no agents to run the tasks\n");
+    }
+
+    /* Agents announce they are ready as soon as they connect */
+    while (run.completed < run.taskCount && run.active > 0) {
+        int ready = epoll_wait(run.epollFd, events, PARALLEL_MAX_WORKERS, -1);
+
+        for (i = 0; i < ready; ++i) {
+            Worker* worker = events[i].data.ptr;
+            ssize_t bytes;
+            Frame   frame;
+
+            if (worker->fd < 0) {
+                continue;
+            }
+            bytes = fillFrameReader(worker->fd, &worker->reader);
+            while (worker->fd >= 0 && takeFrame(&worker->reader, &frame)) {
+                handleFrame(&run, worker, &frame);
+            }
+            if (worker->fd >= 0 && bytes <= 0) {
+                fprintf(stderr, "parallel: lost agent %s\n", worker->name);
+                loseWorker(&run, worker);
+            }
+        }
+    }
+
+    /* Whatever is left had nowhere to run */
+    while (run.queueCount > 0) {
+        size_t task = run.queue[run.queueHead];
+
+        run.queueHead = (run.queueHead + 1) % run.taskCount;
+        run.queueCount--;
+        fprintf(stderr, "parallel: no agent left to run '%s'\n", run.tasks[task].command);
+        finishTask(&run, task, 255);
+    }
+
+    for (i = 0; i < run.workerCount; ++i) {
+        if (run.workers[i].fd >= 0) {
+            loseWorker(&run, &run.workers[i]);
+        }
+    }
+    if (run.epollFd >= 0) {
+        shellClose(run.epollFd);
+    }
+    for (t = 0; t < run.taskCount; ++t) {
+        if (!run.tasks[t].done || run.tasks[t].status != 0) {
+            status = 1;
+        }
+        free(run.tasks[t].command);
+        free(run.tasks[t].output[0].data);
+        free(run.tasks[t].output[1].data);
+    }
+    free(run.tasks);
+    free(run.queue);
+    fflush(stdout);
+    return status;
+}
+
+/*
+ * readLines
+ *
+ * Reads standard input (with read(), as stdio may hold input of the shell's
+ * own) and returns its non-empty lines, newly allocated, storing how many
+ * there are in 'count'.
+ */
+static char** readLines(size_t* count) {
+    char**  lines    = NULL;
+    size_t  capacity = 0;
+    char*   data     = NULL;
+    size_t  length   = 0;
+    size_t  size     = 0;
+    ssize_t bytes;
+    char*   line;
+    char*   save;
+
+    for (;;) {
+        if (length + PARALLEL_READ_SIZE + 1 > size) {
+            size = (length + PARALLEL_READ_SIZE + 1) * 2;
+            data = realloc(data, size);
+        }
+        bytes = read(STDIN_FILENO, data + length, PARALLEL_READ_SIZE);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            if (bytes < 0) {
+                perror("parallel: read");
+            }
+            break;
+        }
+        length += (size_t) bytes;
+    }
+    data[length] = '\0';
+
+    *count = 0;
+    for (line = strtok_r(data, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            lines    = realloc(lines, capacity * sizeof(char*));
+        }
+        lines[(*count)++] = strdup(line);
+    }
+    free(data);
+    return lines;
+}
+
+/*
+ * makeCommand
+ *
+ * Returns a newly allocated copy of 'template' with every "{}" replaced by
+ * 'argument', or with " argument" appended if it has no "{}".
+ */
+static char* makeCommand(const char* template, const char* argument) {
+    size_t      argumentLength = strlen(argument);
+    size_t      length         = strlen(template) + argumentLength + 2;
+    const char* p;
+    char*       command;
+    char*       out;
+
+    for (p = strstr(template, "{}"); p != NULL; p = strstr(p + 2, "{}")) {
+        length += argumentLength;
+    }
+    command = malloc(length);
+
+    if (strstr(template, "{}") == NULL) {
+        snprintf(command, length, "%s %s", template, argument);
+        return command;
+    }
+    for (p = template, out = command; *p != '\0';) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(out, argument, argumentLength);
+            out += argumentLength;
+            p   += 2;
+        } else {
+            *out++ = *p++;
+        }
+    }
+    *out = '\0';
+    return command;
+}
+
+/*
+ * startWorkers
+ *
+ * Connects to the remote agents given with -S (options up to args[first])
+ * and starts 'jobs' local ones (-1 for the default), but no more agents
+ * than there are tasks.
+ */
+static void startWorkers(ParallelRun* run, char** args, int first, long jobs) {
+    int i;
+
+    for (i = 1; i < first; i += 2) {
+        char* list;
+        char* endpoint;
+        char* save;
+
+        if (args[i][1] != 'S') {
+            continue;
+        }
+        list = args[i + 1];
+        if (jobs < 0) {
+            jobs = 0;
+        }
+        for (endpoint = strtok_r(list, ",", &save); endpoint != NULL;
+             endpoint = strtok_r(NULL, ",", &save)) {
+            int fd = connectAgent(endpoint);
+
+            if (fd >= 0 && !addWorker(run, endpoint, fd, -1)) {
+                shellClose(fd);
+            }
+        }
+    }
+    if (jobs < 0) {
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    for (; jobs > 0 && (size_t) run->workerCount < run->taskCount; --jobs) {
+        pid_t pid;
+        int   fd = spawnLocalAgent(&pid);
+
+        if (fd >= 0 && !addWorker(run, "local", fd, pid)) {
+            shellClose(fd);
+            waitpid(pid, NULL, 0);
+        }
+    }
+}
+
+/*
+ * addWorker
+ *
+ * Adds the agent connected on 'fd' to the pool.  Returns false, after
+ * printing a message, if it can't be.
+ */
+static bool addWorker(ParallelRun* run, const char* name, int fd, pid_t pid) {
+    Worker*            worker;
+    struct epoll_event event;
+
+    if (run->workerCount == PARALLEL_MAX_WORKERS) {
+        fprintf(stderr, "parallel: more than %d agents; %s not used\n",
+                PARALLEL_MAX_WORKERS, name);
+        return false;
+    }
+
+    worker = &run->workers[run->workerCount];
+    memset(worker, 0, sizeof(*worker));
+    worker->name = name;
+    worker->fd   = fd;
+    worker->pid  = pid;
+    worker->task = -1;
+
+    event.events   = EPOLLIN;
+    event.data.ptr = worker;
+    if (epoll_ctl(run->epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+    run->workerCount++;
+    run->active++;
+    return true;
+}
+
+/*
+ * dispatch
+ *
+ * Gives 'worker', which is ready, the task at the front of the queue, or
+ * leaves it idle if the queue is empty.
+ */
+static void dispatch(ParallelRun* run, Worker* worker) {
+    size_t task;
+
+    if (run->queueCount == 0) {
+        worker->idle = true;
+        return;
+    }
+
+    task           = run->queue[run->queueHead];
+    run->queueHead = (run->queueHead + 1) % run->taskCount;
+    run->queueCount--;
+
+    worker->idle = false;
+    worker->task = (long) task;
+    run->tasks[task].attempts++;
+    if (!sendFrame(worker->fd, FRAME_COMMAND, run->tasks[task].command,
+                   strlen(run->tasks[task].command))) {
+        fprintf(stderr, "parallel: lost agent %s\n", worker->name);
+        loseWorker(run, worker);
+    }
+}
+
+/*
+ * handleFrame
+ *
+ * Acts on one frame from 'worker'.
+ */
+static void handleFrame(ParallelRun* run, Worker* worker, const Frame* frame) {
+    ExitReport report;
+
+    switch (frame->type) {
+    case FRAME_READY:
+        dispatch(run, worker);
+        break;
+
+    case FRAME_STDOUT:
+    case FRAME_STDERR:
+        if (worker->task >= 0) {
+            capture(&run->tasks[worker->task].output[frame->type == FRAME_STDERR],
+                    frame->payload, frame->length);
+        }
+        break;
+
+    case FRAME_EXIT:
+        if (worker->task >= 0 && parseExitReport(frame, &report)) {
+            size_t task = (size_t) worker->task;
+
+            worker->task = -1;
+            finishTask(run, task, report.status);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * loseWorker
+ *
+ * Drops 'worker' from the pool (reaping it if it is local) and puts any
+ * task it was running back in the queue.
+ */
+static void loseWorker(ParallelRun* run, Worker* worker) {
+    epoll_ctl(run->epollFd, EPOLL_CTL_DEL, worker->fd, NULL);
+    shellClose(worker->fd);
+    worker->fd   = -1;
+    worker->idle = false;
+    freeFrameReader(&worker->reader);
+    if (worker->pid > 0) {
+        while (waitpid(worker->pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+    }
+    run->active--;
+
+    if (worker->task >= 0) {
+        size_t task = (size_t) worker->task;
+
+        worker->task = -1;
+        requeue(run, task);
+    }
+}
+
+/*
+ * requeue
+ *
+ * Puts 'task', whose agent went away, back at the front of the queue and
+ * hands it to an idle agent if there is one.  A task that has used up its
+ * retries fails instead.
+ */
+static void requeue(ParallelRun* run, size_t task) {
+    int i;
+
+    if (run->tasks[task].attempts > run->retries) {
+        fprintf(stderr, "parallel: giving up on '%s' after %d attempts\n",
+                run->tasks[task].command, run->tasks[task].attempts);
+        finishTask(run, task, 255);
+        return;
+    }
+
+    /* Anything it printed before the agent went will be printed again */
+    run->tasks[task].output[0].length = 0;
+    run->tasks[task].output[1].length = 0;
+
+    run->queueHead             = (run->queueHead + run->taskCount - 1) % run->taskCount;
+    run->queue[run->queueHead] = task;
+    run->queueCount++;
+
+    for (i = 0; i < run->workerCount; ++i) {
+        if (run->workers[i].fd >= 0 && run->workers[i].idle) {
+            dispatch(run, &run->workers[i]);
+            break;
+        }
+    }
+}
+
+/*
+ * finishTask
+ *
+ * Records the exit status of 'task' and prints whatever results are now
+ * in order.
+ */
+static void finishTask(ParallelRun* run, size_t task, int status) {
+    run->tasks[task].status = status;
+    run->tasks[task].done   = true;
+    run->completed++;
+    printResults(run);
+}
+
+/*
+ * printResults
+ *
+ * Prints the output of finished tasks, in task order, up to the first
+ * task that hasn't finished.
+ */
+static void printResults(ParallelRun* run) {
+    while (run->printed < run->taskCount && run->tasks[run->printed].done) {
+        Task* task = &run->tasks[run->printed++];
+
+        fwrite(task->output[0].data != NULL ? task->output[0].data : "", 1,
+               task->output[0].length, stdout);
+        fflush(stdout);
+        fwrite(task->output[1].data != NULL ? task->output[1].data : "", 1,
+               task->output[1].length, stderr);
+
+        free(task->output[0].data);
+        free(task->output[1].data);
+        memset(task->output, 0, sizeof(task->output));
+    }
+}
+
+/*
+ * capture
+ *
+ * Appends 'length' bytes of 'data' to 'capture'.
+ */
+static void capture(Capture* capture, const char* data, size_t length) {
+    if (capture->length + length > capture->capacity) {
+        capture->capacity = (capture->length + length) * 2;
+        capture->data     = realloc(capture->data, capture->capacity);
+    }
+    memcpy(capture->data + capture->length, data, length);
+    capture->length += length;
+}
@@ -0,0 +1,22 @@
+/*
+ * shellParallel.h
+ *
+ * The built-in 'parallel' command, which shares a list of tasks out among
+ * local and remote agents (see shellAgent.h).
+ */
+#ifndef SHELL_PARALLEL_H
+#define SHELL_PARALLEL_H
+
+/* Times a task is retried after the agent running it goes away */
+#define PARALLEL_RETRIES 3
+
+/* Most agents one 'parallel' may use */
+#define PARALLEL_MAX_WORKERS 256
+
+/* Bytes read from standard input at a time when it holds the arguments */
+#define PARALLEL_READ_SIZE (64 * 1024)
+
+/* Function prototypes */
+int  doParallel(char** args);
+
+#endif
@@ -15,6 +15,8 @@
 #define MAX_STRING_LENGTH 1024
 
 /* Function prototypes */
-char** getArgList(void);
+char**      getArgList(void);
+char**      getArgListFromString(const char* text);
+const char* getArgQuotes(void);
 
 #endif
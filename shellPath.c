@@ -0,0 +1,315 @@
+/*
+ * shellPath.c
+ *
+ * $PATH searching and the cache of missing commands (see shellPath.h).
+ *
+ * The first lookup with a given $PATH puts an inotify watch on each of its
+ * directories.  Before the cache is consulted, pending events are read
+ * (one non-blocking read(), which fails at once when there are none); any
+ * event means a command may have appeared, so every miss is forgotten.  If
+ * a directory goes away its watch goes with it, so the watches are set up
+ * again on the next lookup.  A directory that cannot be watched -- one that
+ * does not exist yet, or a relative one, which changes with the current
+ * directory -- makes misses expire after PATH_MISS_TTL seconds instead.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "shellPath.h"
+#include "shellFd.h"
+
+/* Events in a $PATH directory that may make a missing command appear */
+#define PATH_WATCH_EVENTS (IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF \
+                           | IN_MOVE_SELF | IN_ONLYDIR)
+
+/* A command name that was not found on $PATH */
+typedef struct {
+    char*         name;   /* NULL if the slot is free */
+    unsigned long hash;
+    time_t        when;   /* Monotonic seconds when it was looked for */
+} CommandMiss;
+
+static CommandMiss misses[PATH_MISS_CACHE_SIZE];
+static int         nextMiss = 0;  /* The oldest miss makes way for a new one */
+
+/* The inotify instance watching the directories of 'watchedPath' */
+static int   inotifyFd   = -1;
+static char* watchedPath = NULL;
+static bool  allWatched  = false;
+
+/* Function prototypes */
+static bool          searchPath(const char* path, const char* name, char* buffer,
+                                size_t size);
+static void          watchPath(const char* path);
+static void          unwatchPath(void);
+static void          readPathEvents(void);
+static bool          isMissing(const char* name, unsigned long hash);
+static void          addMiss(const char* name, unsigned long hash);
+static void          forgetMisses(void);
+static unsigned long hashName(const char* name);
+static time_t        monotonicSeconds(void);
+
+/*
+ * findCommand
+ *
+ * Finds the program a command called 'name' runs: 'name' itself if it
+ * contains a slash, otherwise the first executable file called 'name' in
+ * a $PATH directory, whose path is put in 'buffer' (of 'size' bytes).
+ *
+ * Returns the program's path, or NULL if there is none.
+ */
+const char* findCommand(const char* name, char* buffer, size_t size) {
+    const char*   path = getenv("PATH");
+    unsigned long hash;
+
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    if (name[0] == '\0') {
+        return NULL;
+    }
+    if (path == NULL) {
+        path = PATH_DEFAULT;
+    }
+
+    if (watchedPath == NULL || strcmp(watchedPath, path) != 0) {
+        unwatchPath();
+        forgetMisses();
+        watchPath(path);
+    }
+    readPathEvents();
+
+    hash = hashName(name);
+    if (isMissing(name, hash)) {
+        return NULL;
+    }
+    if (searchPath(path, name, buffer, size)) {
+        return buffer;
+    }
+    addMiss(name, hash);
+    return NULL;
+}
+
+/*
+ * forgetCommandCache
+ *
+ * For a child whose descriptors above standard error have been closed (see
+ * applyFdActions()): forgets the inotify instance and the misses it was
+ * keeping up to date.
+ */
+void forgetCommandCache(void) {
+    inotifyFd = -1;
+    free(watchedPath);
+    watchedPath = NULL;
+    forgetMisses();
+}
+
+/*
+ * searchPath
+ *
+ * Looks for an executable regular file called 'name' in the directories
+ * of 'path', as execvp() would; an empty entry means the current
+ * directory.  Puts its path in 'buffer' (of 'size' bytes).
+ *
+ * Returns true if there is one.
+ */
+static bool searchPath(const char* path, const char* name, char* buffer, size_t size) {
+    const char* dir = path;
+
+    for (;;) {
+        const char* end    = strchrnul(dir, ':');
+        int         length = (int) (end - dir);
+        struct stat info;
+        int         written;
+
+        if (length == 0) {
+            written = snprintf(buffer, size, "./%s", name);
+        } else {
+            written = snprintf(buffer, size, "%.*s/%s", length, dir, name);
+        }
+        if (written > 0 && (size_t) written < size && stat(buffer, &info) == 0
+                && S_ISREG(info.st_mode) && access(buffer, X_OK) == 0) {
+            return true;
+        }
+
+        if (*end == '\0') {
+            return false;
+        }
+        dir = end + 1;
+    }
+}
+
+/*
+ * watchPath
+ *
+ * Puts a watch on each directory of 'path', noting whether they all got
+ * one.
+ */
+static void watchPath(const char* path) {
+    const char* dir = path;
+
+    watchedPath = strdup(path);
+    allWatched  = true;
+
+    inotifyFd = keepFd(shellTrack(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)));
+    if (inotifyFd < 0) {
+        allWatched = false;
+        return;
+    }
+
+    for (;;) {
+        const char* end = strchrnul(dir, ':');
+        char*       copy;
+
+        if (dir[0] != '/') {
+            allWatched = false;  /* Relative, so it moves with the current directory */
+        } else {
+            copy = strndup(dir, (size_t) (end - dir));
+            if (inotify_add_watch(inotifyFd, copy, PATH_WATCH_EVENTS) < 0) {
+                allWatched = false;
+            }
+            free(copy);
+        }
+
+        if (*end == '\0') {
+            return;
+        }
+        dir = end + 1;
+    }
+}
+
+/*
+ * unwatchPath
+ *
+ * Removes every watch, so that the next lookup sets them up again.
+ */
+static void unwatchPath(void) {
+    if (inotifyFd >= 0) {
+        shellClose(inotifyFd);
+        inotifyFd = -1;
+    }
+    free(watchedPath);
+    watchedPath = NULL;
+}
+
+/*
+ * readPathEvents
+ *
+ * Reads pending inotify events.  Any at all forget every miss; a watched
+ * directory going away (or lost events) also has the watches set up
+ * again on the next lookup.
+ */
+static void readPathEvents(void) {
+    char    buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    bool    rewatch = false;
+
+    if (inotifyFd < 0) {
+        return;
+    }
+
+    while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+        char* next = buffer;
+
+        while (next < buffer + length) {
+            const struct inotify_event* event = (const struct inotify_event*) next;
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_Q_OVERFLOW)) {
+                rewatch = true;
+            }
+            next += sizeof(struct inotify_event) + event->len;
+        }
+        forgetMisses();
+    }
+
+    if (rewatch) {
+        unwatchPath();
+    }
+}
+
+/*
+ * isMissing
+ *
+ * Returns true if the command 'name' (whose hash is 'hash') is known to be
+ * missing.
+ */
+static bool isMissing(const char* name, unsigned long hash) {
+    int i;
+
+    for (i = 0; i < PATH_MISS_CACHE_SIZE; ++i) {
+        CommandMiss* miss = &misses[i];
+
+        if (miss->name != NULL && miss->hash == hash && strcmp(miss->name, name) == 0) {
+            if (!allWatched && monotonicSeconds() - miss->when >= PATH_MISS_TTL) {
+                free(miss->name);
+                miss->name = NULL;
+                return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * addMiss
+ *
+ * Remembers that the command 'name' (whose hash is 'hash') is missing.
+ */
+static void addMiss(const char* name, unsigned long hash) {
+    CommandMiss* miss = &misses[nextMiss];
+
+    nextMiss = (nextMiss + 1) % PATH_MISS_CACHE_SIZE;
+    free(miss->name);
+    miss->name = strdup(name);
+    miss->hash = hash;
+    miss->when = allWatched ? 0 : monotonicSeconds();
+}
+
+/*
+ * forgetMisses
+ *
+ * Forgets every missing command.
+ */
+static void forgetMisses(void) {
+    int i;
+
+    for (i = 0; i < PATH_MISS_CACHE_SIZE; ++i) {
+        free(misses[i].name);
+        misses[i].name = NULL;
+    }
+}
+
+/*
+ * hashName
+ *
+ * Returns the FNV-1a hash of 'name', so most misses are told apart without
+ * comparing strings.
+ */
+static unsigned long hashName(const char* name) {
+    unsigned long hash = 2166136261UL;
+
+    for (; *name != '\0'; ++name) {
+        hash = (hash ^ (unsigned char) *name) * 16777619UL;
+    }
+    return hash;
+}
+
+/*
+ * monotonicSeconds
+ *
+ * Returns the coarse monotonic clock in seconds (read without a system
+ * call).
+ */
+static time_t monotonicSeconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec;
+}
@@ -0,0 +1,28 @@
+/*
+ * shellPath.h
+ *
+ * Commands named without a slash are looked for in the directories on
+ * $PATH.  Names that were not found are remembered, so probing again for
+ * a missing command costs no system calls beyond one read() of an inotify
+ * descriptor that watches the $PATH directories: anything created,
+ * renamed or given new permissions in one of them forgets every miss.
+ */
+#ifndef SHELL_PATH_H
+#define SHELL_PATH_H
+
+#include <stddef.h>
+
+/* The search path when $PATH is not set */
+#define PATH_DEFAULT "/usr/local/bin:/usr/bin:/bin"
+
+/* Missing command names remembered */
+#define PATH_MISS_CACHE_SIZE 64
+
+/* Seconds a miss is trusted when some $PATH directory cannot be watched */
+#define PATH_MISS_TTL 1
+
+/* Function prototypes */
+const char* findCommand(const char* name, char* buffer, size_t size);
+void        forgetCommandCache(void);
+
+#endif
@@ -0,0 +1,507 @@
+/*
+ * shellRead.c
+ *
+ * The read-ahead buffers, 'read' and 'mapfile' (see shellRead.h).
+ *
+ * A buffer belongs to the file it was filled from, which is remembered by
+ * descriptor, device and inode.  The shell calls readFdsChanged() before it
+ * changes its own descriptors (a builtin's redirections, 'exec'), which
+ * gives back what was read ahead of seekable files and makes the next
+ * lookup check with fstat() which file each descriptor now refers to; in
+ * between, a lookup costs no system call at all.  A pipe's buffer is found
+ * again by its inode, so
+ *
+ *     read a; read b < file; read c
+ *
+ * carries on in the pipe where 'a' left off.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shellRead.h"
+#include "shellVars.h"
+
+/* The field separators when $IFS is not set */
+#define IFS_DEFAULT " \t\n"
+
+/* What has been read ahead of one file */
+typedef struct {
+    int           fd;        /* The descriptor it was last read through */
+    dev_t         dev;       /* The file, so a pipe's buffer can be found again */
+    ino_t         ino;
+    bool          seekable;
+    unsigned long checked;   /* 'fd' referred to the file in this generation */
+    unsigned long lastUse;   /* For least-recently-used replacement */
+    char*         data;      /* READ_BUFFER_SIZE bytes, once needed */
+    size_t        start;     /* First byte not yet handed out */
+    size_t        end;       /* One past the last byte read */
+} ReadBuffer;
+
+static ReadBuffer    readBuffers[READ_BUFFER_COUNT];
+static unsigned long fdGeneration = 1;  /* Bumped whenever the shell's descriptors change */
+static unsigned long useClock     = 0;
+
+/* The line being read, without its newline */
+static char*  lineText     = NULL;
+static size_t lineCapacity = 0;
+
+/* Function prototypes */
+static ReadBuffer* findReadBuffer(int fd);
+static ReadBuffer* claimReadBuffer(void);
+static void        giveBack(ReadBuffer* buffer);
+static bool        readLine(ReadBuffer* buffer, size_t* used, bool* complete);
+static void        growLine(size_t size);
+static bool        parseFd(const char* text, int* fd);
+static void        splitFields(char* line, char** names);
+static bool        isIfs(char c, const char* ifs);
+static bool        isIfsSpace(char c, const char* ifs);
+
+/*
+ * syncReadBuffers
+ *
+ * Gives back what was read ahead of seekable files, so that whatever reads
+ * from them next starts right after the last line handed out.
+ */
+void syncReadBuffers(void) {
+    int i;
+
+    for (i = 0; i < READ_BUFFER_COUNT; ++i) {
+        giveBack(&readBuffers[i]);
+    }
+}
+
+/*
+ * readFdsChanged
+ *
+ * To be called before the shell changes any of its descriptors: gives back
+ * what was read ahead of seekable files (see syncReadBuffers()), and has
+ * the next lookup find out which file each descriptor refers to.
+ */
+void readFdsChanged(void) {
+    syncReadBuffers();
+    fdGeneration++;
+}
+
+/*
+ * forgetReadBuffers
+ *
+ * For a child whose descriptors have been rearranged (see
+ * applyFdLayout()): forgets what the shell read ahead, which is the
+ * shell's to hand out.
+ */
+void forgetReadBuffers(void) {
+    int i;
+
+    for (i = 0; i < READ_BUFFER_COUNT; ++i) {
+        readBuffers[i].fd      = -1;
+        readBuffers[i].checked = 0;
+        readBuffers[i].start   = 0;
+        readBuffers[i].end     = 0;
+    }
+}
+
+/*
+ * doRead
+ *
+ * Implements the built-in 'read' command:
+ *
+ *     read [-r] [-u fd] [name ...]
+ *
+ * Reads a line from standard input (or 'fd') and splits it into fields at
+ * the characters in $IFS, setting each name to one field and the last to
+ * the rest of the line.  With no names the whole line goes into $REPLY.
+ * Without -r, a backslash quotes the next character and one at the end of
+ * a line joins the next line on.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns 0, or 1 if the end of the input came before a newline.
+ */
+int doRead(char** args) {
+    ReadBuffer* buffer;
+    size_t      used     = 0;
+    bool        raw      = false;
+    bool        complete = false;
+    int         fd       = 0;
+    int         i;
+    int         k;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-'; ++i) {
+        if (strcmp(args[i], "-r") == 0) {
+            raw = true;
+        } else if (strcmp(args[i], "-u") == 0 && parseFd(args[i + 1], &fd)) {
+            ++i;
+        } else {
+            printf("usage: read [-r] [-u fd] [name ...]\n");
+            return 1;
+        }
+    }
+    for (k = i; args[k] != NULL; ++k) {
+        if (!isVarName(args[k], strlen(args[k]))) {
+            fprintf(stderr, "read: %s: not a valid name\n", args[k]);
+            return 1;
+        }
+    }
+    if ((buffer = findReadBuffer(fd)) == NULL) {
+        perror("read");
+        return 1;
+    }
+
+    while (readLine(buffer, &used, &complete) && complete && !raw) {
+        size_t backslashes = 0;
+
+        while (backslashes < used && lineText[used - 1 - backslashes] == '\\') {
+            backslashes++;
+        }
+        if (backslashes % 2 == 0) {
+            break;
+        }
+        used--;  /* A continuation line */
+    }
+    growLine(used + 1);
+    lineText[used] = '\0';
+
+    if (!raw) {
+        char* from = lineText;
+        char* to   = lineText;
+
+        while (*from != '\0') {
+            if (*from == '\\' && from[1] != '\0') {
+                from++;
+            }
+            *to++ = *from++;
+        }
+        *to = '\0';
+    }
+
+    if (args[i] == NULL) {
+        setVar("REPLY", lineText);
+    } else {
+        splitFields(lineText, args + i);
+    }
+    return complete ? 0 : 1;
+}
+
+/*
+ * doMapfile
+ *
+ * Implements the built-in 'mapfile' command:
+ *
+ *     mapfile [-t] [-n count] [-u fd] [array]
+ *
+ * Reads the lines of standard input (or 'fd'), or the first 'count' of
+ * them, into the indexed array 'array' ($MAPFILE by default).  With -t the
+ * newline is left off each line.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command.
+ */
+int doMapfile(char** args) {
+    const char* name     = "MAPFILE";
+    bool        trim     = false;
+    long        limit    = 0;
+    int         fd       = 0;
+    char**      items    = NULL;
+    size_t      count    = 0;
+    size_t      capacity = 0;
+    ReadBuffer* buffer;
+    size_t      used;
+    bool        complete;
+    int         i;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-'; ++i) {
+        if (strcmp(args[i], "-t") == 0) {
+            trim = true;
+        } else if (strcmp(args[i], "-u") == 0 && parseFd(args[i + 1], &fd)) {
+            ++i;
+        } else if (strcmp(args[i], "-n") == 0 && args[i + 1] != NULL
+                   && (limit = atol(args[i + 1])) >= 0) {
+            ++i;
+        } else {
+            printf("usage: mapfile [-t] [-n count] [-u fd] [array]\n");
+            return 1;
+        }
+    }
+    if (args[i] != NULL) {
+        name = args[i];
+    }
+    if (!isVarName(name, strlen(name))) {
+        fprintf(stderr, "mapfile: %s: not a valid name\n", name);
+        return 1;
+    }
+    if ((buffer = findReadBuffer(fd)) == NULL) {
+        perror("mapfile");
+        return 1;
+    }
+
+    for (used = 0; (limit == 0 || count < (size_t) limit)
+                   && readLine(buffer, &used, &complete); used = 0) {
+        if (complete && !trim) {
+            growLine(used + 1);
+            lineText[used++] = '\n';
+        }
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            items    = realloc(items, capacity * sizeof(char*));
+        }
+        items[count++] = strndup(lineText, used);
+    }
+    return setArrayItems(name, items, count) ? 0 : 1;
+}
+
+/*
+ * findReadBuffer
+ *
+ * Returns the buffer for the file 'fd' refers to, or NULL (with errno set)
+ * if 'fd' is not open.
+ */
+static ReadBuffer* findReadBuffer(int fd) {
+    ReadBuffer* found = NULL;
+    struct stat info;
+    int         i;
+
+    for (i = 0; i < READ_BUFFER_COUNT && found == NULL; ++i) {
+        if (readBuffers[i].fd == fd && readBuffers[i].checked == fdGeneration) {
+            found = &readBuffers[i];
+        }
+    }
+
+    if (found == NULL) {
+        if (fstat(fd, &info) < 0) {
+            return NULL;
+        }
+        for (i = 0; i < READ_BUFFER_COUNT && found == NULL; ++i) {
+            ReadBuffer* buffer = &readBuffers[i];
+
+            if (!buffer->seekable && buffer->start < buffer->end
+                    && buffer->dev == info.st_dev && buffer->ino == info.st_ino) {
+                found = buffer;  /* The rest of a pipe */
+            }
+        }
+        if (found == NULL) {
+            found           = claimReadBuffer();
+            found->dev      = info.st_dev;
+            found->ino      = info.st_ino;
+            found->seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+        }
+        found->fd      = fd;
+        found->checked = fdGeneration;
+    }
+
+    /* Another descriptor for the file may share its offset (a dup), so it gives back first */
+    for (i = 0; i < READ_BUFFER_COUNT; ++i) {
+        ReadBuffer* other = &readBuffers[i];
+
+        if (other != found && other->seekable && other->dev == found->dev
+                && other->ino == found->ino) {
+            giveBack(other);
+        }
+    }
+
+    if (found->data == NULL && (found->data = malloc(READ_BUFFER_SIZE)) == NULL) {
+        return NULL;
+    }
+    found->lastUse = ++useClock;
+    return found;
+}
+
+/*
+ * claimReadBuffer
+ *
+ * Returns an empty buffer: the least recently used one holding nothing,
+ * or failing that the least recently used one, emptied.
+ */
+static ReadBuffer* claimReadBuffer(void) {
+    ReadBuffer* claimed = NULL;
+    int         i;
+
+    for (i = 0; i < READ_BUFFER_COUNT; ++i) {
+        ReadBuffer* buffer = &readBuffers[i];
+        bool        empty  = buffer->start == buffer->end;
+
+        if (claimed == NULL || (empty && claimed->start < claimed->end)
+                || (empty == (claimed->start == claimed->end)
+                    && buffer->lastUse < claimed->lastUse)) {
+            claimed = buffer;
+        }
+    }
+    giveBack(claimed);
+    claimed->start = 0;
+    claimed->end   = 0;
+    return claimed;
+}
+
+/*
+ * giveBack
+ *
+ * Empties 'buffer' if it holds part of a seekable file, moving the file
+ * offset back over what was read ahead.
+ */
+static void giveBack(ReadBuffer* buffer) {
+    if (!buffer->seekable || buffer->start == buffer->end) {
+        return;
+    }
+    if (buffer->checked == fdGeneration) {
+        lseek(buffer->fd, -(off_t) (buffer->end - buffer->start), SEEK_CUR);
+    }
+    buffer->start = 0;
+    buffer->end   = 0;
+}
+
+/*
+ * readLine
+ *
+ * Appends the next line from 'buffer', without its newline, to 'lineText'
+ * at '*used', advancing '*used'.  '*complete' says whether a newline ended
+ * it (rather than the end of the input).
+ *
+ * Returns false if there was nothing left to read.
+ */
+static bool readLine(ReadBuffer* buffer, size_t* used, bool* complete) {
+    bool any = false;
+
+    *complete = false;
+    for (;;) {
+        const char* data;
+        const char* newline;
+        size_t      take;
+
+        if (buffer->start == buffer->end) {
+            ssize_t count = read(buffer->fd, buffer->data, READ_BUFFER_SIZE);
+
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return any;
+            }
+            buffer->start = 0;
+            buffer->end   = (size_t) count;
+        }
+
+        data    = buffer->data + buffer->start;
+        newline = memchr(data, '\n', buffer->end - buffer->start);
+        take    = newline != NULL ? (size_t) (newline - data) : buffer->end - buffer->start;
+
+        growLine(*used + take + 1);
+        memcpy(lineText + *used, data, take);
+        *used         += take;
+        buffer->start += take;
+        any            = true;
+
+        if (newline != NULL) {
+            buffer->start++;
+            *complete = true;
+            return true;
+        }
+    }
+}
+
+/*
+ * growLine
+ *
+ * Makes room for at least 'size' bytes in 'lineText'.
+ */
+static void growLine(size_t size) {
+    if (size > lineCapacity) {
+        lineCapacity = size * 2;
+        lineText     = realloc(lineText, lineCapacity);
+    }
+}
+
+/*
+ * parseFd
+ *
+ * Sets '*fd' to the descriptor number 'text' (which may be NULL) gives.
+ *
+ * Returns false if it is not one.
+ */
+static bool parseFd(const char* text, int* fd) {
+    char* end;
+    long  value;
+
+    if (text == NULL) {
+        return false;
+    }
+    value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 0 || value > 1024) {
+        return false;
+    }
+    *fd = (int) value;
+    return true;
+}
+
+/*
+ * splitFields
+ *
+ * Sets each of 'names' (NULL-terminated) to the next field of 'line', and
+ * the last to the rest of it.  Fields are separated by runs of $IFS
+ * blanks, or by one other $IFS character with blanks around it; blanks at
+ * either end of the line are dropped.
+ */
+static void splitFields(char* line, char** names) {
+    const char* ifs = getVar("IFS", 3);
+    char*       p   = line;
+    char*       end;
+    int         i;
+
+    if (ifs == NULL) {
+        ifs = IFS_DEFAULT;
+    }
+    while (isIfsSpace(*p, ifs)) {
+        p++;
+    }
+
+    for (i = 0; names[i + 1] != NULL; ++i) {
+        char* start = p;
+        char  saved;
+
+        while (*p != '\0' && !isIfs(*p, ifs)) {
+            p++;
+        }
+        saved = *p;
+        *p    = '\0';
+        setVar(names[i], start);
+        *p    = saved;
+
+        while (isIfsSpace(*p, ifs)) {
+            p++;
+        }
+        if (isIfs(*p, ifs)) {
+            p++;
+            while (isIfsSpace(*p, ifs)) {
+                p++;
+            }
+        }
+    }
+
+    for (end = p + strlen(p); end > p && isIfsSpace(end[-1], ifs); --end) {
+    }
+    *end = '\0';
+    setVar(names[i], p);
+}
+
+/*
+ * isIfs
+ *
+ * Returns true if 'c' is one of the field separators 'ifs'.
+ */
+static bool isIfs(char c, const char* ifs) {
+    return c != '\0' && strchr(ifs, c) != NULL;
+}
+
+/*
+ * isIfsSpace
+ *
+ * Returns true if 'c' is a blank (space, tab or newline) among the field
+ * separators 'ifs'.
+ */
+static bool isIfsSpace(char c, const char* ifs) {
+    return (c == ' ' || c == '\t' || c == '\n') && isIfs(c, ifs);
+}
@@ -0,0 +1,28 @@
+/*
+ * shellRead.h
+ *
+ * The built-in 'read' and 'mapfile' commands.  Rather than reading a byte
+ * at a time so as never to take more than a line, they read ahead into a
+ * buffer the shell keeps for the file and hand lines out of it.  Before
+ * the shell's descriptors change, or anything else gets to read from
+ * them, what was read ahead of a seekable file is given back with lseek().
+ * What was read ahead from a pipe or terminal cannot be given back; it
+ * stays with the shell for the next 'read' from that pipe.
+ */
+#ifndef SHELL_READ_H
+#define SHELL_READ_H
+
+/* Bytes read ahead at a time */
+#define READ_BUFFER_SIZE (64 * 1024)
+
+/* Files read ahead of at once */
+#define READ_BUFFER_COUNT 4
+
+/* Function prototypes */
+void syncReadBuffers(void);
+void readFdsChanged(void);
+void forgetReadBuffers(void);
+int  doRead(char** args);
+int  doMapfile(char** args);
+
+#endif
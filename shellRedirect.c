@@ -0,0 +1,812 @@
+/*
+ * shellRedirect.c
+ *
+ * Parses redirection operators of the general form
+ *
+ *     [n]>file  [n]>>file  [n]<file  [n]<>file  [n]>&m  [n]<&m  [n]>&-
+ *     &>file    &>>file
+ *
+ * into FdActionLists (see shellRedirect.h), and carries those lists out.
+ *
+ * Rather than performing an open/dup2/close per redirection, a child first
+ * works out the complete descriptor layout it needs (planFdLayout), then
+ * establishes it with one dup3() per descriptor that actually changes,
+ * breaking cycles such as 3>&1 1>&2 2>&3 with a single temporary, and
+ * finally drops everything else it inherited with close_range().
+ *
+ * Redirections given to 'exec' on their own are instead carried out in the
+ * shell, and stay: the descriptors (3-9; the shell keeps its own above
+ * those) are close-on-exec there, and each command's layout starts by
+ * keeping them, so every command inherits them as if they had been
+ * redirected on its own line.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "shellRedirect.h"
+#include "shellFd.h"
+#include "shellDirs.h"
+#include "shellAppend.h"
+#include "shellRead.h"
+
+/* Descriptors >= 3 set up by 'exec' redirections */
+static bool shellFds[FD_SHELL_BASE];
+
+/* Function prototypes */
+static const char* parseFdNumber(const char* text, int* fd);
+static bool        appendAction(FdActionList* list, FdActionType type, int fd,
+                                int srcFd, int flags, const char* path);
+static FdMove*     findMove(FdLayout* layout, int target);
+static bool        isPendingSource(const FdLayout* layout, const bool* done,
+                                   int fd);
+static int         layoutTop(const FdLayout* layout);
+static void        closeUnused(const FdLayout* layout);
+static void        closeFdRange(unsigned int first, unsigned int last);
+static void        failInChild(const char* call);
+static bool        installShellFd(int fd, int source);
+
+/*
+ * isRedirection
+ *
+ * Returns true if 'token' is one of the redirection operators produced by
+ * the scanner.
+ */
+bool isRedirection(const char* token) {
+    const char* op = token;
+
+    if (op[0] == '&') {
+        return strcmp(op, "&>") == 0 || strcmp(op, "&>>") == 0;
+    }
+
+    while (isdigit((unsigned char) *op)) {
+        ++op;
+    }
+    if (*op != '<' && *op != '>') {
+        return false;
+    }
+
+    if (op[1] == '\0') {
+        return true;                              /* [n]< or [n]> */
+    } else if (op[1] == '&') {
+        int fd;
+
+        if (strcmp(op + 2, "-") == 0) {
+            return true;                          /* [n]>&- */
+        }
+        return *parseFdNumber(op + 2, &fd) == '\0' && fd >= 0;
+    }
+    return op[2] == '\0' && ((op[0] == '>' && op[1] == '>')   /* [n]>> */
+                          || (op[0] == '<' && op[1] == '>'));  /* [n]<> */
+}
+
+/*
+ * redirectionNeedsTarget
+ *
+ * Returns true if the redirection operator 'token' is followed by a file
+ * name; the duplicating and closing forms (>&m, >&-) carry their target in
+ * the operator itself.
+ */
+bool redirectionNeedsTarget(const char* token) {
+    return strchr(token + 1, '&') == NULL;
+}
+
+/*
+ * addRedirection
+ *
+ * Compiles the redirection operator 'op' (and, for the forms that take
+ * one, the file name 'target') into actions appended to 'list'.
+ *
+ * Returns false, after printing a message, if the redirection is malformed.
+ */
+bool addRedirection(FdActionList* list, const char* op, const char* target) {
+    int fd = -1;
+
+    if (redirectionNeedsTarget(op) && target == NULL) {
+        fprintf(stderr, "syntax error: missing file name after '%s'\n", op);
+        return false;
+    }
+
+    if (op[0] == '&') { /* &> and &>> send both stdout and stderr to a file */
+        int flags = O_WRONLY | O_CREAT | (op[2] == '>' ? O_APPEND : O_TRUNC);
+
+        return appendAction(list, FD_OPEN,  STDOUT_FILENO, -1, flags, target)
+            && appendAction(list, FD_DUP,   STDERR_FILENO, STDOUT_FILENO, 0, NULL);
+    }
+
+    op = parseFdNumber(op, &fd);
+    if (fd == INT_MAX) {
+        fprintf(stderr, "bad file descriptor in redirection\n");
+        return false;
+    }
+
+    if (op[1] == '&') {
+        int srcFd;
+
+        if (fd < 0) {
+            fd = (op[0] == '<') ? STDIN_FILENO : STDOUT_FILENO;
+        }
+        if (op[2] == '-') {
+            return appendAction(list, FD_CLOSE, fd, -1, 0, NULL);
+        }
+
+        parseFdNumber(op + 2, &srcFd);
+        if (srcFd == INT_MAX) {
+            fprintf(stderr, "bad file descriptor in redirection\n");
+            return false;
+        }
+        return appendAction(list, FD_DUP, fd, srcFd, 0, NULL);
+
+    } else if (op[0] == '<' && op[1] == '>') {
+        return appendAction(list, FD_OPEN, fd < 0 ? STDIN_FILENO : fd, -1,
+                            O_RDWR | O_CREAT, target);
+
+    } else if (op[0] == '<') {
+        return appendAction(list, FD_OPEN, fd < 0 ? STDIN_FILENO : fd, -1,
+                            O_RDONLY, target);
+
+    } else if (op[1] == '>') {
+        return appendAction(list, FD_OPEN, fd < 0 ? STDOUT_FILENO : fd, -1,
+                            O_WRONLY | O_CREAT | O_APPEND, target);
+    }
+
+    return appendAction(list, FD_OPEN, fd < 0 ? STDOUT_FILENO : fd, -1,
+                        O_WRONLY | O_CREAT | O_TRUNC, target);
+}
+
+/*
+ * addFdDup
+ *
+ * Appends an action making 'fd' a copy of 'srcFd' (as if "fd>&srcFd" had
+ * been written) to 'list'.  Used for connecting pipes ahead of a command's
+ * own redirections.
+ *
+ * Returns false, after printing a message, if the list is full.
+ */
+bool addFdDup(FdActionList* list, int fd, int srcFd) {
+    return appendAction(list, FD_DUP, fd, srcFd, 0, NULL);
+}
+
+/*
+ * appendFdActions
+ *
+ * Appends all of the actions in 'more' to the end of 'list'.
+ *
+ * Returns false, after printing a message, if 'list' fills up.
+ */
+bool appendFdActions(FdActionList* list, const FdActionList* more) {
+    int i;
+
+    for (i = 0; i < more->count; ++i) {
+        if (list->count >= MAX_ARGS) {
+            fprintf(stderr, "too many redirections\n");
+            return false;
+        }
+        list->actions[list->count++] = more->actions[i];
+    }
+    return true;
+}
+
+/*
+ * planFdLayout
+ *
+ * Works out the descriptor table that carrying out 'list' in order would
+ * produce, without changing any existing descriptor.  Files are opened
+ * (close-on-exec, wherever the kernel puts them, relative to the shell's
+ * cached directory descriptors) and become the sources of moves;
+ * duplications and closes only rewrite the plan.
+ *
+ * The files opened are recorded in the layout; a process that plans a
+ * layout for someone else (the shell, for its children) closes them with
+ * releaseFdLayout() once the child has it.
+ *
+ * Returns false, after printing a message and closing whatever it opened,
+ * if a file cannot be opened or a redirection copies a descriptor that is
+ * not open.
+ */
+bool planFdLayout(const FdActionList* list, FdLayout* layout) {
+    int* opened = layout->opened;  /* Never user-visible */
+    int  i;
+
+    layout->count       = 0;
+    layout->openedCount = 0;
+    layout->keep        = -1;
+
+    for (i = 0; i < list->count; ++i) {
+        const FdAction* action = &list->actions[i];
+        FdMove*         move   = findMove(layout, action->fd);
+        int             source = -1;
+
+        if (action->type == FD_OPEN) {
+            source = openRedirectCached(action->path, action->flags);
+            if (source < 0) {
+                perror(action->path);
+                releaseFdLayout(layout);
+                return false;
+            }
+            opened[layout->openedCount++] = source;
+
+        } else if (action->type == FD_DUP) {
+            FdMove* from = findMove(layout, action->srcFd);
+            int     k;
+
+            if (from != NULL) {
+                source = from->source;
+            } else {
+                /* Not redirected yet, so it refers to one we inherited */
+                source = action->srcFd;
+                for (k = 0; k < layout->openedCount; ++k) {
+                    if (opened[k] == source) {
+                        source = -1;
+                    }
+                }
+                if (source >= 0 && fcntl(source, F_GETFD) < 0) {
+                    source = -1;
+                }
+            }
+            if (source < 0) {
+                fprintf(stderr, "%d: bad file descriptor\n", action->srcFd);
+                releaseFdLayout(layout);
+                return false;
+            }
+        }
+
+        if (move == NULL) {
+            move = &layout->moves[layout->count++];
+            move->target = action->fd;
+        }
+        move->source = source;
+    }
+
+    return true;
+}
+
+/*
+ * applyFdLayout
+ *
+ * Establishes 'layout' in the calling process and closes every other
+ * descriptor >= 3 except 'layout->keep' (moved out of the way first if the
+ * layout needs its number; it stays close-on-exec).  Moves are ordered so
+ * that no descriptor is overwritten while it is still needed as a source;
+ * when only cycles remain, one source of the cycle is parked on a
+ * temporary descriptor.  Intended to be called in a child just before
+ * exec; on failure an appropriate message is printed and the process
+ * terminates.
+ *
+ * Nothing here allocates or uses stdio, so it is safe in a child that
+ * shares the parent's memory (vfork) or was forked by a signal handler.
+ *
+ * The layout is modified (sources are renamed when cycles are broken).
+ */
+void applyFdLayout(FdLayout* layout) {
+    bool done[MAX_ARGS] = { false };
+    int  remaining      = layout->count;
+    int  i;
+
+    if (layout->keep >= 0 && findMove(layout, layout->keep) != NULL) {
+        layout->keep = fcntl(layout->keep, F_DUPFD_CLOEXEC, layoutTop(layout));
+        if (layout->keep < 0) {
+            failInChild("fcntl");
+        }
+    }
+
+    while (remaining > 0) {
+        bool progress = false;
+
+        for (i = 0; i < layout->count; ++i) {
+            FdMove* move = &layout->moves[i];
+
+            if (done[i] || isPendingSource(layout, done, move->target)) {
+                continue;
+            }
+
+            if (move->source < 0) {
+                /* Anything >= 3 is taken care of by closeUnused() */
+                if (move->target < 3) {
+                    close(move->target);
+                }
+            } else if (move->source == move->target) {
+                /* Already in place, but may be marked close-on-exec */
+                fcntl(move->target, F_SETFD, 0);
+            } else if (dup3(move->source, move->target, 0) < 0) {
+                failInChild("dup3");
+            }
+
+            done[i]  = true;
+            progress = true;
+            remaining--;
+        }
+
+        if (!progress) {
+            /* Every remaining move is part of a cycle; park one source */
+            int parked = -1;
+            int source = -1;
+            int above  = layoutTop(layout);
+
+            for (i = 0; i < layout->count && parked < 0; ++i) {
+                if (!done[i] && layout->moves[i].source >= 0) {
+                    source = layout->moves[i].source;
+                    parked = fcntl(source, F_DUPFD_CLOEXEC, above);
+                }
+            }
+            if (parked < 0) {
+                failInChild("fcntl");
+            }
+            for (i = 0; i < layout->count; ++i) {
+                if (!done[i] && layout->moves[i].source == source) {
+                    layout->moves[i].source = parked;
+                }
+            }
+        }
+    }
+
+    closeUnused(layout);
+}
+
+/*
+ * releaseFdLayout
+ *
+ * Closes the files planFdLayout() opened for 'layout', or hands them back
+ * to the append cache.
+ */
+void releaseFdLayout(FdLayout* layout) {
+    int i;
+
+    for (i = 0; i < layout->openedCount; ++i) {
+        if (!releaseAppendFd(layout->opened[i])) {
+            shellClose(layout->opened[i]);
+        }
+    }
+    layout->openedCount = 0;
+}
+
+/*
+ * pushFdLayout
+ *
+ * Establishes 'layout' over the shell's own descriptors, for a builtin
+ * that runs in the shell with redirections, saving what each target was in
+ * 'backup' so popFdLayout() can put it back.  Every source refers to the
+ * descriptors as they were before the layout (see planFdLayout()), so one
+ * that is also a target is read from its saved copy, and cycles need no
+ * special care.  Descriptors the layout leaves alone stay open.
+ *
+ * Returns false, having changed nothing, if the layout replaces one of the
+ * shell's descriptors (FD_SHELL_BASE and above) or (after printing a
+ * message) one cannot be saved.
+ */
+bool pushFdLayout(const FdLayout* layout, FdBackup* backup) {
+    int i;
+    int k;
+
+    backup->count = 0;
+    for (i = 0; i < layout->count; ++i) {
+        if (layout->moves[i].target >= FD_SHELL_BASE) {
+            return false;
+        }
+    }
+
+    /* What builtins wrote so far goes where standard output went so far */
+    fflush(stdout);
+    readFdsChanged();
+
+    for (i = 0; i < layout->count; ++i) {
+        const FdMove* move = &layout->moves[i];
+        int           saved;
+
+        if (move->source == move->target) {
+            continue;
+        }
+        saved = shellTrack(fcntl(move->target, F_DUPFD_CLOEXEC, FD_SHELL_BASE));
+        if (saved < 0 && errno != EBADF) {
+            perror("fcntl");
+            popFdLayout(backup);
+            return false;
+        }
+        backup->targets[backup->count] = move->target;
+        backup->saved[backup->count++] = saved;
+    }
+
+    for (i = 0; i < layout->count; ++i) {
+        const FdMove* move   = &layout->moves[i];
+        int           source = move->source;
+
+        if (source == move->target) {
+            continue;
+        }
+        for (k = 0; k < backup->count; ++k) {
+            if (backup->targets[k] == source) {
+                source = backup->saved[k];
+            }
+        }
+        if (source < 0) {
+            close(move->target);
+        } else {
+            dup3(source, move->target, move->target > STDERR_FILENO ? O_CLOEXEC : 0);
+        }
+    }
+    return true;
+}
+
+/*
+ * popFdLayout
+ *
+ * Puts back the descriptors pushFdLayout() replaced, as saved in 'backup'.
+ */
+void popFdLayout(FdBackup* backup) {
+    int i;
+
+    fflush(stdout);
+    readFdsChanged();
+
+    for (i = 0; i < backup->count; ++i) {
+        int target = backup->targets[i];
+
+        if (backup->saved[i] < 0) {
+            close(target);
+        } else {
+            dup3(backup->saved[i], target, target > STDERR_FILENO ? O_CLOEXEC : 0);
+            shellClose(backup->saved[i]);
+        }
+    }
+    backup->count = 0;
+}
+
+/*
+ * applyFdActions
+ *
+ * Plans and establishes the descriptor layout described by 'list' (see
+ * planFdLayout() and applyFdLayout()).  Intended to be called in a child
+ * just before exec; on failure the process terminates.
+ */
+void applyFdActions(const FdActionList* list) {
+    FdLayout layout;
+
+    if (!planFdLayout(list, &layout)) {
+        _exit(1);
+    }
+    applyFdLayout(&layout);
+}
+
+/*
+ * applyShellRedirections
+ *
+ * Carries out 'list' in the shell itself ('exec' with only redirections),
+ * so that the descriptors stay open for the commands that follow (see
+ * addShellFds()).  Only descriptors below FD_SHELL_BASE may be set up;
+ * those used by the shell are above it.
+ *
+ * Returns false, after printing a message, if a redirection fails; the
+ * ones before it stay in effect.
+ */
+bool applyShellRedirections(const FdActionList* list) {
+    int i;
+
+    /* What builtins wrote so far goes where standard output went so far */
+    fflush(stdout);
+    readFdsChanged();
+
+    for (i = 0; i < list->count; ++i) {
+        const FdAction* action = &list->actions[i];
+
+        if (action->fd >= FD_SHELL_BASE) {
+            fprintf(stderr, "exec: %d: only descriptors 0-%d can be kept\n",
+                    action->fd, FD_SHELL_BASE - 1);
+            return false;
+        }
+
+        if (action->type == FD_OPEN) {
+            int source = openRedirectTarget(action->path, action->flags, REDIRECT_MODE);
+
+            if (source < 0) {
+                perror(action->path);
+                return false;
+            }
+            if (!installShellFd(action->fd, source)) {
+                shellClose(source);
+                return false;
+            }
+            if (source != action->fd) {
+                shellClose(source);
+            }
+
+        } else if (action->type == FD_DUP) {
+            if (action->srcFd >= FD_SHELL_BASE || fcntl(action->srcFd, F_GETFD) < 0) {
+                fprintf(stderr, "%d: bad file descriptor\n", action->srcFd);
+                return false;
+            }
+            if (!installShellFd(action->fd, action->srcFd)) {
+                return false;
+            }
+
+        } else {
+            if (action->fd >= 3) {
+                shellFds[action->fd] = false;
+                shellClose(action->fd);
+            } else {
+                close(action->fd);
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * addShellFds
+ *
+ * Appends an action keeping each descriptor set up by 'exec' to 'list',
+ * ahead of a command's pipes and own redirections.  Ones no longer open
+ * (in a child that closed them, such as an agent) are forgotten.
+ *
+ * Returns false, after printing a message, if the list is full.
+ */
+bool addShellFds(FdActionList* list) {
+    int fd;
+
+    for (fd = 3; fd < FD_SHELL_BASE; ++fd) {
+        if (shellFds[fd] && fcntl(fd, F_GETFD) < 0) {
+            shellFds[fd] = false;
+        }
+        if (shellFds[fd] && !addFdDup(list, fd, fd)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * addSpawnFileActions
+ *
+ * Translates 'list' into the equivalent posix_spawn file actions.
+ *
+ * Returns 0 on success or an error number from posix_spawn_file_actions_*.
+ */
+int addSpawnFileActions(const FdActionList* list,
+                        posix_spawn_file_actions_t* fileActions) {
+    int i;
+    int error = 0;
+
+    for (i = 0; i < list->count && error == 0; ++i) {
+        const FdAction* action = &list->actions[i];
+
+        switch (action->type) {
+        case FD_OPEN:
+            error = posix_spawn_file_actions_addopen(fileActions, action->fd,
+                                                     action->path,
+                                                     action->flags,
+                                                     REDIRECT_MODE);
+            break;
+
+        case FD_DUP:
+            error = posix_spawn_file_actions_adddup2(fileActions,
+                                                     action->srcFd, action->fd);
+            break;
+
+        case FD_CLOSE:
+            error = posix_spawn_file_actions_addclose(fileActions, action->fd);
+            break;
+        }
+    }
+
+    return error;
+}
+
+/*
+ * parseFdNumber
+ *
+ * Reads an optional decimal descriptor number from the start of 'text'.
+ * '*fd' is set to the number, -1 if there are no digits, or INT_MAX if the
+ * number is out of range.
+ *
+ * Returns a pointer to the first character after the digits.
+ */
+static const char* parseFdNumber(const char* text, int* fd) {
+    long value = -1;
+
+    while (isdigit((unsigned char) *text)) {
+        value = (value < 0 ? 0 : value) * 10 + (*text - '0');
+        if (value >= INT_MAX) {
+            value = INT_MAX;
+        }
+        ++text;
+    }
+
+    *fd = (int) value;
+    return text;
+}
+
+/*
+ * appendAction
+ *
+ * Appends one action to 'list'.
+ *
+ * Returns false, after printing a message, if the list is full.
+ */
+static bool appendAction(FdActionList* list, FdActionType type, int fd,
+                         int srcFd, int flags, const char* path) {
+    FdAction* action;
+
+    if (list->count >= MAX_ARGS) {
+        fprintf(stderr, "too many redirections\n");
+        return false;
+    }
+
+    action         = &list->actions[list->count++];
+    action->type   = type;
+    action->fd     = fd;
+    action->srcFd  = srcFd;
+    action->flags  = flags;
+    action->path   = path;
+    return true;
+}
+
+/*
+ * findMove
+ *
+ * Returns the move in 'layout' whose target is 'target', or NULL if that
+ * descriptor is not (yet) part of the layout.
+ */
+static FdMove* findMove(FdLayout* layout, int target) {
+    int i;
+
+    for (i = 0; i < layout->count; ++i) {
+        if (layout->moves[i].target == target) {
+            return &layout->moves[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * isPendingSource
+ *
+ * Returns true if 'fd' is still needed as the source of a move that has not
+ * been carried out yet (other than a move onto itself).
+ */
+static bool isPendingSource(const FdLayout* layout, const bool* done, int fd) {
+    int i;
+
+    for (i = 0; i < layout->count; ++i) {
+        const FdMove* move = &layout->moves[i];
+
+        if (!done[i] && move->source == fd && move->target != fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * layoutTop
+ *
+ * Returns the lowest descriptor (>= 3) above every one 'layout' mentions,
+ * where a temporary can be put without getting in the way.
+ */
+static int layoutTop(const FdLayout* layout) {
+    int above = 3;
+    int i;
+
+    for (i = 0; i < layout->count; ++i) {
+        if (layout->moves[i].target >= above) {
+            above = layout->moves[i].target + 1;
+        }
+        if (layout->moves[i].source >= above) {
+            above = layout->moves[i].source + 1;
+        }
+    }
+    if (layout->keep >= above) {
+        above = layout->keep + 1;
+    }
+    return above;
+}
+
+/*
+ * closeUnused
+ *
+ * Closes every descriptor >= 3 that is not a target of 'layout' (or its
+ * 'keep'), using one close_range() per gap between the descriptors being
+ * kept.
+ */
+static void closeUnused(const FdLayout* layout) {
+    unsigned int first = 3;
+
+    for (;;) {
+        unsigned int next = ~0U;  /* Lowest kept descriptor >= first */
+        int          i;
+
+        if (layout->keep >= 0 && (unsigned int) layout->keep >= first) {
+            next = (unsigned int) layout->keep;
+        }
+
+        for (i = 0; i < layout->count; ++i) {
+            const FdMove* move = &layout->moves[i];
+
+            if (move->source >= 0 && (unsigned int) move->target >= first
+                    && (unsigned int) move->target < next) {
+                next = (unsigned int) move->target;
+            }
+        }
+
+        if (next == ~0U) {
+            closeFdRange(first, ~0U);
+            return;
+        }
+        if (next > first) {
+            closeFdRange(first, next - 1);
+        }
+        first = next + 1;
+    }
+}
+
+/*
+ * closeFdRange
+ *
+ * Closes descriptors 'first' through 'last' inclusive, with close_range()
+ * where the kernel has it.
+ */
+static void closeFdRange(unsigned int first, unsigned int last) {
+    long limit;
+
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, first, last, 0) == 0) {
+        return;
+    }
+#endif
+
+    /* Older kernels: close them one at a time */
+    limit = sysconf(_SC_OPEN_MAX);
+    if (limit < 0 || (unsigned long) limit > last) {
+        limit = (long) last + 1;
+    }
+    for (; (long) first < limit; ++first) {
+        close((int) first);
+    }
+}
+
+/*
+ * failInChild
+ *
+ * Reports that 'call' failed and terminates the (child) process, using
+ * nothing but write() and _exit().
+ */
+static void failInChild(const char* call) {
+    static const char failed[] = ": failed\n";
+
+    write(STDERR_FILENO, call, strlen(call));
+    write(STDERR_FILENO, failed, sizeof(failed) - 1);
+    _exit(1);
+}
+
+/*
+ * installShellFd
+ *
+ * Makes the shell's descriptor 'fd' a copy of 'source' for good: inherited
+ * as usual if it is a standard one, otherwise close-on-exec and kept for
+ * the commands by addShellFds().
+ *
+ * Returns false, after printing a message, if it cannot be.
+ */
+static bool installShellFd(int fd, int source) {
+    int flags = fd >= 3 ? O_CLOEXEC : 0;
+
+    if (source == fd) {
+        fcntl(fd, F_SETFD, flags != 0 ? FD_CLOEXEC : 0);
+    } else if (dup3(source, fd, flags) < 0) {
+        perror("dup3");
+        return false;
+    }
+
+    if (fd >= 3) {
+        shellFds[fd] = true;
+        markUserFd(fd);
+    }
+    return true;
+}
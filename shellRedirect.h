@@ -0,0 +1,83 @@
+/*
+ * shellRedirect.h
+ *
+ * Redirections are compiled into a per-command list of file descriptor
+ * actions.  The list can either be handed to posix_spawn() as a set of file
+ * actions, or planned into a final descriptor layout (FdLayout) that a child
+ * establishes with as few system calls as possible.
+ */
+#ifndef SHELL_REDIRECT_H
+#define SHELL_REDIRECT_H
+
+#include <stdbool.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include "shellParser.h"
+
+/* Permissions for files created by output redirections (before umask) */
+#define REDIRECT_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
+
+/* The kinds of things a redirection can do to a file descriptor */
+typedef enum {
+    FD_OPEN,  /* open 'path' with 'flags' as 'fd'  -- [n]> [n]>> [n]< [n]<> */
+    FD_DUP,   /* make 'fd' a copy of 'srcFd'        -- [n]>&m [n]<&m        */
+    FD_CLOSE  /* close 'fd'                         -- [n]>&- [n]<&-        */
+} FdActionType;
+
+typedef struct {
+    FdActionType type;
+    int          fd;     /* The descriptor being set up */
+    int          srcFd;  /* FD_DUP: the descriptor to copy */
+    int          flags;  /* FD_OPEN: flags for open(2) */
+    const char*  path;   /* FD_OPEN: the file to open (not owned) */
+} FdAction;
+
+/* The redirections of a single command, in the order they were written */
+typedef struct {
+    FdAction actions[MAX_ARGS];
+    int      count;
+} FdActionList;
+
+/* One descriptor of a child's final layout: 'target' is a copy of 'source' */
+typedef struct {
+    int target;
+    int source;  /* -1 if 'target' is to be closed */
+} FdMove;
+
+/*
+ * The descriptor table a child should end up with.  Every descriptor >= 3
+ * that is not the target of a move is closed.
+ */
+typedef struct {
+    FdMove moves[MAX_ARGS];
+    int    count;
+    int    opened[MAX_ARGS];  /* Files planFdLayout() opened as sources */
+    int    openedCount;
+    int    keep;              /* Also left open (close-on-exec), or -1 */
+} FdLayout;
+
+/* The shell's own descriptors a layout replaced (see pushFdLayout()) */
+typedef struct {
+    int targets[MAX_ARGS];
+    int saved[MAX_ARGS];  /* A copy of what 'target' was, or -1 if it was closed */
+    int count;
+} FdBackup;
+
+/* Function prototypes */
+bool isRedirection(const char* token);
+bool redirectionNeedsTarget(const char* token);
+bool addRedirection(FdActionList* list, const char* op, const char* target);
+bool addFdDup(FdActionList* list, int fd, int srcFd);
+bool appendFdActions(FdActionList* list, const FdActionList* more);
+bool planFdLayout(const FdActionList* list, FdLayout* layout);
+void applyFdLayout(FdLayout* layout);
+void releaseFdLayout(FdLayout* layout);
+bool pushFdLayout(const FdLayout* layout, FdBackup* backup);
+void popFdLayout(FdBackup* backup);
+void applyFdActions(const FdActionList* list);
+bool applyShellRedirections(const FdActionList* list);
+bool addShellFds(FdActionList* list);
+int  addSpawnFileActions(const FdActionList* list,
+                         posix_spawn_file_actions_t* fileActions);
+
+#endif
@@ -0,0 +1,554 @@
+/*
+ * shellSandbox.c
+ *
+ * Implements the 'sandbox' prefix:
+ *
+ *     sandbox command [argument ...]
+ *
+ * Creating namespaces and setting up mounts is the slow part of isolating
+ * a command, so it is done ahead of time by zygotes: background processes
+ * that each enter a fresh set of namespaces, make every mount read-only,
+ * put a tmpfs on /tmp and then wait on a socket.  'sandbox' sends one of
+ * them the command, its directory and its standard descriptors; the zygote
+ * starts it with clone3() (it becomes PID 1 of the new PID namespace),
+ * reports back and, when it finishes, sends its exit status and exits.
+ * Each zygote runs one command, so nothing is shared between commands.
+ *
+ * The shell keeps a pool of zygotes, topping it up while each sandboxed
+ * command runs.  A zygote is left to init rather than to the shell, so the
+ * shell never has to reap one.  A child (one running 'sandbox' in a
+ * pipeline, say) has closed its copies of the pool and starts a zygote of
+ * its own.  A zygote serves only the first request it gets and drops any
+ * others, so a client that loses a race for one simply tries another.
+ *
+ * Only external commands can be run, and only the uid and gid of the user
+ * are mapped into the namespace.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/sched.h>
+#include "shellSandbox.h"
+#include "shellRedirect.h"
+#include "shellParser.h"
+#include "shellDirs.h"
+#include "shellFd.h"
+
+/* What a zygote reports on the reply socket */
+#define SANDBOX_STARTED 'S'  /* The command is running; 'value' is its PID */
+#define SANDBOX_EXITED  'X'  /* The command finished; 'value' is its exit status */
+#define SANDBOX_FAILED  'F'  /* It could not be run; 'value' is an errno */
+
+typedef struct {
+    int32_t kind;
+    int32_t value;
+} SandboxReply;
+
+/* How submitting a command to a zygote turned out */
+typedef enum {
+    SUBMIT_RAN,     /* The command ran */
+    SUBMIT_FAILED,  /* It could not be run; a message has been printed */
+    SUBMIT_TAKEN    /* The zygote was gone or already used; try another */
+} SubmitResult;
+
+/* Sockets to the zygotes ready to use, oldest first */
+static int   pool[SANDBOX_POOL_MAX];
+static int   poolCount = 0;
+static int   poolSize  = 0;
+static pid_t poolOwner = 0;  /* Only this process refills the pool */
+
+/* In a zygote: the command it started, for the SIGINT handler */
+static volatile pid_t        commandPid  = 0;
+static volatile sig_atomic_t interrupted = 0;
+
+/* Function prototypes */
+static void         topUpPool(void);
+static int          startZygote(void);
+static SubmitResult submit(int zygote, const char* request, size_t length, int* status);
+static bool         readReply(int fd, SandboxReply* reply);
+static void         sendReply(int fd, int kind, int value);
+static void         serveZygote(int fd);
+static int          enterNamespaces(void);
+static bool         writeFile(const char* path, const char* text);
+static void         runRequest(char* request, size_t length, const int passed[4]);
+static void         startCommand(const char* cwd, char** argv, const int passed[4]);
+static void         interruptCommand(int signum);
+
+/*
+ * initSandboxPool
+ *
+ * Makes this process the owner of the zygote pool, which is kept at 'size'
+ * zygotes from the first 'sandbox' on, or from now on if 'prefill'.
+ */
+void initSandboxPool(int size, bool prefill) {
+    poolOwner = getpid();
+    poolSize  = size < 0 ? 0 : size > SANDBOX_POOL_MAX ? SANDBOX_POOL_MAX : size;
+    if (prefill) {
+        topUpPool();
+    }
+}
+
+/*
+ * forgetSandboxPool
+ *
+ * For a child whose descriptors above standard error have been closed (see
+ * applyFdActions()): forgets the pool, so that a 'sandbox' run there starts
+ * a zygote of its own.
+ */
+void forgetSandboxPool(void) {
+    poolCount = 0;
+    poolOwner = 0;
+}
+
+/*
+ * doSandbox
+ *
+ * Implements the 'sandbox' prefix, which runs a command in namespaces of
+ * its own.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command, or 126 if it could not be run.
+ */
+int doSandbox(char** args) {
+    static char request[SANDBOX_REQUEST_MAX];
+    char        cwdBuffer[PATH_MAX];
+    const char* cwd    = getenv("PWD");
+    size_t      length = 0;
+    int         status = 126;
+    int         attempts;
+    int         i;
+
+    if (args[1] == NULL) {
+        printf("usage: sandbox command [argument ...]\n");
+        return 1;
+    }
+    if (cwd == NULL) {
+        cwd = getcwd(cwdBuffer, sizeof(cwdBuffer)) != NULL ? cwdBuffer : "/";
+    }
+
+    /* The directory, then the arguments, each with its NUL */
+    for (i = 0; args[i] != NULL; ++i) {
+        const char* text = i == 0 ? cwd : args[i];
+        size_t      size = strlen(text) + 1;
+
+        if (length + size > sizeof(request)) {
+            fprintf(stderr, "sandbox: argument list too long\n");
+            return 126;
+        }
+        memcpy(request + length, text, size);
+        length += size;
+    }
+
+    fflush(stdout);
+    for (attempts = 0; attempts <= SANDBOX_POOL_MAX; ++attempts) {
+        SubmitResult result;
+        bool         pooled;
+        int          zygote;
+
+        /* The pool is filled on first use */
+        if (getpid() == poolOwner && poolCount == 0) {
+            topUpPool();
+        }
+        pooled = poolCount > 0;
+        if (pooled) {
+            zygote = pool[0];
+            memmove(pool, pool + 1, (size_t) --poolCount * sizeof(int));
+        } else if ((zygote = startZygote()) < 0) {
+            return 126;
+        }
+
+        result = submit(zygote, request, length, &status);
+        shellClose(zygote);
+        if (result == SUBMIT_RAN || result == SUBMIT_FAILED) {
+            return status;
+        }
+        if (!pooled) {
+            fprintf(stderr, "sandbox: the zygote went away\n");
+            return 126;
+        }
+    }
+    return 126;
+}
+
+/*
+ * topUpPool
+ *
+ * Starts zygotes until the pool is full.  Only the owner does this.
+ */
+static void topUpPool(void) {
+    while (getpid() == poolOwner && poolCount < poolSize) {
+        int fd = startZygote();
+
+        if (fd < 0) {
+            return;
+        }
+        pool[poolCount++] = keepFd(fd);
+    }
+}
+
+/*
+ * startZygote
+ *
+ * Starts a zygote, which sets up its namespaces in the background.
+ * Returns the socket to send it a command on, or -1 after printing a
+ * message.
+ */
+static int startZygote(void) {
+    int   fds[2];
+    int   status;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    shellTrack(fds[0]);
+    shellTrack(fds[1]);
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        FdActionList actions = { .count = 0 };
+
+        /* Nothing of the shell's but the socket, now descriptor 3 */
+        if (!addRedirection(&actions, "<", "/dev/null")
+                || !addRedirection(&actions, "&>", "/dev/null")
+                || !addFdDup(&actions, 3, fds[1])) {
+            _exit(1);
+        }
+        applyFdActions(&actions);
+        forgetDirFds();
+        forgetSandboxPool();
+
+        /* Leave the zygote itself to init, so the shell need not reap it */
+        if (fork() != 0) {
+            _exit(0);
+        }
+        serveZygote(3);
+        _exit(0);
+    }
+
+    shellClose(fds[1]);
+    if (pid < 0) {
+        perror("fork");
+        shellClose(fds[0]);
+        return -1;
+    }
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    return fds[0];
+}
+
+/*
+ * submit
+ *
+ * Sends the command in 'request' to 'zygote' along with our standard
+ * descriptors and a socket for the replies, and waits for it to finish,
+ * storing its exit status in 'status'.  The pool is topped up while it
+ * runs.
+ */
+static SubmitResult submit(int zygote, const char* request, size_t length, int* status) {
+    union {
+        char           buffer[CMSG_SPACE(4 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec    vector  = { (void*) request, length };
+    struct msghdr   message = { 0 };
+    struct cmsghdr* header;
+    SandboxReply    reply;
+    int             replyFds[2];
+    int             passed[4];
+    ssize_t         sent;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, replyFds) < 0) {
+        perror("socketpair");
+        return SUBMIT_FAILED;
+    }
+    shellTrack(replyFds[0]);
+    shellTrack(replyFds[1]);
+
+    passed[0] = STDIN_FILENO;
+    passed[1] = STDOUT_FILENO;
+    passed[2] = STDERR_FILENO;
+    passed[3] = replyFds[1];
+
+    message.msg_iov        = &vector;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    header                 = CMSG_FIRSTHDR(&message);
+    header->cmsg_level     = SOL_SOCKET;
+    header->cmsg_type      = SCM_RIGHTS;
+    header->cmsg_len       = CMSG_LEN(sizeof(passed));
+    memcpy(CMSG_DATA(header), passed, sizeof(passed));
+
+    while ((sent = sendmsg(zygote, &message, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    shellClose(replyFds[1]);
+    if (sent < 0 && errno != EPIPE && errno != ECONNRESET) {
+        perror("sandbox: sendmsg");
+        shellClose(replyFds[0]);
+        return SUBMIT_FAILED;
+    }
+
+    /* If another request got to the zygote first, ours is dropped unread */
+    if (sent < 0 || !readReply(replyFds[0], &reply)) {
+        shellClose(replyFds[0]);
+        return SUBMIT_TAKEN;
+    }
+    if (reply.kind == SANDBOX_STARTED) {
+        topUpPool();
+        if (!readReply(replyFds[0], &reply)) {
+            reply.kind  = SANDBOX_FAILED;
+            reply.value = ECONNRESET;
+        }
+    }
+    shellClose(replyFds[0]);
+
+    if (reply.kind != SANDBOX_EXITED) {
+        fprintf(stderr, "sandbox: %s\n", strerror(reply.value));
+        return SUBMIT_FAILED;
+    }
+    *status = reply.value;
+    return SUBMIT_RAN;
+}
+
+/*
+ * readReply
+ *
+ * Reads one reply from a zygote.  Returns false if it has gone away.
+ */
+static bool readReply(int fd, SandboxReply* reply) {
+    ssize_t length;
+
+    while ((length = recv(fd, reply, sizeof(*reply), 0)) < 0 && errno == EINTR) {
+    }
+    return length == sizeof(*reply);
+}
+
+/*
+ * sendReply
+ *
+ * Sends one reply from a zygote.
+ */
+static void sendReply(int fd, int kind, int value) {
+    SandboxReply reply = { kind, value };
+
+    while (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) < 0 && errno == EINTR) {
+    }
+}
+
+/*
+ * serveZygote
+ *
+ * The zygote: sets up the namespaces, then runs the first command that
+ * arrives on 'fd'.
+ */
+static void serveZygote(int fd) {
+    static char request[SANDBOX_REQUEST_MAX + 1];
+    union {
+        char           buffer[CMSG_SPACE(4 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec    vector  = { request, SANDBOX_REQUEST_MAX };
+    struct msghdr   message = { 0 };
+    struct cmsghdr* header;
+    int             passed[4];  /* Standard input, output, error; the reply socket */
+    int             setupError;
+    ssize_t         length;
+
+    /* Ctrl-C reaches the zygotes too; it stops the command if there is one */
+    signal(SIGINT, interruptCommand);
+    setupError = enterNamespaces();
+
+    message.msg_iov        = &vector;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    while ((length = recvmsg(fd, &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+
+    /* One request only: closing drops (and so refuses) any others */
+    shellClose(fd);
+    header = CMSG_FIRSTHDR(&message);
+    if (length <= 0 || header == NULL || header->cmsg_type != SCM_RIGHTS
+            || header->cmsg_len != CMSG_LEN(sizeof(passed))) {
+        return;
+    }
+    memcpy(passed, CMSG_DATA(header), sizeof(passed));
+    request[length] = '\0';
+
+    if (setupError != 0) {
+        sendReply(passed[3], SANDBOX_FAILED, setupError);
+        return;
+    }
+    runRequest(request, (size_t) length, passed);
+}
+
+/*
+ * enterNamespaces
+ *
+ * Moves into new user, mount, PID, IPC and UTS namespaces (the PID
+ * namespace is for children), makes every mount read-only and puts a
+ * private tmpfs on /tmp.  Returns 0, or the errno of the step that failed.
+ */
+static int enterNamespaces(void) {
+    struct mount_attr attributes = { .attr_set = MOUNT_ATTR_RDONLY | MOUNT_ATTR_NOSUID };
+    char              uidMap[64];
+    char              gidMap[64];
+
+    snprintf(uidMap, sizeof(uidMap), "%ld %ld 1\n", (long) getuid(), (long) getuid());
+    snprintf(gidMap, sizeof(gidMap), "%ld %ld 1\n", (long) getgid(), (long) getgid());
+
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWIPC
+                | CLONE_NEWUTS) < 0
+            || !writeFile("/proc/self/uid_map", uidMap)
+            || !writeFile("/proc/self/setgroups", "deny")
+            || !writeFile("/proc/self/gid_map", gidMap)) {
+        return errno;
+    }
+
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0
+            || mount_setattr(AT_FDCWD, "/", AT_RECURSIVE, &attributes,
+                             sizeof(attributes)) < 0
+            || mount("tmpfs", "/tmp", "tmpfs", MS_NOSUID | MS_NODEV,
+                     SANDBOX_TMPFS_OPTIONS) < 0) {
+        return errno;
+    }
+
+    sethostname("sandbox", strlen("sandbox"));
+    return 0;
+}
+
+/*
+ * writeFile
+ *
+ * Writes 'text' to the (/proc) file 'path'.  Returns false on error.
+ */
+static bool writeFile(const char* path, const char* text) {
+    int  fd = open(path, O_WRONLY | O_CLOEXEC);
+    bool written;
+
+    if (fd < 0) {
+        return false;
+    }
+    written = write(fd, text, strlen(text)) == (ssize_t) strlen(text);
+    close(fd);
+    return written;
+}
+
+/*
+ * runRequest
+ *
+ * Starts the command in 'request' (the directory, then the arguments,
+ * each ending in a NUL) on the descriptors in 'passed', then reports its
+ * exit status.
+ */
+static void runRequest(char* request, size_t length, const int passed[4]) {
+    struct clone_args cloneArgs = { 0 };
+    char*             argv[MAX_ARGS + 1];
+    char*             next  = request + strlen(request) + 1;
+    int               pidfd = -1;
+    int               argc  = 0;
+    int               status;
+    siginfo_t         info;
+    pid_t             pid;
+    int               i;
+
+    while (next < request + length && argc < MAX_ARGS) {
+        argv[argc++]  = next;
+        next         += strlen(next) + 1;
+    }
+    argv[argc] = NULL;
+    if (argc == 0) {
+        sendReply(passed[3], SANDBOX_FAILED, EINVAL);
+        return;
+    }
+
+    cloneArgs.flags       = CLONE_PIDFD;
+    cloneArgs.pidfd       = (uint64_t) (uintptr_t) &pidfd;
+    cloneArgs.exit_signal = SIGCHLD;
+    pid = (pid_t) syscall(SYS_clone3, &cloneArgs, sizeof(cloneArgs));
+    if (pid < 0) {
+        sendReply(passed[3], SANDBOX_FAILED, errno);
+        return;
+    } else if (pid == 0) {
+        startCommand(request, argv, passed);
+    }
+
+    /* Only the command keeps the standard descriptors, so pipes see it finish */
+    commandPid = pid;
+    for (i = 0; i < 3; ++i) {
+        close(passed[i]);
+    }
+    sendReply(passed[3], SANDBOX_STARTED, pid);
+
+    while (waitid(P_PIDFD, (id_t) pidfd, &info, WEXITED) < 0 && errno == EINTR) {
+    }
+    if (interrupted) {
+        status = 128 + SIGINT;
+    } else if (info.si_code == CLD_EXITED) {
+        status = info.si_status;
+    } else {
+        status = 128 + info.si_status;
+    }
+    sendReply(passed[3], SANDBOX_EXITED, status);
+}
+
+/*
+ * startCommand
+ *
+ * In the command's child: sets up its descriptors and directory and runs
+ * it.  Never returns.
+ */
+static void startCommand(const char* cwd, char** argv, const int passed[4]) {
+    FdActionList actions = { .count = 0 };
+    int          fd;
+
+    for (fd = 0; fd < 3; ++fd) {
+        if (!addFdDup(&actions, fd, passed[fd])) {
+            _exit(126);
+        }
+    }
+    applyFdActions(&actions);
+
+    if (chdir(cwd) < 0) {
+        fprintf(stderr, "sandbox: %s: %s; running in /\n", cwd, strerror(errno));
+        if (chdir("/") < 0) {
+            _exit(126);
+        }
+    }
+    signal(SIGINT, SIG_DFL);
+
+    execvp(argv[0], argv);  /* Searches $PATH as the shell would */
+    fprintf(stderr, "sandbox: %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+/*
+ * interruptCommand
+ *
+ * SIGINT handler for zygotes.  The command is PID 1 of its namespace and
+ * so ignores a SIGINT from outside; it has to be killed outright.
+ */
+static void interruptCommand(int signum) {
+    (void) signum;
+    if (commandPid > 0) {
+        interrupted = 1;
+        kill(commandPid, SIGKILL);
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ * shellSandbox.h
+ *
+ * The 'sandbox' prefix runs a command in its own user, mount, PID, IPC and
+ * UTS namespaces, with the file system read-only apart from a private
+ * /tmp.  The namespaces are set up ahead of time by a pool of "zygote"
+ * processes, so running a command costs little more than a fork.
+ */
+#ifndef SHELL_SANDBOX_H
+#define SHELL_SANDBOX_H
+
+#include <stdbool.h>
+
+/* Zygotes kept ready, unless $SHELL_SANDBOX_POOL says otherwise */
+#define SANDBOX_POOL_DEFAULT 4
+
+/* Most zygotes the pool will keep */
+#define SANDBOX_POOL_MAX 64
+
+/* Mount options for the private /tmp */
+#define SANDBOX_TMPFS_OPTIONS "size=64m,mode=1777"
+
+/* Largest request (the directory and arguments) sent to a zygote */
+#define SANDBOX_REQUEST_MAX (64 * 1024)
+
+/* Function prototypes */
+void initSandboxPool(int size, bool prefill);
+void forgetSandboxPool(void);
+int  doSandbox(char** args);
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * shellSpawn.c
+ *
+ * Builds and starts spawn plans (see shellSpawn.h).
+ *
+ * All of the work that can fail or allocate happens in the shell:
+ * creating the pipes, opening redirection files, planning each process's
+ * descriptor layout (planFdLayout()).  Which signal handlers the children
+ * must drop is recorded as the shell installs them (setShellSignal()),
+ * not asked of the kernel for every signal on every line.  A child then only joins its process
+ * group, resets those handlers, establishes its layout (applyFdLayout())
+ * and restores the signal mask -- system calls on data the plan already
+ * holds -- before execve().  Because that sequence is async-signal-safe
+ * and writes nothing but its own stack, programs are started with vfork():
+ * the child borrows the shell's memory instead of copying its page tables,
+ * and reports a failed execve() by leaving errno in the plan.  Builtins,
+ * which use the whole of the shell, still run in a forked child.
+ *
+ * A program the exec cache has a descriptor for (see shellExec.h) is run
+ * with execveat() on it, falling back to its path should that fail.
+ *
+ * All signals are blocked while children are started, so no handler of
+ * the shell's runs in a child sharing its memory.
+ *
+ * A builtin on its own with redirections runs in the shell instead: its
+ * layout is set up over the shell's descriptors (pushFdLayout()) and taken
+ * down again afterwards, so appending to a file in the append cache costs
+ * no open() or fork() at all.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include "shellSpawn.h"
+#include "shellFd.h"
+#include "shellDirs.h"
+#include "shellSandbox.h"
+#include "shellExec.h"
+#include "shellPath.h"
+#include "shellAppend.h"
+#include "shellRead.h"
+
+extern char** environ;
+
+/* Signals the shell has a handler for (all bits clear: none) */
+static sigset_t caughtSignals;
+
+/* Function prototypes */
+static bool  planStage(SpawnPlan* plan, int index);
+static pid_t startStage(SpawnPlan* plan, SpawnStage* stage);
+static int   startChild(const SpawnPlan* plan, const SpawnStage* stage);
+static void  execProgram(const SpawnPlan* plan, const SpawnStage* stage, int execFd);
+static void  closePipes(SpawnPlan* plan);
+
+/*
+ * addSpawnStage
+ *
+ * Returns a new, empty stage at the end of 'plan', or NULL (after printing
+ * a message) if the pipeline is too long.
+ */
+SpawnStage* addSpawnStage(SpawnPlan* plan) {
+    SpawnStage* stage;
+
+    if (plan->count == SPAWN_MAX_STAGES) {
+        fprintf(stderr, "too many commands in the pipeline\n");
+        return NULL;
+    }
+
+    stage = &plan->stages[plan->count++];
+    stage->argv[0]       = NULL;
+    stage->path          = NULL;
+    stage->builtin       = NULL;
+    stage->execFd        = -1;
+    stage->actions.count = 0;
+    stage->ready         = false;
+    stage->pid           = -1;
+    stage->execError     = 0;
+    return stage;
+}
+
+/*
+ * setShellSignal
+ *
+ * Sets the disposition of 'signum' to 'handler', as signal() does, and
+ * records whether the shell now catches it: the children it starts reset
+ * a caught signal to its default, since the handler is the shell's.
+ */
+void setShellSignal(int signum, void (*handler)(int)) {
+    signal(signum, handler);
+    if (handler != SIG_DFL && handler != SIG_IGN) {
+        sigaddset(&caughtSignals, signum);
+    } else {
+        sigdelset(&caughtSignals, signum);
+    }
+}
+
+/*
+ * prepareSpawnPlan
+ *
+ * Does the shell's part of starting the stages of 'plan': creates the
+ * pipes between them, plans each one's descriptor layout, opening its
+ * redirection files, and looks its program up in the exec cache.  A stage
+ * whose program was not found or whose layout cannot be planned (a message
+ * has been printed) is left out, as if it had failed at once; its
+ * neighbours see the end of their pipes.
+ *
+ * Returns false, after printing a message, if the pipes cannot be made.
+ */
+bool prepareSpawnPlan(SpawnPlan* plan) {
+    int i;
+
+    plan->envp     = environ;
+    plan->defaults = caughtSignals;
+
+    for (i = 0; i < plan->count - 1; ++i) {
+        if (shellPipe(plan->pipes[i]) < 0) {
+            perror("pipe");
+            plan->count = i + 1;
+            closePipes(plan);
+            return false;
+        }
+    }
+
+    for (i = 0; i < plan->count; ++i) {
+        SpawnStage* stage = &plan->stages[i];
+
+        if (stage->builtin == NULL && stage->argv[0] != NULL && stage->path == NULL) {
+            fprintf(stderr, "%s: command not found\n", stage->argv[0]);
+            continue;
+        }
+
+        stage->ready = planStage(plan, i);
+        if (stage->ready && stage->builtin == NULL && stage->path != NULL) {
+            stage->execFd = findExecFd(stage->path);
+        }
+    }
+    return true;
+}
+
+/*
+ * startSpawnPlan
+ *
+ * Starts every stage of the prepared 'plan' (see prepareSpawnPlan()),
+ * recording their process IDs, then closes the shell's copies of the
+ * pipes and redirection files.
+ */
+void startSpawnPlan(SpawnPlan* plan) {
+    sigset_t all;
+    int      i;
+
+    /* Otherwise forked builtins inherit (and may print again) what is buffered */
+    fflush(stdout);
+    flushAppends();
+
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &plan->mask);
+
+    for (i = 0; i < plan->count; ++i) {
+        SpawnStage* stage = &plan->stages[i];
+
+        if (stage->ready) {
+            stage->pid = startStage(plan, stage);
+        }
+        if (stage->pid > 0 && plan->pgid >= 0) {
+            /* Also here, so the group exists before the next stage joins it */
+            setpgid(stage->pid, plan->pgid);
+            if (plan->pgid == 0) {
+                plan->pgid = stage->pid;
+            }
+        }
+        if (stage->ready) {
+            releaseFdLayout(&stage->layout);
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &plan->mask, NULL);
+    closePipes(plan);
+}
+
+/*
+ * execSpawnPlan
+ *
+ * Replaces the shell with the single program of the prepared 'plan' (one
+ * stage, not a builtin), instead of starting a child and waiting for it:
+ * for the last command of a script, when nothing would be left to do but
+ * exit with its status.  Does not return.
+ */
+void execSpawnPlan(SpawnPlan* plan) {
+    SpawnStage* stage = &plan->stages[0];
+    int         execFd;
+
+    fflush(stdout);
+    flushAppends();
+    if (!stage->ready) {
+        exit(1);
+    }
+    if (stage->argv[0] == NULL) {
+        exit(0);
+    }
+
+    sigprocmask(SIG_BLOCK, NULL, &plan->mask);
+    execFd = startChild(plan, stage);
+    execProgram(plan, stage, execFd);
+    perror("execv");
+    exit(1);
+}
+
+/*
+ * runSpawnBuiltin
+ *
+ * Runs the builtin of the prepared 'plan' (one stage) in the shell rather
+ * than in a child, with its descriptor layout set up over the shell's own
+ * for as long as it runs.  With 'combine', standard output going to a file
+ * in the append cache goes through the cache's stream for it (see
+ * appendStream()), and is left there to be written out with what follows.
+ *
+ * Returns false, having done nothing, if the builtin cannot run in the
+ * shell (its layout replaces descriptors the shell keeps for itself); the
+ * plan is then started as usual.  Otherwise '*status' is its exit status.
+ */
+bool runSpawnBuiltin(SpawnPlan* plan, bool combine, int* status) {
+    SpawnStage* stage  = &plan->stages[0];
+    FILE*       output = stdout;
+    FILE*       stream = NULL;
+    FdBackup    backup;
+    int         i;
+
+    if (!stage->ready) {
+        *status = 1;  /* A message has been printed */
+        return true;
+    }
+
+    for (i = 0; combine && i < stage->layout.count; ++i) {
+        if (stage->layout.moves[i].target == STDOUT_FILENO) {
+            stream = appendStream(stage->layout.moves[i].source);
+        }
+    }
+    if (stream == NULL) {
+        flushAppends();
+    }
+
+    if (!pushFdLayout(&stage->layout, &backup)) {
+        return false;
+    }
+    if (stream != NULL) {
+        stdout = stream;
+    }
+    *status = stage->builtin(stage->argv);
+    stdout = output;
+    popFdLayout(&backup);
+    releaseFdLayout(&stage->layout);
+    return true;
+}
+
+/*
+ * planStage
+ *
+ * Plans the descriptor layout of stage 'index' of 'plan': the descriptors
+ * 'exec' set up, then its pipes, so that its own redirections can override
+ * them ("p1 2>&1 | p2" sends p1's standard error down the pipe too).
+ *
+ * Returns false, after printing a message, if it cannot be planned.
+ */
+static bool planStage(SpawnPlan* plan, int index) {
+    SpawnStage*  stage = &plan->stages[index];
+    FdActionList actions = { .count = 0 };
+
+    if (!addShellFds(&actions)) {
+        return false;
+    }
+    if (index > 0 && !addFdDup(&actions, STDIN_FILENO, plan->pipes[index - 1][0])) {
+        return false;
+    }
+    if (index < plan->count - 1
+            && !addFdDup(&actions, STDOUT_FILENO, plan->pipes[index][1])) {
+        return false;
+    }
+
+    return appendFdActions(&actions, &stage->actions)
+        && planFdLayout(&actions, &stage->layout);
+}
+
+/*
+ * startStage
+ *
+ * Starts the child for 'stage': vforked for a program, forked for a
+ * builtin.  Returns its process ID, or -1 (after printing a message) if
+ * it could not be started.
+ */
+static pid_t startStage(SpawnPlan* plan, SpawnStage* stage) {
+    pid_t pid;
+
+    if (stage->builtin != NULL) {
+        pid = fork();
+        if (pid == 0) {
+            int status;
+
+            startChild(plan, stage);
+
+            /* The cached directory descriptors were closed with everything else */
+            forgetDirFds();
+            forgetSandboxPool();
+            forgetExecCache();
+            forgetCommandCache();
+            forgetAppendCache();
+            forgetReadBuffers();
+            status = stage->builtin(stage->argv);
+            fflush(stdout);
+            _exit(status);
+        }
+    } else {
+        stage->execError = 0;
+        pid = vfork();
+        if (pid == 0) {
+            int execFd = startChild(plan, stage);
+
+            if (stage->argv[0] == NULL) {
+                _exit(0);  /* Only redirections */
+            }
+            execProgram(plan, stage, execFd);
+            stage->execError = errno;
+            _exit(1);
+        }
+    }
+
+    if (pid < 0) {
+        perror("fork");
+    } else if (stage->execError != 0) {
+        /* The child is gone (and reaped later); it left its errno with us */
+        errno = stage->execError;
+        perror("execv");
+    }
+    return pid;
+}
+
+/*
+ * startChild
+ *
+ * The child's side of starting 'stage': joins the process group, resets
+ * the shell's signal handlers, establishes the descriptor layout and
+ * restores the signal mask.  Only system calls and the plan are used, so
+ * this is safe in a vforked child.  Terminates the child on failure.
+ *
+ * Returns the stage's exec cache descriptor (which may have had to move
+ * out of the layout's way), or -1.
+ */
+static int startChild(const SpawnPlan* plan, const SpawnStage* stage) {
+    struct sigaction standard;
+    FdLayout         layout = stage->layout;  /* applyFdLayout() rewrites it */
+    int              i;
+
+    if (plan->pgid >= 0) {
+        setpgid(0, plan->pgid);
+    }
+
+    memset(&standard, 0, sizeof(standard));
+    standard.sa_handler = SIG_DFL;
+    for (i = 1; i < NSIG; ++i) {
+        if (sigismember(&plan->defaults, i) == 1) {
+            sigaction(i, &standard, NULL);
+        }
+    }
+
+    layout.keep = stage->execFd;
+    applyFdLayout(&layout);
+    sigprocmask(SIG_SETMASK, &plan->mask, NULL);
+    return layout.keep;
+}
+
+/*
+ * execProgram
+ *
+ * Executes the program of 'stage', from the exec cache's descriptor
+ * 'execFd' if there is one.  Returns (with errno set) only on failure.
+ */
+static void execProgram(const SpawnPlan* plan, const SpawnStage* stage, int execFd) {
+#ifdef SYS_execveat
+    if (execFd >= 0) {
+        syscall(SYS_execveat, execFd, "", stage->argv, plan->envp, AT_EMPTY_PATH);
+    }
+#endif
+    execve(stage->path, stage->argv, plan->envp);
+}
+
+/*
+ * closePipes
+ *
+ * Closes the shell's ends of the pipes between the stages of 'plan'.
+ */
+static void closePipes(SpawnPlan* plan) {
+    int i;
+
+    for (i = 0; i < plan->count - 1; ++i) {
+        shellClose(plan->pipes[i][0]);
+        shellClose(plan->pipes[i][1]);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * shellSpawn.h
+ *
+ * A command line is started from a spawn plan: everything its processes
+ * need -- arguments, program, environment, descriptor layout, signal mask
+ * and process group -- is worked out in the shell first, so each child
+ * only has to make a handful of system calls before exec.
+ */
+#ifndef SHELL_SPAWN_H
+#define SHELL_SPAWN_H
+
+#include <stdbool.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/types.h>
+#include "shellParser.h"
+#include "shellRedirect.h"
+
+/* Most processes in one pipeline */
+#define SPAWN_MAX_STAGES 64
+
+/* One process of a pipeline */
+typedef struct {
+    char*         argv[MAX_ARGS + 1];     /* NULL-terminated; points into the line */
+    const char*   path;                   /* The program to execute, or NULL if not found */
+    char          found[PATH_MAX];        /* Where 'path' points if found on $PATH */
+    int           execFd;                 /* The exec cache's descriptor for it, or -1 */
+    int         (*builtin)(char** args);  /* Or the builtin to run */
+    FdActionList  actions;                /* Its redirections, as written */
+    FdLayout      layout;                 /* Its descriptors, pipes included */
+    bool          ready;                  /* The layout could be planned */
+    pid_t         pid;                    /* Once started; -1 if it could not be */
+    int           execError;              /* errno from a failed execve() */
+} SpawnStage;
+
+/* The processes of a command line, connected by pipes */
+typedef struct {
+    SpawnStage stages[SPAWN_MAX_STAGES];
+    int        count;
+    char**     envp;
+    sigset_t   mask;      /* The signal mask the children start with */
+    sigset_t   defaults;  /* Signals whose handlers the children reset */
+    pid_t      pgid;      /* -1 for the shell's process group, 0 for a new one */
+    int        pipes[SPAWN_MAX_STAGES][2];
+} SpawnPlan;
+
+/* Function prototypes */
+void        setShellSignal(int signum, void (*handler)(int));
+SpawnStage* addSpawnStage(SpawnPlan* plan);
+bool        prepareSpawnPlan(SpawnPlan* plan);
+void        startSpawnPlan(SpawnPlan* plan);
+void        execSpawnPlan(SpawnPlan* plan);
+bool        runSpawnBuiltin(SpawnPlan* plan, bool combine, int* status);
+
+#endif
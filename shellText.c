@@ -0,0 +1,889 @@
+/*
+ * shellText.c
+ *
+ * Implements built-in versions of three text filters:
+ *
+ *     cut  -f list [-d delim] [-s] | -b list | -c list  [file ...]
+ *     uniq [-c] [-d] [-u] [file]
+ *     tr   [-d] [-s] set1 [set2]
+ *
+ * Input is read in large blocks, and each block is handed over as a run of
+ * complete lines, so lines are never copied or allocated individually; a
+ * block only grows when a single line is longer than it.  'cut' finds
+ * delimiters and newlines together in one SSE2 pass over the block and
+ * stops looking at a line once the last wanted field is behind it.  'tr'
+ * translates through a 256-entry table, in place.  Output is gathered into
+ * one buffer and written when it fills.
+ *
+ * -c is treated the same as -b; the shell works in bytes.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "shellText.h"
+#include "shellFd.h"
+
+/* Input being read a block of lines at a time */
+typedef struct {
+    int    fd;
+    char*  data;
+    size_t capacity;
+    size_t start;     /* First byte not yet handed out */
+    size_t end;       /* One past the last byte read */
+    bool   eof;
+} LineReader;
+
+/* Output waiting to be written to standard output */
+typedef struct {
+    char*  data;
+    size_t length;
+    bool   failed;    /* A write failed; the rest is discarded */
+} TextOutput;
+
+/* A range of fields or bytes, numbered from 1 */
+typedef struct {
+    size_t low;
+    size_t high;      /* SIZE_MAX for an open-ended range (N-) */
+} CutRange;
+
+/* Options for one 'cut' invocation */
+typedef struct {
+    CutRange ranges[CUT_MAX_RANGES];
+    size_t   count;
+    bool     fields;      /* -f, rather than -b/-c */
+    char     delimiter;
+    bool     suppress;    /* -s: drop lines with no delimiter */
+} CutOptions;
+
+/* Options for one 'uniq' invocation */
+typedef struct {
+    bool counts;          /* -c */
+    bool repeatedOnly;    /* -d */
+    bool uniqueOnly;      /* -u */
+} UniqOptions;
+
+/* A character class usable in a 'tr' set */
+typedef struct {
+    const char* name;
+    int       (*test)(int c);
+} CharClass;
+
+static const CharClass charClasses[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+/* Function prototypes */
+static bool          openInput(LineReader* reader, const char* path);
+static void          closeInput(LineReader* reader);
+static const char*   nextBlock(LineReader* reader, size_t* length);
+static const char*   findEither(const char* p, const char* end, char a, char b);
+static bool          parseList(const char* text, CutOptions* options);
+static bool          inRanges(const CutOptions* options, size_t* cursor, size_t n);
+static void          cutFields(const char* block, size_t length,
+                               const CutOptions* options, TextOutput* out);
+static void          cutBytes(const char* block, size_t length,
+                              const CutOptions* options, TextOutput* out);
+static void          emitGroup(TextOutput* out, const UniqOptions* options,
+                               const char* line, size_t length, size_t count);
+static bool          expandSet(const char* text, unsigned char* set, size_t* length);
+static unsigned char parseChar(const char** text);
+static void          emit(TextOutput* out, const char* text, size_t length);
+static void          flushOutput(TextOutput* out);
+static bool          writeAll(int fd, const char* data, size_t length);
+
+/*
+ * doCut
+ *
+ * Implements the built-in 'cut' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        Options come first; the remaining arguments are files to read
+ *        ("-", or none at all, for standard input).
+ *
+ * Returns the exit status of the command.
+ */
+int doCut(char** args) {
+    CutOptions  options;
+    TextOutput  out    = { NULL, 0, false };
+    const char* list   = NULL;
+    int         status = 0;
+    int         i;
+
+    options.count     = 0;
+    options.fields    = false;
+    options.delimiter = '\t';
+    options.suppress  = false;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; ++i) {
+        char        option = args[i][1];
+        const char* value;
+
+        if (strcmp(args[i], "--") == 0) {
+            ++i;
+            break;
+        }
+        if (option == 's' && args[i][2] == '\0') {
+            options.suppress = true;
+            continue;
+        }
+
+        /* The remaining options take a value, attached or not */
+        value = args[i][2] != '\0' ? args[i] + 2 : args[++i];
+        if (value == NULL || strchr("bcdf", option) == NULL) {
+            printf("usage: cut -f list [-d delim] [-s] | -b list | -c list [file ...]\n");
+            return 1;
+        }
+        if (option == 'd') {
+            if (strlen(value) != 1) {
+                printf("cut: the delimiter must be a single character\n");
+                return 1;
+            }
+            options.delimiter = value[0];
+        } else {
+            options.fields = option == 'f';
+            list           = value;
+        }
+    }
+
+    if (list == NULL) {
+        printf("usage: cut -f list [-d delim] [-s] | -b list | -c list [file ...]\n");
+        return 1;
+    }
+    if (!parseList(list, &options)) {
+        return 1;
+    }
+
+    /* Keep our output in order with anything already buffered by stdio */
+    fflush(stdout);
+    out.data = malloc(TEXT_OUTPUT_SIZE);
+
+    do {
+        LineReader  reader;
+        const char* block;
+        size_t      length;
+
+        if (!openInput(&reader, args[i])) {
+            status = 1;
+            continue;
+        }
+        while ((block = nextBlock(&reader, &length)) != NULL) {
+            if (options.fields) {
+                cutFields(block, length, &options, &out);
+            } else {
+                cutBytes(block, length, &options, &out);
+            }
+        }
+        closeInput(&reader);
+    } while (args[i] != NULL && args[++i] != NULL);
+
+    flushOutput(&out);
+    free(out.data);
+    return status || out.failed;
+}
+
+/*
+ * doUniq
+ *
+ * Implements the built-in 'uniq' command, which collapses runs of identical
+ * adjacent lines into one.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        -c prefixes each line with its count, -d prints only repeated
+ *        lines and -u only unrepeated ones.  An optional file name follows.
+ *
+ * Returns the exit status of the command.
+ */
+int doUniq(char** args) {
+    UniqOptions options        = { false, false, false };
+    TextOutput  out            = { NULL, 0, false };
+    LineReader  reader;
+    const char* block;
+    size_t      length;
+    const char* previous       = NULL;   /* The line being counted */
+    size_t      previousLength = 0;
+    size_t      count          = 0;
+    char*       saved          = NULL;   /* A copy of it, across blocks */
+    size_t      savedCapacity  = 0;
+    int         i;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; ++i) {
+        const char* option;
+
+        for (option = args[i] + 1; *option != '\0'; ++option) {
+            switch (*option) {
+            case 'c': options.counts       = true; break;
+            case 'd': options.repeatedOnly = true; break;
+            case 'u': options.uniqueOnly   = true; break;
+            default:
+                printf("uniq: invalid option -- '%c'\n", *option);
+                printf("usage: uniq [-cdu] [file]\n");
+                return 1;
+            }
+        }
+    }
+    if (args[i] != NULL && args[i + 1] != NULL) {
+        printf("usage: uniq [-cdu] [file]\n");
+        return 1;
+    }
+
+    if (!openInput(&reader, args[i])) {
+        return 1;
+    }
+    fflush(stdout);
+    out.data = malloc(TEXT_OUTPUT_SIZE);
+
+    while ((block = nextBlock(&reader, &length)) != NULL) {
+        const char* p   = block;
+        const char* end = block + length;
+
+        while (p < end) {
+            const char* newline    = memchr(p, '\n', end - p);
+            size_t      lineLength = (newline != NULL ? newline : end) - p;
+
+            if (count > 0 && lineLength == previousLength
+                    && memcmp(p, previous, lineLength) == 0) {
+                count++;
+            } else {
+                if (count > 0) {
+                    emitGroup(&out, &options, previous, previousLength, count);
+                }
+                previous       = p;
+                previousLength = lineLength;
+                count          = 1;
+            }
+            p = newline != NULL ? newline + 1 : end;
+        }
+
+        /* The block is reused by the next read; keep the line being counted */
+        if (count > 0 && previous != saved) {
+            if (previousLength > savedCapacity || saved == NULL) {
+                savedCapacity = previousLength > 256 ? previousLength : 256;
+                free(saved);
+                saved = malloc(savedCapacity);
+            }
+            memcpy(saved, previous, previousLength);
+            previous = saved;
+        }
+    }
+    if (count > 0) {
+        emitGroup(&out, &options, previous, previousLength, count);
+    }
+
+    closeInput(&reader);
+    flushOutput(&out);
+    free(out.data);
+    free(saved);
+    return out.failed;
+}
+
+/*
+ * doTr
+ *
+ * Implements the built-in 'tr' command, which copies standard input to
+ * standard output translating, deleting or squeezing characters.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        Sets may contain ranges (a-z), classes ([:upper:]) and escapes
+ *        (\n, \t, \\, \NNN).  When set2 is shorter than set1 its last
+ *        character is repeated.
+ *
+ * Returns the exit status of the command.
+ */
+int doTr(char** args) {
+    static unsigned char set1[TR_SET_MAX];
+    static unsigned char set2[TR_SET_MAX];
+    unsigned char        map[256];
+    bool                 removed[256]  = { false };
+    bool                 squeezed[256] = { false };
+    size_t               length1 = 0;
+    size_t               length2 = 0;
+    bool                 delete  = false;
+    bool                 squeeze = false;
+    int                  last    = -1;   /* The last byte written, for -s */
+    unsigned char*       buffer;
+    ssize_t              count;
+    int                  operands;
+    int                  status  = 0;
+    int                  i;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; ++i) {
+        const char* option;
+
+        for (option = args[i] + 1; *option != '\0'; ++option) {
+            switch (*option) {
+            case 'd': delete  = true; break;
+            case 's': squeeze = true; break;
+            default:
+                printf("tr: invalid option -- '%c'\n", *option);
+                printf("usage: tr [-ds] set1 [set2]\n");
+                return 1;
+            }
+        }
+    }
+
+    for (operands = 0; args[i + operands] != NULL; ++operands) {
+    }
+    /* -d and -s alone take one set; translating and -ds take two */
+    if (operands < 1 || operands > 2
+            || (operands == 1 && !delete && !squeeze)
+            || (operands == 2 && delete && !squeeze)
+            || (operands == 1 && delete && squeeze)) {
+        printf("usage: tr [-ds] set1 [set2]\n");
+        return 1;
+    }
+    if (!expandSet(args[i], set1, &length1)
+            || (operands == 2 && !expandSet(args[i + 1], set2, &length2))) {
+        return 1;
+    }
+    if (operands == 2 && !delete && length2 == 0 && length1 > 0) {
+        printf("tr: when translating, set2 must not be empty\n");
+        return 1;
+    }
+
+    for (i = 0; i < 256; ++i) {
+        map[i] = (unsigned char) i;
+    }
+    for (i = 0; (size_t) i < length1; ++i) {
+        if (delete) {
+            removed[set1[i]] = true;
+        } else if (operands == 2) {
+            map[set1[i]] = set2[(size_t) i < length2 ? (size_t) i : length2 - 1];
+        }
+    }
+    if (squeeze) {
+        const unsigned char* set    = operands == 2 ? set2 : set1;
+        size_t               length = operands == 2 ? length2 : length1;
+
+        for (i = 0; (size_t) i < length; ++i) {
+            squeezed[set[i]] = true;
+        }
+    }
+
+    fflush(stdout);
+    buffer = malloc(TEXT_BUFFER_SIZE);
+
+    while ((count = read(STDIN_FILENO, buffer, TEXT_BUFFER_SIZE)) != 0) {
+        size_t kept = 0;
+        size_t j;
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("tr: read");
+            status = 1;
+            break;
+        }
+
+        if (!delete && !squeeze) {
+            /* Plain translation is done in place, one table lookup a byte */
+            for (j = 0; j < (size_t) count; ++j) {
+                buffer[j] = map[buffer[j]];
+            }
+            kept = (size_t) count;
+        } else {
+            for (j = 0; j < (size_t) count; ++j) {
+                unsigned char c = buffer[j];
+
+                if (removed[c]) {
+                    continue;
+                }
+                c = map[c];
+                if (squeezed[c] && c == last) {
+                    continue;
+                }
+                buffer[kept++] = c;
+                last           = c;
+            }
+        }
+
+        if (!writeAll(STDOUT_FILENO, (const char*) buffer, kept)) {
+            perror("tr: write");
+            status = 1;
+            break;
+        }
+    }
+
+    free(buffer);
+    return status;
+}
+
+/*
+ * openInput
+ *
+ * Prepares 'reader' to read 'path' (standard input if it is NULL or "-").
+ * Prints a message and returns false if the file can't be opened.
+ */
+static bool openInput(LineReader* reader, const char* path) {
+    if (path == NULL || strcmp(path, "-") == 0) {
+        reader->fd = STDIN_FILENO;
+    } else if ((reader->fd = shellOpen(path, O_RDONLY, 0)) < 0) {
+        perror(path);
+        return false;
+    }
+
+    reader->capacity = TEXT_BUFFER_SIZE;
+    reader->data     = malloc(reader->capacity);
+    reader->start    = 0;
+    reader->end      = 0;
+    reader->eof      = false;
+    return true;
+}
+
+/*
+ * closeInput
+ *
+ * Releases what openInput() set up.  Standard input is left open.
+ */
+static void closeInput(LineReader* reader) {
+    if (reader->fd != STDIN_FILENO) {
+        shellClose(reader->fd);
+    }
+    free(reader->data);
+    reader->data = NULL;
+}
+
+/*
+ * nextBlock
+ *
+ * Returns the next run of complete lines from 'reader' (the last one
+ * without a newline if the input doesn't end with one), storing its length
+ * in 'length', or NULL at the end of the input.  The block stays valid
+ * until the next call.
+ */
+static const char* nextBlock(LineReader* reader, size_t* length) {
+    for (;;) {
+        size_t      available = reader->end - reader->start;
+        const char* newline   = NULL;
+        ssize_t     count;
+
+        if (available > 0) {
+            newline = memrchr(reader->data + reader->start, '\n', available);
+        }
+        if (newline != NULL || (reader->eof && available > 0)) {
+            const char* block = reader->data + reader->start;
+            size_t      end   = newline != NULL
+                                ? (size_t) (newline - reader->data) + 1 : reader->end;
+
+            *length       = end - reader->start;
+            reader->start = end;
+            return block;
+        }
+        if (reader->eof) {
+            return NULL;
+        }
+
+        /* Keep the partial line at the front, growing only if it fills the buffer */
+        if (reader->start > 0) {
+            memmove(reader->data, reader->data + reader->start, available);
+            reader->start = 0;
+            reader->end   = available;
+        }
+        if (reader->end == reader->capacity) {
+            reader->capacity *= 2;
+            reader->data      = realloc(reader->data, reader->capacity);
+        }
+
+        count = read(reader->fd, reader->data + reader->end,
+                     reader->capacity - reader->end);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            reader->eof = true;
+        } else if (count == 0) {
+            reader->eof = true;
+        } else {
+            reader->end += (size_t) count;
+        }
+    }
+}
+
+/*
+ * findEither
+ *
+ * Returns a pointer to the first 'a' or 'b' in [p, end), or 'end' if there
+ * is neither.  With SSE2, 16 bytes are compared against both at once.
+ */
+static const char* findEither(const char* p, const char* end, char a, char b) {
+#ifdef __SSE2__
+    __m128i first  = _mm_set1_epi8(a);
+    __m128i second = _mm_set1_epi8(b);
+
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) p);
+        int     mask  = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, first),
+                                                       _mm_cmpeq_epi8(chunk, second)));
+
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == a || *p == b) {
+            return p;
+        }
+    }
+    return end;
+}
+
+/*
+ * parseList
+ *
+ * Parses a 'cut' list ("1,3-5,7-") into options->ranges, sorted and with
+ * overlapping ranges merged.  Prints a message and returns false if the
+ * list is malformed.
+ */
+static bool parseList(const char* text, CutOptions* options) {
+    const char* p = text;
+    size_t      i;
+    size_t      merged;
+
+    while (*p != '\0') {
+        CutRange range     = { 1, SIZE_MAX };
+        bool     sawNumber = false;
+        char*    after;
+
+        if (options->count == CUT_MAX_RANGES) {
+            printf("cut: too many ranges in '%s'\n", text);
+            return false;
+        }
+        if (isdigit((unsigned char) *p)) {
+            range.low = strtoul(p, &after, 10);
+            p         = after;
+            sawNumber = true;
+            if (*p != '-') {
+                range.high = range.low;
+            }
+        }
+        if (*p == '-') {
+            ++p;
+            if (isdigit((unsigned char) *p)) {
+                range.high = strtoul(p, &after, 10);
+                p          = after;
+                sawNumber  = true;
+            }
+        }
+        if ((*p != ',' && *p != '\0') || !sawNumber || range.low == 0
+                || range.high < range.low) {
+            printf("cut: invalid list '%s'\n", text);
+            return false;
+        }
+        if (*p == ',') {
+            ++p;
+        }
+
+        /* Insert in order of the start of the range */
+        for (i = options->count; i > 0 && options->ranges[i - 1].low > range.low; --i) {
+            options->ranges[i] = options->ranges[i - 1];
+        }
+        options->ranges[i] = range;
+        options->count++;
+    }
+
+    if (options->count == 0) {
+        printf("cut: invalid list '%s'\n", text);
+        return false;
+    }
+
+    for (merged = 0, i = 1; i < options->count; ++i) {
+        CutRange* last = &options->ranges[merged];
+
+        if (last->high == SIZE_MAX || options->ranges[i].low <= last->high + 1) {
+            if (options->ranges[i].high > last->high) {
+                last->high = options->ranges[i].high;
+            }
+        } else {
+            options->ranges[++merged] = options->ranges[i];
+        }
+    }
+    options->count = merged + 1;
+    return true;
+}
+
+/*
+ * inRanges
+ *
+ * Returns true if 'n' is selected by the list.  Numbers must be asked
+ * about in increasing order; 'cursor' (0 for the first) remembers which
+ * range was reached.
+ */
+static bool inRanges(const CutOptions* options, size_t* cursor, size_t n) {
+    while (*cursor < options->count && options->ranges[*cursor].high < n) {
+        (*cursor)++;
+    }
+    return *cursor < options->count && options->ranges[*cursor].low <= n;
+}
+
+/*
+ * cutFields
+ *
+ * Writes the selected fields of each line in 'block' to 'out'.
+ */
+static void cutFields(const char* block, size_t length,
+                      const CutOptions* options, TextOutput* out) {
+    const char* p         = block;
+    const char* end       = block + length;
+    size_t      lastField = options->ranges[options->count - 1].high;
+
+    while (p < end) {
+        const char* hit     = findEither(p, end, options->delimiter, '\n');
+        size_t      field   = 1;
+        size_t      cursor  = 0;
+        bool        printed = false;
+
+        if (hit == end || *hit == '\n') {
+            /* A line without a delimiter is passed through whole, unless -s */
+            if (!options->suppress) {
+                emit(out, p, hit - p);
+                emit(out, "\n", 1);
+            }
+            p = hit < end ? hit + 1 : end;
+            continue;
+        }
+
+        for (;;) {
+            if (inRanges(options, &cursor, field)) {
+                if (printed) {
+                    emit(out, &options->delimiter, 1);
+                }
+                emit(out, p, hit - p);
+                printed = true;
+            }
+            if (hit == end || *hit == '\n') {
+                break;
+            }
+
+            p = hit + 1;
+            if (++field > lastField) {
+                /* Nothing more is wanted from this line */
+                hit = memchr(p, '\n', end - p);
+                if (hit == NULL) {
+                    hit = end;
+                }
+                break;
+            }
+            hit = findEither(p, end, options->delimiter, '\n');
+        }
+
+        emit(out, "\n", 1);
+        p = hit < end ? hit + 1 : end;
+    }
+}
+
+/*
+ * cutBytes
+ *
+ * Writes the selected bytes of each line in 'block' to 'out'.
+ */
+static void cutBytes(const char* block, size_t length,
+                     const CutOptions* options, TextOutput* out) {
+    const char* p   = block;
+    const char* end = block + length;
+
+    while (p < end) {
+        const char* newline    = memchr(p, '\n', end - p);
+        size_t      lineLength = (newline != NULL ? newline : end) - p;
+        size_t      i;
+
+        for (i = 0; i < options->count && options->ranges[i].low <= lineLength; ++i) {
+            size_t high = options->ranges[i].high < lineLength
+                          ? options->ranges[i].high : lineLength;
+
+            emit(out, p + options->ranges[i].low - 1, high - options->ranges[i].low + 1);
+        }
+        emit(out, "\n", 1);
+        p = newline != NULL ? newline + 1 : end;
+    }
+}
+
+/*
+ * emitGroup
+ *
+ * Writes one line of 'uniq' output for a run of 'count' identical lines,
+ * if the options want it.
+ */
+static void emitGroup(TextOutput* out, const UniqOptions* options,
+                      const char* line, size_t length, size_t count) {
+    if ((options->repeatedOnly && count < 2) || (options->uniqueOnly && count > 1)) {
+        return;
+    }
+    if (options->counts) {
+        char prefix[32];
+        int  prefixLength = snprintf(prefix, sizeof(prefix), "%7zu ", count);
+
+        emit(out, prefix, (size_t) prefixLength);
+    }
+    emit(out, line, length);
+    emit(out, "\n", 1);
+}
+
+/*
+ * expandSet
+ *
+ * Expands the 'tr' set 'text' into the bytes it stands for.  Prints a
+ * message and returns false if it is malformed or too long.
+ */
+static bool expandSet(const char* text, unsigned char* set, size_t* length) {
+    const char* p = text;
+
+    *length = 0;
+    while (*p != '\0') {
+        unsigned int low;
+        unsigned int high;
+        unsigned int c;
+
+        if (p[0] == '[' && p[1] == ':') {
+            const char* close = strstr(p + 2, ":]");
+            size_t      i;
+
+            for (i = 0; close != NULL && i < sizeof(charClasses) / sizeof(charClasses[0]); ++i) {
+                if (strlen(charClasses[i].name) == (size_t) (close - p - 2)
+                        && strncmp(charClasses[i].name, p + 2, close - p - 2) == 0) {
+                    break;
+                }
+            }
+            if (close == NULL || i == sizeof(charClasses) / sizeof(charClasses[0])) {
+                printf("tr: invalid character class in '%s'\n", text);
+                return false;
+            }
+            for (c = 0; c < 256; ++c) {
+                if (charClasses[i].test((int) c)) {
+                    if (*length == TR_SET_MAX) {
+                        printf("tr: set too long: '%s'\n", text);
+                        return false;
+                    }
+                    set[(*length)++] = (unsigned char) c;
+                }
+            }
+            p = close + 2;
+            continue;
+        }
+
+        low  = parseChar(&p);
+        high = low;
+        if (p[0] == '-' && p[1] != '\0') {
+            ++p;
+            high = parseChar(&p);
+            if (high < low) {
+                printf("tr: range '%c-%c' is in reverse order\n", low, high);
+                return false;
+            }
+        }
+        for (c = low; c <= high; ++c) {
+            if (*length == TR_SET_MAX) {
+                printf("tr: set too long: '%s'\n", text);
+                return false;
+            }
+            set[(*length)++] = (unsigned char) c;
+        }
+    }
+    return true;
+}
+
+/*
+ * parseChar
+ *
+ * Returns the (possibly escaped) character at *text and advances past it.
+ */
+static unsigned char parseChar(const char** text) {
+    const char*   p = *text;
+    unsigned char c = (unsigned char) *p++;
+
+    if (c == '\\' && *p != '\0') {
+        c = (unsigned char) *p++;
+        switch (c) {
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'v': c = '\v'; break;
+        default:
+            if (c >= '0' && c <= '7') {
+                unsigned int value  = c - '0';
+                int          digits = 1;
+
+                while (digits < 3 && *p >= '0' && *p <= '7') {
+                    value = value * 8 + (unsigned int) (*p++ - '0');
+                    digits++;
+                }
+                c = (unsigned char) value;
+            }
+            break;
+        }
+    }
+    *text = p;
+    return c;
+}
+
+/*
+ * emit
+ *
+ * Appends 'length' bytes of 'text' to 'out', writing the buffer out when
+ * it fills.  Pieces too big for the buffer are written directly.
+ */
+static void emit(TextOutput* out, const char* text, size_t length) {
+    if (out->length + length > TEXT_OUTPUT_SIZE) {
+        flushOutput(out);
+        if (length >= TEXT_OUTPUT_SIZE) {
+            if (!out->failed && !writeAll(STDOUT_FILENO, text, length)) {
+                perror("write");
+                out->failed = true;
+            }
+            return;
+        }
+    }
+    memcpy(out->data + out->length, text, length);
+    out->length += length;
+}
+
+/*
+ * flushOutput
+ *
+ * Writes everything buffered in 'out' to standard output.
+ */
+static void flushOutput(TextOutput* out) {
+    if (!out->failed && !writeAll(STDOUT_FILENO, out->data, out->length)) {
+        perror("write");
+        out->failed = true;
+    }
+    out->length = 0;
+}
+
+/*
+ * writeAll
+ *
+ * Writes all 'length' bytes of 'data' to 'fd'.  Returns false on error.
+ */
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t result = write(fd, data, length);
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data   += result;
+        length -= (size_t) result;
+    }
+    return true;
+}
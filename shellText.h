@@ -0,0 +1,26 @@
+/*
+ * shellText.h
+ *
+ * The built-in text filters 'cut', 'uniq' and 'tr'.
+ */
+#ifndef SHELL_TEXT_H
+#define SHELL_TEXT_H
+
+/* Size of the input block read at a time (grown only for longer lines) */
+#define TEXT_BUFFER_SIZE (256 * 1024)
+
+/* Size of the output buffer, which is written whenever it fills */
+#define TEXT_OUTPUT_SIZE (64 * 1024)
+
+/* Most ranges a 'cut' list may contain */
+#define CUT_MAX_RANGES 64
+
+/* Longest expanded 'tr' set */
+#define TR_SET_MAX 4096
+
+/* Function prototypes */
+int  doCut(char** args);
+int  doUniq(char** args);
+int  doTr(char** args);
+
+#endif
@@ -0,0 +1,859 @@
+/*
+ * shellVars.c
+ *
+ * The variable table (see shellVars.h).
+ *
+ * Variables live in an open-addressed hash table keyed by name (FNV-1a,
+ * linear probing).  Lookups take the name as a pointer and a length, so
+ * expansion can look a name up where it stands in a word without copying
+ * it out first.
+ *
+ * An indexed array is a vector of its items, NULL where one is unset.  An
+ * associative array is an open-addressed table of its own whose keys are
+ * interned: each distinct key is stored once, with its hash, however many
+ * arrays use it, so arrays of records with the same fields share the
+ * strings, and a key is found in an array by comparing pointers.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "shellVars.h"
+
+#define VAR_TABLE_MASK (VAR_TABLE_SIZE - 1)
+
+/* The kinds of value a variable can hold */
+typedef enum {
+    VAR_STRING,
+    VAR_INDEXED,
+    VAR_ASSOC
+} VarType;
+
+/* An item of an associative array; 'key' is NULL in a free slot */
+typedef struct {
+    const char*   key;    /* Interned (see internKey()) */
+    unsigned long hash;
+    char*         value;
+} AssocItem;
+
+/* A variable; 'name' is NULL in a free slot */
+typedef struct {
+    char*      name;
+    VarType    type;
+    char*      value;     /* VAR_STRING */
+    char**     items;     /* VAR_INDEXED: 'length' strings, NULL where unset */
+    size_t     length;
+    AssocItem* slots;     /* VAR_ASSOC: 'capacity' slots */
+    size_t     capacity;  /* Of 'items' or 'slots' */
+    size_t     count;     /* Items set */
+} Var;
+
+/* An interned key; 'string' is NULL in a free slot */
+typedef struct {
+    char*         string;
+    unsigned long hash;
+    size_t        refs;   /* Associative array items with this key */
+} Key;
+
+static Var vars[VAR_TABLE_SIZE];
+static int varCount = 0;
+
+static Key*   keys        = NULL;
+static size_t keyCapacity = 0;
+static size_t keyCount    = 0;
+
+/* Function prototypes */
+static Var*          findVar(const char* name, size_t length, bool create);
+static const char*   getItem(const Var* var, const char* key, size_t keyLength);
+static bool          setItem(Var* var, const char* key, size_t keyLength, const char* value,
+                             size_t valueLength);
+static bool          setIndexed(Var* var, long index, const char* value, size_t valueLength);
+static AssocItem*    findAssoc(Var* var, const char* key, size_t keyLength, bool create);
+static void          growAssoc(Var* var);
+static bool          parseIndex(const Var* var, const char* key, size_t keyLength, long* index);
+static bool          convertVar(Var* var, VarType type);
+static void          clearVar(Var* var);
+static bool          splitAssignment(const char* word, size_t* nameLength, const char** key,
+                                     size_t* keyLength);
+static const char*   internKey(const char* key, size_t length, bool create,
+                               unsigned long* hash);
+static void          releaseKey(const char* key, unsigned long hash);
+static void          growKeys(void);
+static unsigned long hashName(const char* name, size_t length);
+
+/*
+ * isVarName
+ *
+ * Returns true if the 'length' bytes at 'name' make a variable name: a
+ * letter or underscore, then letters, digits and underscores.
+ */
+bool isVarName(const char* name, size_t length) {
+    size_t i;
+
+    if (length == 0 || !(isalpha((unsigned char) name[0]) || name[0] == '_')) {
+        return false;
+    }
+    for (i = 1; i < length; ++i) {
+        if (!(isalnum((unsigned char) name[i]) || name[i] == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * getVar
+ *
+ * Returns the value of the variable named by the 'length' bytes at 'name'
+ * (for an array, its item 0), or NULL if it is not set.  A name the shell
+ * has not set is looked up in the environment.
+ */
+const char* getVar(const char* name, size_t length) {
+    Var* var = findVar(name, length, false);
+    char copy[256];
+
+    if (var != NULL) {
+        return var->type == VAR_STRING ? var->value : getItem(var, "0", 1);
+    }
+
+    if (name[length] == '\0') {
+        return getenv(name);
+    }
+    if (length >= sizeof(copy)) {
+        return NULL;
+    }
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    return getenv(copy);
+}
+
+/*
+ * getArrayItem
+ *
+ * Returns the item of the array named by the 'length' bytes at 'name' that
+ * the 'keyLength' bytes at 'key' pick out, or NULL if it is not set.  For
+ * an indexed array the key is a number (counting from the end if
+ * negative) or the name of a variable holding one; a string variable is
+ * an array of one item.
+ */
+const char* getArrayItem(const char* name, size_t length, const char* key, size_t keyLength) {
+    Var* var = findVar(name, length, false);
+
+    if (var == NULL) {
+        return keyLength == 1 && key[0] == '0' ? getVar(name, length) : NULL;
+    }
+    return getItem(var, key, keyLength);
+}
+
+/*
+ * getArrayCount
+ *
+ * Returns the number of items set in the array named by the 'length'
+ * bytes at 'name' (1 for a string variable that is set).
+ */
+size_t getArrayCount(const char* name, size_t length) {
+    Var* var = findVar(name, length, false);
+
+    if (var == NULL || var->type == VAR_STRING) {
+        return getVar(name, length) != NULL ? 1 : 0;
+    }
+    return var->count;
+}
+
+/*
+ * visitArray
+ *
+ * Calls 'visit' with each item set in the array named by the 'length'
+ * bytes at 'name', or with its key if 'keys' is true: indexed arrays in
+ * order of index, associative ones in no particular order.
+ *
+ * Returns false if 'visit' did.
+ */
+bool visitArray(const char* name, size_t length, bool keys, VarVisitor visit,
+                void* context) {
+    Var*   var = findVar(name, length, false);
+    char   index[24];
+    size_t i;
+
+    if (var == NULL || var->type == VAR_STRING) {
+        const char* value = getVar(name, length);
+
+        return value == NULL || visit(keys ? "0" : value, context);
+    }
+
+    if (var->type == VAR_INDEXED) {
+        for (i = 0; i < var->length; ++i) {
+            if (var->items[i] == NULL) {
+                continue;
+            }
+            snprintf(index, sizeof(index), "%zu", i);
+            if (!visit(keys ? index : var->items[i], context)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    for (i = 0; i < var->capacity; ++i) {
+        if (var->slots[i].key != NULL
+                && !visit(keys ? var->slots[i].key : var->slots[i].value, context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * setVar
+ *
+ * Sets the variable 'name' to (a copy of) the string 'value'; for an
+ * array, sets its item 0.
+ *
+ * Returns false, after printing a message, if there is no room for it.
+ */
+bool setVar(const char* name, const char* value) {
+    Var* var = findVar(name, strlen(name), true);
+
+    if (var == NULL) {
+        fprintf(stderr, "%s: too many variables\n", name);
+        return false;
+    }
+    if (var->type != VAR_STRING) {
+        return setItem(var, "0", 1, value, strlen(value));
+    }
+    clearVar(var);
+    var->value = strdup(value);
+    return true;
+}
+
+/*
+ * setArrayItems
+ *
+ * Makes the variable 'name' an indexed array of the 'count' strings in
+ * 'items', taking over the array and the strings (all malloc()ed).
+ *
+ * Returns false, after printing a message and freeing them, if there is
+ * no room for it.
+ */
+bool setArrayItems(const char* name, char** items, size_t count) {
+    Var*   var = findVar(name, strlen(name), true);
+    size_t i;
+
+    if (var == NULL) {
+        fprintf(stderr, "%s: too many variables\n", name);
+        for (i = 0; i < count; ++i) {
+            free(items[i]);
+        }
+        free(items);
+        return false;
+    }
+    clearVar(var);
+    var->type     = VAR_INDEXED;
+    var->items    = items;
+    var->length   = count;
+    var->capacity = count;
+    var->count    = count;
+    return true;
+}
+
+/*
+ * isAssignment
+ *
+ * Returns true if 'word' is an assignment: a variable name, optionally
+ * with a subscript ([key]), then '=' and a value.
+ */
+bool isAssignment(const char* word) {
+    size_t      nameLength;
+    const char* key;
+    size_t      keyLength;
+
+    return splitAssignment(word, &nameLength, &key, &keyLength);
+}
+
+/*
+ * isListAssignment
+ *
+ * Returns true if 'word' begins an assignment of a list of items to an
+ * array, name=(item ...).  The scanner splits the list into words of its
+ * own (see assignList()).
+ */
+bool isListAssignment(const char* word) {
+    size_t      nameLength;
+    const char* key;
+    size_t      keyLength;
+
+    return splitAssignment(word, &nameLength, &key, &keyLength) && key == NULL
+           && word[nameLength + 1] == '(';
+}
+
+/*
+ * assignVar
+ *
+ * Carries out the assignment 'word' (see isAssignment()).
+ *
+ * Returns false, after printing a message, if it cannot be.
+ */
+bool assignVar(const char* word) {
+    size_t      nameLength;
+    const char* key;
+    size_t      keyLength;
+    const char* value;
+    Var*        var;
+
+    if (!splitAssignment(word, &nameLength, &key, &keyLength)) {
+        return false;
+    }
+    if ((var = findVar(word, nameLength, true)) == NULL) {
+        fprintf(stderr, "%.*s: too many variables\n", (int) nameLength, word);
+        return false;
+    }
+
+    value = key == NULL ? word + nameLength + 1 : key + keyLength + 2;
+    if (key == NULL) {
+        return setVar(var->name, value);
+    }
+    if (var->type == VAR_STRING && !convertVar(var, VAR_INDEXED)) {
+        return false;
+    }
+    return setItem(var, key, keyLength, value, strlen(value));
+}
+
+/*
+ * assignList
+ *
+ * Carries out the list assignment name=(item ...) that starts with
+ * 'words[0]' (see isListAssignment()) and goes on to the first unquoted
+ * word ending in ')'; 'quotes' holds the quote each word had.  The items
+ * replace the array's: an indexed array takes them in order, or at the
+ * index given as [index]=item; an associative array needs [key]=item.
+ *
+ * Returns the number of words the assignment took, or -1 after printing a
+ * message if it could not be carried out.
+ */
+int assignList(char** words, const char* quotes) {
+    size_t      nameLength;
+    const char* key;
+    size_t      keyLength;
+    Var*        var;
+    VarType     type;
+    long        next = 0;  /* The index the next unsubscripted item goes at */
+    bool        done = true;
+    int         i;
+
+    splitAssignment(words[0], &nameLength, &key, &keyLength);
+    if ((var = findVar(words[0], nameLength, true)) == NULL) {
+        fprintf(stderr, "%.*s: too many variables\n", (int) nameLength, words[0]);
+        return -1;
+    }
+    type = var->type == VAR_ASSOC ? VAR_ASSOC : VAR_INDEXED;
+    clearVar(var);
+    var->type = type;
+
+    for (i = 0; words[i] != NULL; ++i) {
+        const char* item   = i == 0 ? words[0] + nameLength + 2 : words[i];
+        size_t      length = strlen(item);
+        bool        quoted = i > 0 && quotes[i] != '\0';
+        bool        last   = !quoted && length > 0 && item[length - 1] == ')';
+        const char* close  = NULL;
+
+        if (last) {
+            length--;
+        }
+        if (!quoted && length > 0 && item[0] == '[') {
+            close = memmem(item, length, "]=", 2);
+        }
+
+        if (close != NULL) {
+            key       = item + 1;
+            keyLength = (size_t) (close - key);
+            if (var->type == VAR_ASSOC) {
+                if (!setItem(var, key, keyLength, close + 2, length - keyLength - 3)) {
+                    done = false;
+                }
+            } else if (!parseIndex(var, key, keyLength, &next)
+                       || !setIndexed(var, next++, close + 2, length - keyLength - 3)) {
+                done = false;
+            }
+        } else if (length > 0 || quoted) {
+            if (var->type == VAR_ASSOC) {
+                fprintf(stderr, "%s: %.*s: an associative array item needs a [key]\n",
+                        var->name, (int) length, item);
+                done = false;
+            } else if (!setIndexed(var, next++, item, length)) {
+                done = false;
+            }
+        }
+        if (last) {
+            return done ? i + 1 : -1;
+        }
+    }
+    return done ? i : -1;
+}
+
+/*
+ * doDeclare
+ *
+ * Implements the built-in 'declare' command:
+ *
+ *     declare [-a | -A] name[=value] ...
+ *
+ * Declares each variable 'name' (-a as an indexed array, -A as an
+ * associative one), optionally assigning it a value.  A string variable
+ * declared an array becomes its item 0.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *
+ * Returns the exit status of the command.
+ */
+int doDeclare(char** args) {
+    VarType type   = VAR_STRING;
+    int     status = 0;
+    int     i      = 1;
+
+    if (args[1] != NULL && (strcmp(args[1], "-a") == 0 || strcmp(args[1], "-A") == 0)) {
+        type = args[1][1] == 'a' ? VAR_INDEXED : VAR_ASSOC;
+        i++;
+    }
+    if (args[i] == NULL) {
+        printf("usage: declare [-a | -A] name[=value] ...\n");
+        return 1;
+    }
+
+    for (; args[i] != NULL; ++i) {
+        size_t      nameLength = strcspn(args[i], "=[");
+        const char* key;
+        size_t      keyLength;
+        Var*        var;
+
+        if (!isVarName(args[i], nameLength)
+                || (args[i][nameLength] != '\0'
+                    && !splitAssignment(args[i], &nameLength, &key, &keyLength))) {
+            fprintf(stderr, "declare: %s: not a valid name\n", args[i]);
+            status = 1;
+        } else if ((var = findVar(args[i], nameLength, true)) == NULL) {
+            fprintf(stderr, "%.*s: too many variables\n", (int) nameLength, args[i]);
+            status = 1;
+        } else if ((type != VAR_STRING && !convertVar(var, type))
+                   || (args[i][nameLength] != '\0' && !assignVar(args[i]))) {
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/*
+ * findVar
+ *
+ * Returns the variable named by the 'length' bytes at 'name'.  If there is
+ * none, returns NULL, or with 'create' a new, empty string variable (NULL
+ * if the table is half full already).
+ */
+static Var* findVar(const char* name, size_t length, bool create) {
+    size_t slot = hashName(name, length) & VAR_TABLE_MASK;
+
+    while (vars[slot].name != NULL) {
+        if (strncmp(vars[slot].name, name, length) == 0 && vars[slot].name[length] == '\0') {
+            return &vars[slot];
+        }
+        slot = (slot + 1) & VAR_TABLE_MASK;
+    }
+
+    if (!create || varCount >= VAR_TABLE_SIZE / 2) {
+        return NULL;
+    }
+    varCount++;
+    memset(&vars[slot], 0, sizeof(Var));
+    vars[slot].name = strndup(name, length);
+    vars[slot].type = VAR_STRING;
+    return &vars[slot];
+}
+
+/*
+ * getItem
+ *
+ * Returns the item of 'var' the 'keyLength' bytes at 'key' pick out (see
+ * getArrayItem()), or NULL if it is not set.
+ */
+static const char* getItem(const Var* var, const char* key, size_t keyLength) {
+    AssocItem* item;
+    long       index;
+
+    switch (var->type) {
+    case VAR_ASSOC:
+        item = findAssoc((Var*) var, key, keyLength, false);
+        return item != NULL ? item->value : NULL;
+    case VAR_INDEXED:
+        if (!parseIndex(var, key, keyLength, &index) || (size_t) index >= var->length) {
+            return NULL;
+        }
+        return var->items[index];
+    default:
+        return parseIndex(var, key, keyLength, &index) && index == 0 ? var->value : NULL;
+    }
+}
+
+/*
+ * setItem
+ *
+ * Sets the item of the array 'var' the 'keyLength' bytes at 'key' pick out
+ * to (a copy of) the 'valueLength' bytes at 'value'.
+ *
+ * Returns false, after printing a message, if the key is no good.
+ */
+static bool setItem(Var* var, const char* key, size_t keyLength, const char* value,
+                    size_t valueLength) {
+    AssocItem* item;
+    long       index;
+
+    if (var->type == VAR_ASSOC) {
+        item = findAssoc(var, key, keyLength, true);
+        free(item->value);
+        item->value = strndup(value, valueLength);
+        return true;
+    }
+    return parseIndex(var, key, keyLength, &index) && setIndexed(var, index, value, valueLength);
+}
+
+/*
+ * setIndexed
+ *
+ * Sets item 'index' of the indexed array 'var' to (a copy of) the
+ * 'valueLength' bytes at 'value', growing the array to take it.
+ *
+ * Returns false, after printing a message, if the index is too large.
+ */
+static bool setIndexed(Var* var, long index, const char* value, size_t valueLength) {
+    if (index >= VAR_INDEX_LIMIT) {
+        fprintf(stderr, "%s[%ld]: array index too large\n", var->name, index);
+        return false;
+    }
+
+    if ((size_t) index >= var->capacity) {
+        size_t capacity = var->capacity < 8 ? 8 : var->capacity;
+
+        while (capacity <= (size_t) index) {
+            capacity *= 2;
+        }
+        var->items = realloc(var->items, capacity * sizeof(char*));
+        memset(var->items + var->capacity, 0, (capacity - var->capacity) * sizeof(char*));
+        var->capacity = capacity;
+    }
+    if ((size_t) index >= var->length) {
+        var->length = (size_t) index + 1;
+    }
+
+    if (var->items[index] == NULL) {
+        var->count++;
+    }
+    free(var->items[index]);
+    var->items[index] = strndup(value, valueLength);
+    return true;
+}
+
+/*
+ * findAssoc
+ *
+ * Returns the item of the associative array 'var' with the key given by
+ * the 'keyLength' bytes at 'key'.  If there is none, returns NULL, or with
+ * 'create' a new item with no value.
+ */
+static AssocItem* findAssoc(Var* var, const char* key, size_t keyLength, bool create) {
+    unsigned long hash;
+    const char*   interned = internKey(key, keyLength, create, &hash);
+    size_t        slot;
+
+    /* A key that was never interned is in no array */
+    if (interned == NULL) {
+        return NULL;
+    }
+    if (create && (var->count + 1) * 2 > var->capacity) {
+        growAssoc(var);
+    }
+    if (var->capacity == 0) {
+        return NULL;
+    }
+
+    for (slot = hash & (var->capacity - 1); var->slots[slot].key != NULL;
+         slot = (slot + 1) & (var->capacity - 1)) {
+        if (var->slots[slot].key == interned) {
+            if (create) {
+                releaseKey(interned, hash);
+            }
+            return &var->slots[slot];
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    var->count++;
+    var->slots[slot].key   = interned;
+    var->slots[slot].hash  = hash;
+    var->slots[slot].value = NULL;
+    return &var->slots[slot];
+}
+
+/*
+ * growAssoc
+ *
+ * Doubles the slots of the associative array 'var' (or gives it its first
+ * ones), moving the items over.
+ */
+static void growAssoc(Var* var) {
+    AssocItem* old      = var->slots;
+    size_t     capacity = var->capacity == 0 ? VAR_ASSOC_SIZE : var->capacity * 2;
+    size_t     slot;
+    size_t     i;
+
+    var->slots = calloc(capacity, sizeof(AssocItem));
+    for (i = 0; i < var->capacity; ++i) {
+        if (old[i].key == NULL) {
+            continue;
+        }
+        for (slot = old[i].hash & (capacity - 1); var->slots[slot].key != NULL;
+             slot = (slot + 1) & (capacity - 1)) {
+        }
+        var->slots[slot] = old[i];
+    }
+    var->capacity = capacity;
+    free(old);
+}
+
+/*
+ * parseIndex
+ *
+ * Sets '*index' to the index of the array 'var' the 'keyLength' bytes at
+ * 'key' give: a number, or the name of a variable holding one, counting
+ * back from the end if negative.
+ *
+ * Returns false, after printing a message, if there is no such index.
+ */
+static bool parseIndex(const Var* var, const char* key, size_t keyLength, long* index) {
+    char        digits[24];
+    char*       end;
+    const char* number = key;
+    size_t      length = keyLength;
+
+    if (isVarName(key, keyLength)) {
+        if ((number = getVar(key, keyLength)) == NULL) {
+            number = "0";
+        }
+        length = strlen(number);
+    }
+    if (length > 0 && length < sizeof(digits)) {
+        memcpy(digits, number, length);
+        digits[length] = '\0';
+        *index         = strtol(digits, &end, 10);
+        if (*index < 0) {
+            *index += (long) (var->type == VAR_INDEXED ? var->length : 1);
+        }
+        if (*end == '\0' && *index >= 0) {
+            return true;
+        }
+    }
+    fprintf(stderr, "%s[%.*s]: bad array subscript\n", var->name, (int) keyLength, key);
+    return false;
+}
+
+/*
+ * convertVar
+ *
+ * Makes 'var' a variable of 'type', a string variable's value becoming
+ * item 0 of an array.
+ *
+ * Returns false, after printing a message, if it is an array of the other
+ * kind already.
+ */
+static bool convertVar(Var* var, VarType type) {
+    char* value = var->value;
+    bool  done  = true;
+
+    if (var->type == type) {
+        return true;
+    }
+    if (var->type != VAR_STRING) {
+        fprintf(stderr, "%s: cannot convert between indexed and associative arrays\n",
+                var->name);
+        return false;
+    }
+
+    var->value = NULL;
+    var->type  = type;
+    if (value != NULL) {
+        done = setItem(var, "0", 1, value, strlen(value));
+    }
+    free(value);
+    return done;
+}
+
+/*
+ * clearVar
+ *
+ * Frees the value of 'var', leaving it an unset string.
+ */
+static void clearVar(Var* var) {
+    size_t i;
+
+    for (i = 0; i < var->length; ++i) {
+        free(var->items[i]);
+    }
+    for (i = 0; var->slots != NULL && i < var->capacity; ++i) {
+        if (var->slots[i].key != NULL) {
+            releaseKey(var->slots[i].key, var->slots[i].hash);
+            free(var->slots[i].value);
+        }
+    }
+    free(var->items);
+    free(var->slots);
+    free(var->value);
+    var->type     = VAR_STRING;
+    var->value    = NULL;
+    var->items    = NULL;
+    var->length   = 0;
+    var->slots    = NULL;
+    var->capacity = 0;
+    var->count    = 0;
+}
+
+/*
+ * splitAssignment
+ *
+ * If 'word' is an assignment (see isAssignment()), sets '*nameLength' to
+ * the length of the name at its start and '*key' and '*keyLength' to its
+ * subscript ('*key' NULL if it has none).  The value follows the '='
+ * after them.
+ *
+ * Returns false if it is not an assignment.
+ */
+static bool splitAssignment(const char* word, size_t* nameLength, const char** key,
+                            size_t* keyLength) {
+    const char* close;
+
+    *nameLength = strcspn(word, "=[");
+    *key        = NULL;
+    if (!isVarName(word, *nameLength)) {
+        return false;
+    }
+    if (word[*nameLength] == '=') {
+        return true;
+    }
+    if (word[*nameLength] != '[' || (close = strstr(word + *nameLength, "]=")) == NULL) {
+        return false;
+    }
+    *key       = word + *nameLength + 1;
+    *keyLength = (size_t) (close - *key);
+    return true;
+}
+
+/*
+ * internKey
+ *
+ * Returns the interned copy of the key given by the 'length' bytes at
+ * 'key', and sets '*hash' to its hash.  With 'create' the key is interned
+ * if it is not already, and the caller holds a reference to it (see
+ * releaseKey()); otherwise NULL is returned for a key not interned.
+ */
+static const char* internKey(const char* key, size_t length, bool create,
+                             unsigned long* hash) {
+    size_t slot;
+
+    *hash = hashName(key, length);
+    if (create && (keyCount + 1) * 2 > keyCapacity) {
+        growKeys();
+    }
+    if (keyCapacity == 0) {
+        return NULL;
+    }
+
+    for (slot = *hash & (keyCapacity - 1); keys[slot].string != NULL;
+         slot = (slot + 1) & (keyCapacity - 1)) {
+        if (keys[slot].hash == *hash && strncmp(keys[slot].string, key, length) == 0
+                && keys[slot].string[length] == '\0') {
+            keys[slot].refs += create ? 1 : 0;
+            return keys[slot].string;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    keyCount++;
+    keys[slot].string = strndup(key, length);
+    keys[slot].hash   = *hash;
+    keys[slot].refs   = 1;
+    return keys[slot].string;
+}
+
+/*
+ * releaseKey
+ *
+ * Drops a reference to the interned key 'key' (with hash 'hash'), freeing
+ * it when no array uses it any more.
+ */
+static void releaseKey(const char* key, unsigned long hash) {
+    size_t mask = keyCapacity - 1;
+    size_t hole;
+    size_t next;
+
+    for (hole = hash & mask; keys[hole].string != key; hole = (hole + 1) & mask) {
+    }
+    if (--keys[hole].refs > 0) {
+        return;
+    }
+
+    /* Close the gap, moving back each key after it that probed past it */
+    keyCount--;
+    free(keys[hole].string);
+    keys[hole].string = NULL;
+    for (next = (hole + 1) & mask; keys[next].string != NULL; next = (next + 1) & mask) {
+        size_t home = keys[next].hash & mask;
+
+        if (next > hole ? (home <= hole || home > next) : (home <= hole && home > next)) {
+            keys[hole]        = keys[next];
+            keys[next].string = NULL;
+            hole              = next;
+        }
+    }
+}
+
+/*
+ * growKeys
+ *
+ * Doubles the table of interned keys (or makes it), moving the keys over.
+ */
+static void growKeys(void) {
+    Key*   old      = keys;
+    size_t capacity = keyCapacity == 0 ? VAR_KEYS_SIZE : keyCapacity * 2;
+    size_t slot;
+    size_t i;
+
+    keys = calloc(capacity, sizeof(Key));
+    for (i = 0; i < keyCapacity; ++i) {
+        if (old[i].string == NULL) {
+            continue;
+        }
+        for (slot = old[i].hash & (capacity - 1); keys[slot].string != NULL;
+             slot = (slot + 1) & (capacity - 1)) {
+        }
+        keys[slot] = old[i];
+    }
+    keyCapacity = capacity;
+    free(old);
+}
+
+/*
+ * hashName
+ *
+ * Returns the FNV-1a hash of the 'length' bytes at 'name'.
+ */
+static unsigned long hashName(const char* name, size_t length) {
+    unsigned long hash = 2166136261UL;
+    size_t        i;
+
+    for (i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char) name[i]) * 16777619UL;
+    }
+    return hash;
+}
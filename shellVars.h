@@ -0,0 +1,45 @@
+/*
+ * shellVars.h
+ *
+ * Shell variables, set by assignments (name=value) and by builtins such
+ * as 'read' and 'mapfile', and expanded in words ($name, ${name}).  A
+ * variable holds a string or an array of them: an indexed array (as
+ * 'mapfile' fills, or name=(a b c) and name[i]=value set) or an
+ * associative one, keyed by strings (declared with 'declare -A').  Names
+ * the shell has not set are looked up in the environment.
+ */
+#ifndef SHELL_VARS_H
+#define SHELL_VARS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Slots in the variable table (a power of two); at most half are used */
+#define VAR_TABLE_SIZE 1024
+
+/* Slots an associative array starts with, and the table of keys (powers of two) */
+#define VAR_ASSOC_SIZE 8
+#define VAR_KEYS_SIZE  256
+
+/* Indexed arrays are stored densely, so their indexes are kept below this */
+#define VAR_INDEX_LIMIT (1024 * 1024)
+
+/* Called with each item (or key) of an array; returns false to stop */
+typedef bool (*VarVisitor)(const char* item, void* context);
+
+/* Function prototypes */
+bool        isVarName(const char* name, size_t length);
+const char* getVar(const char* name, size_t length);
+const char* getArrayItem(const char* name, size_t length, const char* key, size_t keyLength);
+size_t      getArrayCount(const char* name, size_t length);
+bool        visitArray(const char* name, size_t length, bool keys, VarVisitor visit,
+                       void* context);
+bool        setVar(const char* name, const char* value);
+bool        setArrayItems(const char* name, char** items, size_t count);
+bool        isAssignment(const char* word);
+bool        isListAssignment(const char* word);
+bool        assignVar(const char* word);
+int         assignList(char** words, const char* quotes);
+int         doDeclare(char** args);
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * shellWalk.c
+ *
+ * Directory traversal (see shellWalk.h).  Entries are stat'ed with statx()
+ * relative to the directory's descriptor, asking only for the fields the
+ * caller needs; when the caller needs nothing and the file system reports
+ * entry types, no stat call is made at all.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "shellWalk.h"
+#include "shellFd.h"
+#include "shellDirs.h"
+
+/* Function prototypes */
+static unsigned char typeFromMode(unsigned int mode);
+static bool          walkDir(WalkDir* dir, unsigned int mask, int flags,
+                             WalkCallback callback, void* context);
+
+/*
+ * readWalkDir
+ *
+ * Reads the directory 'name' (relative to 'parentFd') into 'dir'.
+ *
+ * parentFd - Descriptor the name is relative to (or AT_FDCWD)
+ * name     - The directory to read
+ * path     - What to call the directory in messages and in dir->path
+ * mask     - STATX_* fields wanted for each entry (0 for names only)
+ * flags    - WALK_ALL to include dot files
+ *
+ * Returns false, after printing a message, if the directory can't be read.
+ * On success the caller must call freeWalkDir().
+ */
+bool readWalkDir(int parentFd, const char* name, const char* path,
+                 unsigned int mask, int flags, WalkDir* dir) {
+    DIR*           stream = NULL;
+    struct dirent* entry;
+    size_t         capacity      = 64;
+    size_t         namesSize     = 0;
+    size_t         namesCapacity = 4096;
+    size_t         i;
+    int            fd;
+    int            streamFd = -1;
+
+    /* The stream gets its own copy of the descriptor, which closedir() closes */
+    fd = shellTrack(openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd >= 0 && (streamFd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) >= 0) {
+        stream = fdopendir(streamFd);
+    }
+    if (stream == NULL) {
+        perror(path);
+        if (streamFd >= 0) {
+            close(streamFd);
+        }
+        if (fd >= 0) {
+            shellClose(fd);
+        }
+        return false;
+    }
+
+    dir->path    = strdup(path);
+    dir->dirFd   = fd;
+    dir->count   = 0;
+    dir->entries = malloc(capacity * sizeof(WalkEntry));
+    dir->names   = malloc(namesCapacity);
+
+    while ((entry = readdir(stream)) != NULL) {
+        size_t length = strlen(entry->d_name) + 1;
+
+        if (entry->d_name[0] == '.' && !(flags & WALK_ALL)) {
+            continue;
+        }
+
+        if (dir->count == capacity) {
+            capacity    *= 2;
+            dir->entries = realloc(dir->entries, capacity * sizeof(WalkEntry));
+        }
+        if (namesSize + length > namesCapacity) {
+            while (namesSize + length > namesCapacity) {
+                namesCapacity *= 2;
+            }
+            dir->names = realloc(dir->names, namesCapacity);
+        }
+
+        memcpy(dir->names + namesSize, entry->d_name, length);
+        /* Stash the arena offset; it becomes a pointer once reading is done */
+        dir->entries[dir->count].name = (const char*) (uintptr_t) namesSize;
+        dir->entries[dir->count].type = entry->d_type;
+        dir->count++;
+        namesSize += length;
+    }
+
+    for (i = 0; i < dir->count; ++i) {
+        WalkEntry*   walkEntry = &dir->entries[i];
+        unsigned int want      = mask;
+
+        walkEntry->name = dir->names + (uintptr_t) walkEntry->name;
+        if (walkEntry->type == DT_UNKNOWN) {
+            want |= STATX_TYPE;
+        }
+
+        memset(&walkEntry->stx, 0, sizeof(walkEntry->stx));
+        if (want != 0) {
+            if (statx(fd, walkEntry->name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                      want, &walkEntry->stx) < 0) {
+                perror(walkEntry->name);
+            } else if (walkEntry->type == DT_UNKNOWN) {
+                walkEntry->type = typeFromMode(walkEntry->stx.stx_mode);
+            }
+        }
+        if (walkEntry->type == DT_UNKNOWN) {
+            walkEntry->type = DT_REG;
+        }
+    }
+
+    closedir(stream);
+    return true;
+}
+
+/*
+ * freeWalkDir
+ *
+ * Releases everything readWalkDir() allocated.
+ */
+void freeWalkDir(WalkDir* dir) {
+    if (dir->dirFd >= 0) {
+        shellClose(dir->dirFd);
+    }
+    free(dir->entries);
+    free(dir->names);
+    free(dir->path);
+    dir->entries = NULL;
+    dir->names   = NULL;
+    dir->path    = NULL;
+    dir->dirFd   = -1;
+}
+
+/*
+ * walkTree
+ *
+ * Reads the directory 'path' and passes it to 'callback'; with
+ * WALK_RECURSIVE, does the same for every subdirectory (symbolic links are
+ * not followed), depth first, in the order the callback leaves the entries.
+ *
+ * Returns false if the callback stopped the walk or 'path' can't be read.
+ */
+bool walkTree(const char* path, unsigned int mask, int flags,
+              WalkCallback callback, void* context) {
+    WalkDir dir;
+    bool    result;
+
+    if (!readWalkDir(cwdDirFd(), path, path, mask, flags, &dir)) {
+        return false;
+    }
+    result = walkDir(&dir, mask, flags, callback, context);
+    freeWalkDir(&dir);
+    return result;
+}
+
+/*
+ * joinPath
+ *
+ * Returns a newly allocated "dir/name".
+ */
+char* joinPath(const char* dir, const char* name) {
+    size_t dirLength = strlen(dir);
+    size_t length    = dirLength + strlen(name) + 2;
+    char*  path      = malloc(length);
+
+    if (dirLength > 0 && dir[dirLength - 1] == '/') {
+        snprintf(path, length, "%s%s", dir, name);
+    } else {
+        snprintf(path, length, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+/*
+ * walkDir
+ *
+ * Hands 'dir' to the callback and then, if recursing, walks each of its
+ * subdirectories.
+ */
+static bool walkDir(WalkDir* dir, unsigned int mask, int flags,
+                    WalkCallback callback, void* context) {
+    size_t i;
+
+    if (!callback(dir, context)) {
+        return false;
+    }
+    if (!(flags & WALK_RECURSIVE)) {
+        return true;
+    }
+
+    for (i = 0; i < dir->count; ++i) {
+        const WalkEntry* entry = &dir->entries[i];
+        WalkDir          subdir;
+        char*            path;
+        bool             keepGoing = true;
+
+        if (entry->type != DT_DIR || strcmp(entry->name, ".") == 0
+                || strcmp(entry->name, "..") == 0) {
+            continue;
+        }
+
+        path = joinPath(dir->path, entry->name);
+        if (readWalkDir(dir->dirFd, entry->name, path, mask, flags, &subdir)) {
+            keepGoing = walkDir(&subdir, mask, flags, callback, context);
+            freeWalkDir(&subdir);
+        }
+        free(path);
+
+        if (!keepGoing) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * typeFromMode
+ *
+ * Converts the file type bits of a mode into a DT_* value.
+ */
+static unsigned char typeFromMode(unsigned int mode) {
+    switch (mode & S_IFMT) {
+    case S_IFDIR:  return DT_DIR;
+    case S_IFLNK:  return DT_LNK;
+    case S_IFCHR:  return DT_CHR;
+    case S_IFBLK:  return DT_BLK;
+    case S_IFIFO:  return DT_FIFO;
+    case S_IFSOCK: return DT_SOCK;
+    default:       return DT_REG;
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * shellWalk.h
+ *
+ * The shell's directory traversal engine.  A directory is read in one go
+ * into a WalkDir (names in a single arena, plus whatever statx() fields
+ * the caller asked for), handed to a callback, and then -- for recursive
+ * walks -- its subdirectories are visited in the order the callback left
+ * the entries in.
+ */
+#ifndef SHELL_WALK_H
+#define SHELL_WALK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* Flags for walkTree() */
+#define WALK_ALL       0x1  /* Include names starting with '.' */
+#define WALK_RECURSIVE 0x2  /* Descend into subdirectories */
+
+typedef struct {
+    const char*   name;
+    unsigned char type;  /* DT_* (never DT_UNKNOWN) */
+    struct statx  stx;   /* Only the fields asked for are valid */
+} WalkEntry;
+
+typedef struct {
+    char*      path;     /* The directory, as given or joined from the root */
+    int        dirFd;    /* Open for the duration of the callback */
+    WalkEntry* entries;
+    size_t     count;
+    char*      names;    /* Arena holding every entry's name */
+} WalkDir;
+
+/*
+ * Called once per directory.  May reorder (but not remove) entries.
+ * Returns false to stop the walk.
+ */
+typedef bool (*WalkCallback)(WalkDir* dir, void* context);
+
+/* Function prototypes */
+bool readWalkDir(int parentFd, const char* name, const char* path,
+                 unsigned int mask, int flags, WalkDir* dir);
+void freeWalkDir(WalkDir* dir);
+bool walkTree(const char* path, unsigned int mask, int flags,
+              WalkCallback callback, void* context);
+char* joinPath(const char* dir, const char* name);
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * shellXargs.c
+ *
+ * Implements a built-in version of the 'xargs' command:
+ *
+ *     xargs [-0] [-n max] [-P procs] [-v] [command [initial-arguments]]
+ *
+ * Arguments are read from standard input, separated by blanks and newlines
+ * (no quote processing), or by NUL bytes with -0.  Each command gets as
+ * many of them as fit under the kernel's ARG_MAX once the environment and
+ * the initial arguments are accounted for, or at most 'max' with -n.  A
+ * command named without a slash is looked up on $PATH once, through the
+ * shell's command cache (see findCommand()); it defaults to /bin/echo.
+ *
+ * Commands are started with posix_spawn(), with standard input redirected
+ * from /dev/null; -P runs up to 'procs' of them at once (0 for one per
+ * CPU).  -v reports how many exec calls were made against one per
+ * argument.
+ *
+ * The exit status follows GNU xargs: 123 if any command failed, 124 if one
+ * exited with 255 (which stops xargs), 125 if one was killed by a signal,
+ * and 126 or 127 if the command couldn't be run.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include "shellXargs.h"
+#include "shellRedirect.h"
+#include "shellJobs.h"
+#include "shellPath.h"
+
+extern char** environ;
+
+/* Everything one 'xargs' invocation keeps track of */
+typedef struct {
+    char**  fixed;          /* The command and its initial arguments */
+    size_t  fixedCount;
+    const char* program;    /* The command, found on $PATH */
+    char    found[PATH_MAX];   /* Where 'program' points if it was */
+    char*   text;           /* Text of the pending arguments, NUL-separated */
+    size_t  textLength;
+    size_t  textCapacity;
+    size_t* offsets;        /* Where each pending argument starts in 'text' */
+    size_t  count;          /* Number of pending arguments */
+    size_t  offsetCapacity;
+    char**  argv;           /* Built from the above for each spawn */
+    size_t  argvCapacity;
+    size_t  baseSize;       /* Bytes of environment and initial arguments */
+    size_t  size;           /* ...plus the pending arguments */
+    size_t  limit;          /* Most bytes a batch may use */
+    size_t  maxArgLength;   /* Longest single argument the kernel accepts */
+    size_t  maxItems;       /* -n, or 0 for no limit */
+    int     maxProcs;       /* -P */
+    pid_t   running[XARGS_MAX_PROCS];
+    int     runningCount;
+    size_t  items;          /* Arguments read */
+    size_t  execs;          /* Commands started */
+    int     status;         /* Exit status so far */
+    bool    stop;           /* Don't start any more commands */
+    posix_spawn_file_actions_t fileActions;
+} XargsState;
+
+/* Function prototypes */
+static size_t argSize(size_t length);
+static void   appendByte(XargsState* state, char c);
+static void   endArgument(XargsState* state, size_t start);
+static void   spawnBatch(XargsState* state);
+static void   waitForChild(XargsState* state);
+static bool   parseCount(const char* text, const char* option, size_t* value);
+
+/*
+ * doXargs
+ *
+ * Implements the built-in 'xargs' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        Options come first; the first argument that isn't one is the
+ *        command to run, and the rest are passed to it ahead of the
+ *        arguments read.
+ *
+ * Returns the exit status of the command.
+ */
+int doXargs(char** args) {
+    static char* defaultCommand[] = { "/bin/echo", NULL };
+    XargsState   state;
+    FdActionList actions    = { .count = 0 };
+    bool         nulls      = false;
+    bool         report     = false;
+    size_t       envSize    = 0;
+    size_t       start      = 0;     /* Where the argument being read began */
+    bool         inArgument = false;
+    char*        buffer;
+    ssize_t      length;
+    size_t       i;
+    long         argMax;
+    int          arg;
+
+    memset(&state, 0, sizeof(state));
+    state.maxProcs = 1;
+
+    for (arg = 1; args[arg] != NULL && args[arg][0] == '-' && args[arg][1] != '\0'; ++arg) {
+        const char* option = args[arg] + 1;
+
+        if (strcmp(args[arg], "--") == 0) {
+            ++arg;
+            break;
+        }
+        for (; *option != '\0'; ++option) {
+            const char* value;
+
+            if (*option == '0') {
+                nulls = true;
+                continue;
+            } else if (*option == 'v') {
+                report = true;
+                continue;
+            } else if (*option != 'n' && *option != 'P') {
+                printf("xargs: invalid option -- '%c'\n", *option);
+                printf("usage: xargs [-0v] [-n max] [-P procs] [command [argument ...]]\n");
+                return 1;
+            }
+
+            /* -n and -P take a value, attached or not */
+            value = option[1] != '\0' ? option + 1 : args[++arg];
+            if (value == NULL) {
+                printf("usage: xargs [-0v] [-n max] [-P procs] [command [argument ...]]\n");
+                return 1;
+            }
+            if (*option == 'n') {
+                if (!parseCount(value, "-n", &state.maxItems)) {
+                    return 1;
+                }
+                if (state.maxItems == 0) {
+                    printf("xargs: -n must be at least 1\n");
+                    return 1;
+                }
+            } else {
+                size_t procs;
+
+                if (!parseCount(value, "-P", &procs)) {
+                    return 1;
+                }
+                if (procs == 0) {
+                    procs = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                state.maxProcs = procs > XARGS_MAX_PROCS ? XARGS_MAX_PROCS : (int) procs;
+            }
+            break;
+        }
+    }
+
+    state.fixed = args[arg] != NULL ? &args[arg] : defaultCommand;
+    while (state.fixed[state.fixedCount] != NULL) {
+        state.fixedCount++;
+    }
+    state.program = findCommand(state.fixed[0], state.found, sizeof(state.found));
+    if (state.program == NULL) {
+        fprintf(stderr, "xargs: %s: command not found\n", state.fixed[0]);
+        return 127;
+    }
+
+    /* The kernel charges for every string and pointer in argv and envp */
+    argMax = sysconf(_SC_ARG_MAX);
+    for (i = 0; environ[i] != NULL; ++i) {
+        envSize += argSize(strlen(environ[i]));
+    }
+    state.size = envSize + 2 * sizeof(char*);
+    for (i = 0; i < state.fixedCount; ++i) {
+        state.size += argSize(strlen(state.fixed[i]));
+    }
+    state.baseSize     = state.size;
+    state.limit        = argMax > XARGS_HEADROOM ? (size_t) argMax - XARGS_HEADROOM : 0;
+    state.maxArgLength = 32 * (size_t) sysconf(_SC_PAGESIZE) - 1;
+    if (state.size >= state.limit) {
+        fprintf(stderr, "xargs: environment and arguments leave no room under ARG_MAX\n");
+        return 1;
+    }
+
+    /* The commands get /dev/null as standard input; ours is the argument list */
+    if (!addRedirection(&actions, "<", "/dev/null")
+            || posix_spawn_file_actions_init(&state.fileActions) != 0
+            || addSpawnFileActions(&actions, &state.fileActions) != 0) {
+        fprintf(stderr, "xargs: can't set up file actions\n");
+        return 1;
+    }
+
+    fflush(stdout);
+    buffer = malloc(XARGS_READ_SIZE);
+
+    while (!state.stop && (length = read(STDIN_FILENO, buffer, XARGS_READ_SIZE)) != 0) {
+        ssize_t j;
+
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("xargs: read");
+            state.status = 1;
+            break;
+        }
+
+        for (j = 0; j < length && !state.stop; ++j) {
+            char c         = buffer[j];
+            bool separator = nulls ? c == '\0' : (c == ' ' || c == '\t' || c == '\n');
+
+            if (!separator) {
+                if (!inArgument) {
+                    start      = state.textLength;
+                    inArgument = true;
+                }
+                appendByte(&state, c);
+            } else if (inArgument) {
+                endArgument(&state, start);
+                inArgument = false;
+            }
+        }
+    }
+    if (inArgument && !state.stop) {
+        endArgument(&state, start);
+    }
+    if (state.count > 0 && !state.stop) {
+        spawnBatch(&state);
+    }
+    while (state.runningCount > 0) {
+        waitForChild(&state);
+    }
+
+    if (report) {
+        fprintf(stderr, "xargs: %zu arguments in %zu exec calls (%zu saved)\n",
+                state.items, state.execs,
+                state.items > state.execs ? state.items - state.execs : 0);
+    }
+
+    posix_spawn_file_actions_destroy(&state.fileActions);
+    free(buffer);
+    free(state.text);
+    free(state.offsets);
+    free(state.argv);
+    return state.status;
+}
+
+/*
+ * argSize
+ *
+ * Returns what an argument of 'length' characters costs against ARG_MAX:
+ * the string, its NUL and its pointer.
+ */
+static size_t argSize(size_t length) {
+    return length + 1 + sizeof(char*);
+}
+
+/*
+ * appendByte
+ *
+ * Adds 'c' to the text of the argument being read.
+ */
+static void appendByte(XargsState* state, char c) {
+    if (state->textLength == state->textCapacity) {
+        state->textCapacity = state->textCapacity ? state->textCapacity * 2 : 4096;
+        state->text         = realloc(state->text, state->textCapacity);
+    }
+    state->text[state->textLength++] = c;
+}
+
+/*
+ * endArgument
+ *
+ * Finishes the argument that began at 'start' in the text.  If it won't fit
+ * in the pending batch, the batch is run first and the argument starts the
+ * next one.
+ */
+static void endArgument(XargsState* state, size_t start) {
+    size_t length = state->textLength - start;
+    size_t size   = argSize(length);
+
+    appendByte(state, '\0');
+    state->items++;
+
+    if (state->count > 0 && (state->size + size > state->limit
+                             || (state->maxItems != 0 && state->count == state->maxItems))) {
+        spawnBatch(state);
+        if (state->stop) {
+            return;
+        }
+
+        /* Move this argument to the front for the next batch */
+        memmove(state->text, state->text + start, length + 1);
+        state->textLength = length + 1;
+        start             = 0;
+    }
+
+    /* Even on its own it won't fit */
+    if (length > state->maxArgLength || state->size + size > state->limit) {
+        fprintf(stderr, "xargs: argument line too long\n");
+        state->status = 1;
+        state->stop   = true;
+        return;
+    }
+
+    if (state->count == state->offsetCapacity) {
+        state->offsetCapacity = state->offsetCapacity ? state->offsetCapacity * 2 : 1024;
+        state->offsets        = realloc(state->offsets,
+                                        state->offsetCapacity * sizeof(size_t));
+    }
+    state->offsets[state->count++] = start;
+    state->size                   += size;
+}
+
+/*
+ * spawnBatch
+ *
+ * Starts the command on the pending arguments, after waiting for a running
+ * one to finish if -P of them are already going.  The pending batch is
+ * emptied.
+ */
+static void spawnBatch(XargsState* state) {
+    size_t count = state->count;
+    size_t total = state->fixedCount + count + 1;
+    size_t i;
+    pid_t  pid;
+    int    error;
+
+    while (state->runningCount >= state->maxProcs) {
+        waitForChild(state);
+    }
+    if (state->stop) {
+        return;
+    }
+
+    if (total > state->argvCapacity) {
+        state->argvCapacity = total;
+        state->argv         = realloc(state->argv, total * sizeof(char*));
+    }
+    memcpy(state->argv, state->fixed, state->fixedCount * sizeof(char*));
+    for (i = 0; i < count; ++i) {
+        state->argv[state->fixedCount + i] = state->text + state->offsets[i];
+    }
+    state->argv[total - 1] = NULL;
+
+    /* posix_spawn() returns once the child has exec'ed, so argv can be reused */
+    error = posix_spawn(&pid, state->program, &state->fileActions, NULL,
+                        state->argv, environ);
+    if (error != 0) {
+        fprintf(stderr, "xargs: %s: %s\n", state->argv[0], strerror(error));
+        state->status = error == ENOENT ? 127 : 126;
+        state->stop   = true;
+        return;
+    }
+    state->running[state->runningCount++] = pid;
+    state->execs++;
+
+    state->size       = state->baseSize;
+    state->count      = 0;
+    state->textLength = 0;
+}
+
+/*
+ * waitForChild
+ *
+ * Waits for one of the commands xargs started to finish and folds its exit
+ * status into the overall one.  Other children of this process (such as
+ * the left-hand side of a pipeline into xargs, or a background job) are
+ * handed to the job table.
+ */
+static void waitForChild(XargsState* state) {
+    int   status;
+    pid_t pid = waitpid(-1, &status, 0);
+    int   i;
+
+    if (pid < 0) {
+        if (errno != EINTR) {
+            state->runningCount = 0;
+        }
+        return;
+    }
+    for (i = 0; i < state->runningCount && state->running[i] != pid; ++i) {
+    }
+    if (i == state->runningCount) {
+        jobFinished(pid, status, NULL);
+        return;
+    }
+    state->running[i] = state->running[--state->runningCount];
+
+    if (WIFSIGNALED(status)) {
+        state->status = 125;
+        state->stop   = true;
+    } else if (WEXITSTATUS(status) == 255) {
+        state->status = 124;
+        state->stop   = true;
+    } else if (WEXITSTATUS(status) != 0 && state->status == 0) {
+        state->status = 123;
+    }
+}
+
+/*
+ * parseCount
+ *
+ * Parses the value 'text' of the numeric option 'option' into 'value'.
+ * Prints a message and returns false if it isn't a non-negative number.
+ */
+static bool parseCount(const char* text, const char* option, size_t* value) {
+    char* end;
+
+    *value = strtoul(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || *text == '-') {
+        printf("xargs: invalid number for %s: '%s'\n", option, text);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,22 @@
+/*
+ * shellXargs.h
+ *
+ * The built-in 'xargs' command, which runs a program on as many of the
+ * arguments read from standard input at a time as the kernel will accept.
+ */
+#ifndef SHELL_XARGS_H
+#define SHELL_XARGS_H
+
+/* Room left under ARG_MAX for the kernel's own bookkeeping (as GNU xargs) */
+#define XARGS_HEADROOM 2048
+
+/* Size of each read from standard input */
+#define XARGS_READ_SIZE (64 * 1024)
+
+/* Most commands -P will run at once */
+#define XARGS_MAX_PROCS 256
+
+/* Function prototypes */
+int  doXargs(char** args);
+
+#endif